@@ -1,7 +1,5 @@
 #include <stdio.h>
 
-#define MAX_CLINE 200
-
 /**
  * Include files for open(), read(), etc.
  * See **man** 3 open
@@ -10,12 +8,14 @@
 #include <sys/stat.h>
 #include <fcntl.h>
 
-#include <unistd.h>  // for lseek() 
+#include <unistd.h>  // for pread() 
+#include <sys/mman.h> // for mmap()
 #include <errno.h>
 #include <string.h>  // for strlen(), etc;
 
 #include <ctype.h>   // for isspace
-#include <alloca.h>  // for alloca
+#include <stdlib.h>  // for malloc, free
+#include <limits.h>  // for UINT_MAX
 #include <assert.h>
 
 #include "readini.h"
@@ -33,47 +33,17 @@ int line_is_section_type(const char *buffer)
    return buffer[0] == '[';
 }
 
-/** @brief Reports if '[' and ']' in buffer, without regard to what's between the square braces. */
-int line_contains_section_head(const char *buffer)
-{
-   const char *ptr = "";
-   if (line_is_section_type(buffer))
-   {
-      ptr = buffer;
-      while (*++ptr && *ptr != ']')
-         ;
-   }
-
-   return *ptr == ']';
-}
-
 /** @brief Reports if buffer contains the *section_name* specified section header. */
 int line_is_section(const char *buffer, const char *section_name)
 {
    int len_name = strlen(section_name);
    if (line_is_section_type(buffer))
-      return len_name+1 < MAX_CLINE
-         && buffer[len_name+1] == ']'
-         && 0 == strncmp(&buffer[1], section_name, len_name);
+      return 0 == strncmp(&buffer[1], section_name, len_name)
+         && buffer[len_name+1] == ']';
    else
       return 0;
 }
 
-/**
- * @brief Read character at a time to first newline or EOF.
- */
-void discard_file_chars_to_newline(int fh)
-{
-   char minibuff;
-   ssize_t bytes_read;
-
-   while( (bytes_read = read(fh, &minibuff, 1)) )
-   {
-      if (minibuff == '\n')
-         break;
-   }
-}
-
 /**
  * @brief Scans the buffer to find a tag and value.
  *
@@ -83,431 +53,1369 @@ void discard_file_chars_to_newline(int fh)
  * substrings.
  */
 int ri_parse_line_info(const char *buffer, struct ri_line_info *li)
+{
+   return ri_parse_line_slice(buffer, buffer + strlen(buffer), li);
+}
+
+/**
+ * @brief Scans a line that ends at *end* to find a tag and value.
+ *
+ * The same as *ri_parse_line_info()*, for a line that need not be
+ * terminated.  The end of the tag is found with the vector kernel
+ * selected for the CPU.
+ */
+int ri_parse_line_slice(const char *line, const char *end, struct ri_line_info *li)
 {
    const char *ptr;
 
    memset(li, 0, sizeof(struct ri_line_info));
 
-   if (*buffer == '\0')
+   if (line >= end)
       return 0;
 
-   ptr = buffer;
-
    // Find first non-tag character
-   while (*++ptr && !is_end_tag(ptr))
-      ;
+   ptr = ri_scan.tag_end(line + 1, end);
 
-   li->tag = buffer;
-   li->len_tag = ptr - buffer;
+   li->tag = line;
+   li->len_tag = ptr - line;
 
-   if (*ptr)
-   {
-      // move past spaces and/or operators to find value:
-      while (*++ptr && is_end_tag(ptr))
-         ;
+   // move past spaces and/or operators to find value:
+   while (ptr < end && is_end_tag(ptr))
+      ++ptr;
+
+   // Back-off ending spaces
+   while (end > ptr && is_space(end - 1))
+      --end;
 
+   if (end > ptr)
+   {
       li->value = ptr;
+      li->len_value = end - ptr;
+   }
+
+   return 1;
+}
 
-      // Find the end of the value
-      while (*++ptr)
-         ;
+/**
+ * @brief Head of list of readers opened by *ri_open()*.
+ *
+ * Each thread has its own list, so a reader is only ever used by
+ * the thread whose *ri_open()* callback is running.
+ */
+__thread Reader *open_readers = NULL;
 
-      // Back-off ending spaces
-      if (ptr > li->value)
-      {
-         while (ptr > li->value && is_space(ptr))
-            --ptr;
+/**
+ * @brief Longest line read by the calling thread before truncation,
+ *        or 0 for no limit.  See *ri_set_line_limit()*.
+ */
+__thread int line_limit = 0;
 
-         li->len_value = ptr - li->value + 1;
-      }
-      else
-      {
-         li->value = NULL;
-         li->len_value = 0;
-      }
-   }
-   return 1;
+/**
+ * @brief Limit the length of lines read by the calling thread.
+ *
+ * By default, lines of any length are read whole.  With a limit,
+ * lines longer than *limit* characters are truncated with a warning
+ * by the readers and event parsers the thread then creates, as
+ * lines were before they could be read whole.  Documents made by
+ * *ri_load()* are never truncated.
+ *
+ * @param limit Longest line to read, or 0 for no limit.
+ *
+ * @return The previous limit.
+ */
+int ri_set_line_limit(int limit)
+{
+   int previous = line_limit;
+   line_limit = limit > 0 ? limit : 0;
+   return previous;
 }
 
 /**
- * @brief Read a line from an open file handle.
+ * @brief Prepare a block buffer to read from a file descriptor.
  *
- * @return TRUE until EOF
+ * The reader starts at the current file position of *fh*, and
+ * then reads with *pread()* at its own offset, never moving the file
+ * position, so any number of readers can share a file descriptor.
+ * Descriptors that can't seek, like pipes, are read sequentially.
+ * The block grows to hold the longest line read.
  *
- * This function reads characters until it reaches a newline or the EOF.
- * The buffer will contain as many of the read characters as fit, with 
- * the following conditions:
- * 
- * - The buffer string will be terminated with a '\0'.
- * - A comment, introduced by '#', will not be included in the buffer.
- * - An escaped '#' i.e. "\#" will be rendered as a single '#' in the tag,
- *   without being treated as an introduction to a comment.
- * - A too-long line will be truncated
- * - The function returns TRUE until the call after it reaches the EOF.
- * - With each return of **read_line**, the file pointer is at the
- *   beginning of a text line.
+ * @return TRUE if the block buffer was allocated, otherwise FALSE.
  */
-int read_line(int fh, char *buffer, int buff_len)
+int reader_init(Reader *rdr, int fh)
 {
-   char *ptr = buffer;
-   char *end = buffer + buff_len;
-   ssize_t bytes_read;
+   memset(rdr, 0, sizeof(Reader));
+   rdr->fh = fh;
+   rdr->line_limit = line_limit;
+   rdr->offset = lseek(fh, 0, SEEK_CUR);
+   if (rdr->offset == -1)
+   {
+      rdr->offset = 0;
+      rdr->sequential = 1;
+   }
 
-   *ptr = '\0';
+   ri_arena_init(&rdr->heads_arena, 0);
+   reader_check_file(rdr);
 
-   while (ptr < end)
+   rdr->block = (char*)malloc(RI_BLOCK_SIZE);
+   if (!rdr->block)
    {
-      bytes_read = read(fh, ptr, 1);
+      fprintf(stderr, "Failed to allocate read buffer.");
+      return 0;
+   }
 
-      if (bytes_read==0)
-      {
-         if (ptr > buffer)
-            // fake a newline if we've read some characters
-            *ptr = '\n';
-         else
-            // If EOF with no contents, we're done
-            return 0;
-      }
+   rdr->capacity = RI_BLOCK_SIZE;
+   return 1;
+}
 
-      // If a comment is starting, pretend it's the EOL
-      if (*ptr == '#')
-      {
-         if (ptr > buffer && *(ptr-1) == '\\')
-         {
-            *(ptr-1) = '#';
-            continue;
-         }
-         else
-         {
-            *ptr = '\n';
-            discard_file_chars_to_newline(fh);
-         }
-      }
+/** @brief Frees the block buffer and section heads of a reader. */
+void reader_release(Reader *rdr)
+{
+   RI_STAT_ADD(lines, rdr->lines);
+   RI_STAT_ADD(comment_lines, rdr->comment_lines);
+   RI_STATS_ONLY(rdr->lines = rdr->comment_lines = 0);
 
-      if (*ptr == '\n')
-         break;
-      // Ignore leading spaces:
-      else if ( is_space(ptr) && ptr == buffer)
-         continue;
-      else
-         ++ptr;
+   free(rdr->block);
+   rdr->block = NULL;
+   rdr->pos = rdr->end = rdr->capacity = 0;
+
+   free(rdr->cooked);
+   rdr->cooked = NULL;
+   rdr->cooked_size = 0;
+
+   reader_forget_heads(rdr);
+}
+
+/**
+ * @brief Move unread bytes to the front of the block and fill the rest.
+ *
+ * @return Number of bytes added to the block, 0 at EOF.
+ */
+int reader_fill(Reader *rdr)
+{
+   ssize_t bytes_read;
+
+   if (rdr->pos > 0)
+   {
+      memmove(rdr->block, &rdr->block[rdr->pos], rdr->end - rdr->pos);
+      rdr->offset += rdr->pos;
+      rdr->end -= rdr->pos;
+      rdr->pos = 0;
    }
 
-   // Reached end without finding newline.
-   if (ptr >= end)
+   do
    {
-      discard_file_chars_to_newline(fh);
-      *--ptr = '\n';
+      if (rdr->sequential)
+         bytes_read = read(rdr->fh, &rdr->block[rdr->end], rdr->capacity - rdr->end);
+      else
+         bytes_read = pread(rdr->fh, &rdr->block[rdr->end], rdr->capacity - rdr->end,
+                            rdr->offset + rdr->end);
    }
+   while (bytes_read == -1 && errno == EINTR);
 
-   if (*ptr == '\n')
-      *ptr = '\0';
+   RI_STAT_ADD(read_calls, 1);
 
-   return 1;
+   if (bytes_read <= 0)
+      return 0;
+
+   RI_STAT_ADD(bytes_read, bytes_read);
+   rdr->end += bytes_read;
+   return bytes_read;
 }
 
 /**
- * @brief Position the file pointer to the line following a named section head.
- *
- * @return TRUE if the section was found, otherwise FALSE (0).
+ * @brief Double the size of the block, to hold a line that fills it.
  *
- * A named section head is a string enclosed in square-brackets "[]".
- * If the function returns TRUE, the calling function can expect
- * the file pointer to be at the first content line of the section.
+ * @return TRUE if successful, FALSE if out of memory.
  */
-int find_section(int fh, const char* section_name)
+int reader_grow(Reader *rdr)
 {
-   char buffer[MAX_CLINE];
-   int len_name = strlen(section_name);
-   int found = 0;
+   char *larger;
 
-   // Move to top of the file:
-   lseek(fh, SEEK_SET, 0);
-
-   while (read_line(fh, buffer, MAX_CLINE))
+   if (rdr->capacity > INT_MAX / 2
+       || !(larger = (char*)realloc(rdr->block, rdr->capacity * 2)))
    {
-      if (buffer[0] == '['
-          && strncmp(&buffer[1], section_name, len_name)==0
-          && buffer[len_name+1] == ']')
-      {
-         found = 1;
-         break;
-      }
+      fprintf(stderr, "Failed to allocate read buffer.");
+      return 0;
    }
 
-   return found;
+   rdr->block = larger;
+   rdr->capacity *= 2;
+   return 1;
 }
 
 /**
- * @brief Works with read_inifile_section_recursive to collect configuration data.
+ * @brief Slice the next raw line out of the block buffer.
+ *
+ * @return TRUE until EOF
+ *
+ * Sets *line* to the first character of the line and *len* to the
+ * number of characters preceding the newline or EOF.  The slice
+ * remains valid until the next call to a reader function.
+ *
+ * A line that doesn't fit in the block is read whole by growing
+ * the block, so only the longest lines of a file cost a copy.  A
+ * line longer than the reader's line limit, or than a block that
+ * can't grow, is truncated, and the remainder of the line is
+ * discarded by the following call.
  */
-void read_inifile_section_lines(struct read_inifile_bundle* bundle)
+int reader_next_line(Reader *rdr, const char **line, int *len)
 {
-   struct ri_line_info li;
-   struct ri_line *new_iniline, *root = NULL, *tail = NULL;
-   char *tag, *value;
-   
-   char *buffer = bundle->buffer;
-
+   char *newline;
+   int scanned = 0;
 
-   while (read_line(bundle->fh, buffer, MAX_CLINE))
+   while (rdr->skip_to_newline)
    {
-      memset(&li, 0, sizeof(li));
-
-      if (line_is_section_type(buffer))
+      newline = (char*)memchr(&rdr->block[rdr->pos], '\n', rdr->end - rdr->pos);
+      if (newline)
       {
-         // Prevent callback-triggering while-loop exit
-         // by returning directly at return from recursion:
-         return read_inifile_section_recursive(bundle);
+         rdr->pos = newline - rdr->block + 1;
+         rdr->skip_to_newline = 0;
       }
-      else if ( ri_parse_line_info(buffer, &li) )
+      else
       {
-         new_iniline = (struct ri_line *)alloca(sizeof(struct ri_line));
-         memset(new_iniline, 0, sizeof(struct ri_line));
-
-         // Set empty tail members to tag/value of the line
-         tag = (char *)alloca(li.len_tag+1);
-         memcpy(tag, li.tag, li.len_tag);
-         tag[li.len_tag] = '\0';
-         new_iniline->tag = tag;
-
-         if (li.len_value)
-         {
-            value = (char*)alloca(li.len_value+1);
-            memcpy(value, li.value, li.len_value);
-            value[li.len_value] = '\0';
-
-            new_iniline->value = value;
-         }
-
-         if (tail)
-         {
-            tail->next = new_iniline;
-            tail = new_iniline;
-         }
-         else
-            bundle->tail->lines = root = tail = new_iniline;
+         rdr->pos = rdr->end;
+         if (!reader_fill(rdr))
+            rdr->skip_to_newline = 0;
       }
    }
 
-   // Despite the recursion, we should only arrive here once,
-   // when the configuration file has been completely read.
-   // We'll close the file handle before invoking the callback
-   // to preserve system resources.
-   //
-   // Further, we close the file and set the file descriptor
-   // in *bundle* to -1 so it won't be closed twice.
-   close(bundle->fh);
-   bundle->fh = -1;
-
-   // Make linked data available to requesting function
-   (*bundle->ifu)(bundle->head, bundle->data);
-}
+   while (1)
+   {
+      newline = (char*)memchr(&rdr->block[rdr->pos + scanned],
+                              '\n',
+                              rdr->end - rdr->pos - scanned);
+      if (newline)
+         break;
 
-/**
- * When entering this function, the bundle->buffer must contain
- * the section line, so the it can be called for the next section
- * header without having to rewind the file.
- */
-void read_inifile_section_recursive(struct read_inifile_bundle* bundle)
-{
-   assert(bundle->buffer[0] == '[');
+      scanned = rdr->end - rdr->pos;
 
-   char *ptr;
-   struct ri_section* new_inisection = NULL;
-   char *buffer = bundle->buffer;
-   char *section_name = NULL;
-   int section_name_length = 0;
+      if ((rdr->line_limit && scanned > rdr->line_limit)
+          || (rdr->pos == 0 && rdr->end == rdr->capacity && !reader_grow(rdr)))
+      {
+         // Line too long to read: truncate it here
+         rdr->skip_to_newline = 1;
+         break;
+      }
+      else if (!reader_fill(rdr))
+         break;
+   }
 
-   // Find trailing ']' to delimit section name.
-   // Initial increment to skip the leading '[',
-   ptr = buffer;
-   while (*++ptr && *ptr != ']')
-      ;
+   *line = &rdr->block[rdr->pos];
 
-   if (*ptr)
+   if (newline)
    {
-      section_name_length = ptr - buffer - 1;
-      section_name = (char*)alloca(section_name_length+1);
-      memcpy(section_name, &buffer[1], section_name_length);
-      section_name[section_name_length] = '\0';
+      *len = newline - *line;
+      rdr->pos += *len + 1;
+   }
+   else if (rdr->pos == rdr->end)
+      return 0;
+   else
+   {
+      // Final line without newline, or truncated line
+      *len = rdr->end - rdr->pos;
+      rdr->pos = rdr->end;
    }
 
-   if (section_name)
+   if (rdr->line_limit && *len > rdr->line_limit)
    {
-      new_inisection = (struct ri_section*)alloca(sizeof(struct ri_section));
-      memset(new_inisection, 0, sizeof(struct ri_section));
-      new_inisection->section_name = section_name;
+      fprintf(stderr, "Line truncated to %d characters.", rdr->line_limit);
+      *len = rdr->line_limit;
+      RI_STAT_ADD(truncated_lines, 1);
+   }
+   else if (rdr->skip_to_newline)
+      RI_STAT_ADD(truncated_lines, 1);
 
-      if (bundle->tail)
-      {
-         bundle->tail->next = new_inisection;
-         bundle->tail = new_inisection;
-      }
-      else
-         bundle->tail = bundle->head = new_inisection;
+   return 1;
+}
 
-      read_inifile_section_lines(bundle);
-   }
+/** @brief Returns the file offset of the next line to be read. */
+off_t reader_tell(const Reader *rdr)
+{
+   return rdr->offset + rdr->pos;
 }
 
 /**
- * @brief Opens a file, invokes callback with file descriptor, then closes file.
- *
- * A simple implementation of my model of resource cleanup: call this function
- * with a callback argument that is invoked when the resources are available.
- * When the callback function returns, the resources are unwound.
+ * @brief Position reader to read from a file offset.
  *
- * @param[in] path         Path to configuration file.
- * @param[in] cb_file_user Function pointer called with an open file descriptor.
- * @param[in] data         Castable void pointer to custom application data.
+ * No system call is made: the block is refilled from the new
+ * offset when the next line is needed, unless the offset is
+ * already in the block.
  */
-void ri_open(const char *path, ri_File_User cb_file_user, void* data)
+void reader_seek(Reader *rdr, off_t offset)
 {
-   int fh = open(path, O_RDONLY);
-   if (fh == -1)
-   {
-      fprintf(stderr, "Failed to open \"%s\".", path);
-   }
+   rdr->skip_to_newline = 0;
+
+   if (offset >= rdr->offset && offset <= rdr->offset + rdr->end)
+      rdr->pos = offset - rdr->offset;
    else
    {
-      (*cb_file_user)(fh, data);
-      close(fh);
+      rdr->offset = offset;
+      rdr->pos = rdr->end = 0;
    }
 }
 
 /**
- * @brief Primary interface for acquiring the contents of a section.
- *
- * This function is used with an open file descriptor to retrieve
- * the lines of a specific section.  It works with a file descriptor
- * to support loading multiple sections without closing and opening
- * the file between section readings.
-
- * @param fh               File descriptor of an open file.
- * @param section_name     Name of section to retrieve.
- * @param cb_lines_browser Callback function that will be called with a
- *                         pointer to the head of a **ri_line** linked list.
- * @param[in] data         Castable void pointer to custom application data.
+ * @brief Drop the contents of the block, so the next line is read from the file.
  */
-void ri_open_section(int fh, const char *section_name, ri_Lines_Browser cb_lines_browser, void* data)
+void reader_discard(Reader *rdr)
 {
-   off_t saved_offset = lseek(fh, SEEK_CUR, 0);
+   // The next read follows the last byte in the block:
+   rdr->offset += rdr->end;
+   rdr->pos = rdr->end = 0;
+   rdr->skip_to_newline = 0;
+}
 
-   char buffer[MAX_CLINE];
+/** @brief Clear the table of section head offsets. */
+void reader_forget_heads(Reader *rdr)
+{
+   ri_arena_release(&rdr->heads_arena);
+   memset(&rdr->heads, 0, sizeof(Name_Table));
+   rdr->heads_count = 0;
+   rdr->heads_scanned = 0;
+   rdr->heads_complete = 0;
+}
 
-   struct ri_line_info li;
-   struct ri_line *new_iniline, *root = NULL, *tail =NULL;
+/**
+ * @brief Forget section heads and buffered text if the file has changed.
+ *
+ * A file whose status can't be read is treated as changed, and its
+ * size is left unknown, so that it is scanned again from the top.
+ * Descriptors read sequentially can't be scanned again, so their
+ * buffered text is kept.
+ *
+ * @return TRUE if the file size and modification time are unchanged.
+ */
+int reader_check_file(Reader *rdr)
+{
+   struct stat st;
 
-   char *tag, *value;
+   if (rdr->sequential)
+      return 1;
 
-   if (find_section(fh, section_name))
+   if (fstat(rdr->fh, &st))
    {
-      while (read_line(fh, buffer, MAX_CLINE))
-      {
-         if (line_is_section_type(buffer))
-            break;
-         else if ( ri_parse_line_info(buffer, &li) )
-         {
-            new_iniline = (struct ri_line *)alloca(sizeof(struct ri_line));
-            memset(new_iniline, 0, sizeof(struct ri_line));
-
-            // Set empty tail members to tag/value of the line
-            tag = (char *)alloca(li.len_tag+1);
-            memcpy(tag, li.tag, li.len_tag);
-            tag[li.len_tag] = '\0';
-            new_iniline->tag = tag;
-
-            if (li.len_value)
-            {
-               value = (char*)alloca(li.len_value+1);
-               memcpy(value, li.value, li.len_value);
-               value[li.len_value] = '\0';
+      reader_forget_heads(rdr);
+      reader_discard(rdr);
+      rdr->file_size = -1;
+      return 0;
+   }
 
-               new_iniline->value = value;
-            }
+   if (st.st_size == rdr->file_size
+       && st.st_mtim.tv_sec == rdr->file_mtime.tv_sec
+       && st.st_mtim.tv_nsec == rdr->file_mtime.tv_nsec)
+      return 1;
 
-            if (tail)
-            {
-               tail->next = new_iniline;
-               tail = new_iniline;
-            }
-            else
-               root = tail = new_iniline;
-         }
-      };
-   }
+   reader_forget_heads(rdr);
+   reader_discard(rdr);
 
-   (*cb_lines_browser)(fh, root, data);
-   
-   lseek(fh, SEEK_SET, saved_offset);
+   rdr->file_size = st.st_size;
+   rdr->file_mtime = st.st_mtim;
+   return 0;
 }
 
 /**
- * @brief Return value string associated with a tag name.
- *
- * Scans a linked list of lines info for a line whose tag
- * value matches the *tag_name* parameter.
+ * @brief Save the offset of the first content line of a section.
  *
- * @param lines_head Pointer to first node of a linked list
- *                   of lines info.
- * @param tag_name   Name of tag to match in the linked lines
- *                   list.
+ * Only the first head of a repeated section name is recorded.  The
+ * name is a slice of *len* characters, which is copied to the heads
+ * arena to be looked up, and left there unused for a repeated name.
  *
- * @return Pointer to value string if tag is found and it
- *         has a value.  Nonexistent tags and empty found
- *         tags will return NULL;
+ * @return TRUE if successful, FALSE if out of memory.
  */
-const char* ri_find_value(const struct ri_line* lines_head,
-                          const char* tag_name)
+int reader_record_head(Reader *rdr, const char *name, int len, off_t offset)
 {
-   const struct ri_line *ptr = lines_head;
+   Name_Slot *slot;
+   unsigned hash;
+   off_t *saved;
+   char *copy;
 
-   while (ptr)
+   if (!name_table_grow(&rdr->heads, rdr->heads_count + 1, &rdr->heads_arena)
+       || !(copy = arena_strndup(&rdr->heads_arena, name, len)))
+      return 0;
+
+   hash = ri_hash(copy);
+   slot = name_table_probe(&rdr->heads, copy, hash);
+   if (!slot->node)
    {
-      if (0 == strcmp(ptr->tag, tag_name))
-         return ptr->value;
+      saved = (off_t*)ri_arena_alloc(&rdr->heads_arena, sizeof(off_t));
+      if (!saved)
+         return 0;
+
+      *saved = offset;
+      slot->name = copy;
+      slot->hash = hash;
+      slot->node = saved;
+      ++rdr->heads_count;
+   }
+
+   return 1;
+}
 
+/** @brief Return the reader registered by *ri_open()* for a file descriptor. */
+Reader *find_reader(int fh)
+{
+   Reader *ptr = open_readers;
+   while (ptr && ptr->fh != fh)
       ptr = ptr->next;
-   }
 
-   return NULL;
+   return ptr;
 }
 
 /**
- * @brief Retrieve a named section in order to scan its contents.
+ * @brief Read the contents of a line from a reader's block buffer.
  *
- * Note that scanning sections can only find sections that are or
- * follow the **root** section.  This is because the sections are
- * single-link chains that do not know which or whether another
- * section is pointing at it.
+ * @return TRUE until EOF
+ *
+ * Sets *line* and *len* to a slice of the next line, which remains
+ * valid until the next call to a reader function, with the following
+ * conditions:
+ *
+ * - The slice is not terminated.
+ * - Leading spaces are skipped.
+ * - A comment, introduced by '#', is not included in the slice.
+ * - An escaped '#' i.e. "\#" will be rendered as a single '#' in the tag,
+ *   without being treated as an introduction to a comment.  Such a
+ *   line is compacted in a copy, so the block remains as read.
+ * - A line is truncated only if it is longer than the reader's
+ *   line limit, or too long to allocate.
+ * - The function returns TRUE until the call after it reaches the EOF.
+ * - With each return of **read_line**, the reader is positioned at
+ *   the beginning of a text line.
  */
-const ri_Section* ri_get_section(const ri_Section* root, const char *name)
+int read_line(Reader *rdr, const char **line, int *len)
 {
-   const ri_Section* ptr = root;
-   while (ptr)
+   const char *ptr, *end, *comment;
+   char *larger, *cooked_end;
+
+   if (!reader_next_line(rdr, &ptr, len))
    {
-      if (0 == strcmp(ptr->section_name, name))
-         return ptr;
-      else
-         ptr = ptr->next;
+      *len = 0;
+      return 0;
    }
 
-   return NULL;
-}
+   end = ptr + *len;
+   RI_STATS_ONLY(++rdr->lines);
 
+   // Ignore leading spaces:
+   while (ptr < end && is_space(ptr))
+      ++ptr;
 
-/**
- * @brief Reads an entire configuration file into a linked list.
- *
- * Opens and reads the configuration file into a linked list of
- * sections, leaving out the comments and empty lines.
- *
- * @param filepath            Path to the configuration file.
- * @param cb_sections_browser Pointer to function that will consume the
- *                            sections linked list.  **Do not** quote
- *                            the function name.  See example below.
- * @param data                This parameter value will be passed back
+   comment = (const char*)memchr(ptr, '#', end - ptr);
+   RI_STATS_ONLY(rdr->comment_lines += comment == ptr);
+   if (comment && comment > ptr && *(comment-1) == '\\')
+   {
+      if (rdr->cooked_size < end - ptr + 1)
+      {
+         larger = (char*)realloc(rdr->cooked, end - ptr + 1);
+         if (larger)
+         {
+            rdr->cooked = larger;
+            rdr->cooked_size = end - ptr + 1;
+         }
+      }
+
+      if (rdr->cooked_size >= end - ptr + 1)
+      {
+         memcpy(rdr->cooked, ptr, end - ptr);
+         cooked_end = rdr->cooked + (end - ptr);
+         ptr = cook_line(rdr->cooked, &cooked_end);
+         end = cooked_end;
+      }
+      else
+      {
+         // Out of memory: treat the escaped '#' as a comment
+         fprintf(stderr, "Failed to allocate read buffer.");
+         end = comment;
+      }
+   }
+   else if (comment)
+      end = comment;
+
+   *line = ptr;
+   *len = end - ptr;
+
+   return 1;
+}
+
+/**
+ * @brief Position the reader to the line following a named section head.
+ *
+ * @return TRUE if the section was found, otherwise FALSE (0).
+ *
+ * A named section head is a string enclosed in square-brackets "[]".
+ * If the function returns TRUE, the calling function can expect
+ * the reader to be at the first content line of the section.
+ *
+ * The offset of every section head passed while scanning is recorded
+ * in the reader, so a section that has already been passed is found
+ * with a single seek, and a new search resumes where the last one
+ * stopped instead of at the top of the file.  The record is discarded
+ * if the size or modification time of the file changes, or its status
+ * can't be read.
+ */
+int find_section(Reader *rdr, const char* section_name)
+{
+   const char *line, *close;
+   const Name_Slot *slot;
+   int len, recording = 1;
+   int len_name = strlen(section_name);
+
+   reader_check_file(rdr);
+
+   if (rdr->heads.slots)
+   {
+      slot = name_table_probe(&rdr->heads, section_name, ri_hash(section_name));
+      if (slot->node)
+      {
+         reader_seek(rdr, *(const off_t*)slot->node);
+         return 1;
+      }
+   }
+
+   if (rdr->heads_complete)
+      return 0;
+
+   // Resume scanning following the last recorded section head:
+   reader_seek(rdr, rdr->heads_scanned);
+
+   while (read_line(rdr, &line, &len))
+   {
+      if (len && line_is_section_type(line)
+          && (close = (const char*)memchr(line, ']', len)))
+      {
+         if (recording)
+         {
+            if (reader_record_head(rdr, line + 1, close - line - 1, reader_tell(rdr)))
+               rdr->heads_scanned = reader_tell(rdr);
+            else
+            {
+               // Out of memory: future searches will start from the top
+               reader_forget_heads(rdr);
+               recording = 0;
+            }
+         }
+
+         if (close - line - 1 == len_name && 0 == memcmp(line + 1, section_name, len_name))
+            return 1;
+      }
+   }
+
+   if (recording)
+   {
+      rdr->heads_scanned = reader_tell(rdr);
+      rdr->heads_complete = 1;
+   }
+
+   return 0;
+}
+
+/**
+ * @brief Prepare an arena to allocate from blocks of *block_size* bytes.
+ *
+ * No memory is allocated until the first call to *ri_arena_alloc()*.
+ */
+void ri_arena_init(Arena *arena, size_t block_size)
+{
+   arena->head = NULL;
+   arena->block_size = block_size < 4096 ? 4096 : block_size;
+}
+
+/**
+ * @brief Allocate pointer-aligned memory from an arena.
+ *
+ * When the current block is exhausted, a new block is allocated
+ * that is twice the size of the previous block.
+ *
+ * @return Pointer to memory, or NULL if the allocation failed.
+ */
+void *ri_arena_alloc(Arena *arena, size_t size)
+{
+   Arena_Block *block = arena->head;
+   size_t block_size;
+   void *ptr;
+
+   size = (size + sizeof(void*) - 1) & ~(sizeof(void*) - 1);
+
+   if (!block || block->size - block->used < size)
+   {
+      block_size = arena->block_size;
+      if (block)
+         block_size = block->size * 2;
+      if (block_size < size)
+         block_size = size;
+
+      block = (Arena_Block*)malloc(sizeof(Arena_Block) + block_size);
+      if (!block)
+      {
+         fprintf(stderr, "Failed to allocate parse memory.");
+         return NULL;
+      }
+
+      block->size = block_size;
+      block->used = 0;
+      block->next = arena->head;
+      arena->head = block;
+   }
+
+   ptr = &block->data[block->used];
+   block->used += size;
+   return ptr;
+}
+
+/** @brief Free all blocks of an arena at once. */
+void ri_arena_release(Arena *arena)
+{
+   Arena_Block *next, *block = arena->head;
+   while (block)
+   {
+      next = block->next;
+      free(block);
+      block = next;
+   }
+
+   arena->head = NULL;
+}
+
+/**
+ * @brief Take ownership of the blocks of another arena.
+ *
+ * The blocks are freed with those of *arena*, and *other* is left
+ * empty.  New allocations continue in the current block of *arena*.
+ */
+void ri_arena_adopt(Arena *arena, Arena *other)
+{
+   Arena_Block *tail = other->head;
+
+   if (!tail)
+      return;
+
+   if (!arena->head)
+      arena->head = other->head;
+   else
+   {
+      while (tail->next)
+         tail = tail->next;
+
+      tail->next = arena->head->next;
+      arena->head->next = other->head;
+   }
+
+   other->head = NULL;
+}
+
+/** @brief Size of the memory mapping used for a text of *len* bytes. */
+size_t mapped_text_size(size_t len)
+{
+   size_t page = sysconf(_SC_PAGESIZE);
+   return (len / page + 1) * page;
+}
+
+/**
+ * @brief Map a file for parsing in place.
+ *
+ * The file is mapped privately and writable, so terminating lines
+ * in place doesn't change the file.  The mapping is backed by an
+ * anonymous region at least one byte longer than the file, so the
+ * last line can be terminated even if the file ends on a page boundary.
+ *
+ * @return Pointer to the first character of the file, NULL on failure.
+ */
+char *map_text(int fh, size_t len)
+{
+   size_t map_len = mapped_text_size(len);
+   void *base = mmap(NULL, map_len, PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_ANONYMOUS, -1, 0);
+
+   if (base == MAP_FAILED)
+      return NULL;
+
+   if (len && mmap(base, len, PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_FIXED, fh, 0) == MAP_FAILED)
+   {
+      munmap(base, map_len);
+      return NULL;
+   }
+
+   RI_STAT_ADD(bytes_mapped, len);
+   return (char*)base;
+}
+
+/** @brief Release a mapping made by *map_text()*. */
+void unmap_text(char *text, size_t len)
+{
+   munmap(text, mapped_text_size(len));
+}
+
+/**
+ * @brief Apply the *read_line()* rules to a line, in place.
+ *
+ * @param line First character of a line.
+ * @param end  Pointer to the newline or EOF following the line.  On
+ *             return, set to the '\0' terminating the cooked line.
+ *
+ * @return Pointer to the first character of the cooked line.
+ *
+ * Leading spaces and comments are dropped, and escaped '#' characters
+ * are compacted to a single '#'.  The line is only moved if it
+ * contains an escaped '#'.
+ */
+char *cook_line(char *line, char **end)
+{
+   char *ptr, *out;
+
+   // Ignore leading spaces:
+   while (line < *end && is_space(line))
+      ++line;
+
+   ptr = (char*)memchr(line, '#', *end - line);
+   if (ptr)
+   {
+      if (ptr == line || *(ptr-1) != '\\')
+         *end = ptr;
+      else
+      {
+         out = ptr;
+         while (ptr < *end)
+         {
+            if (*ptr == '#')
+            {
+               if (out > line && *(out-1) == '\\')
+               {
+                  *(out-1) = '#';
+                  ++ptr;
+                  continue;
+               }
+               else
+                  break;
+            }
+
+            *out++ = *ptr++;
+         }
+
+         *end = out;
+      }
+   }
+
+   **end = '\0';
+   return line;
+}
+
+/**
+ * @brief Append an entry to a growable array.
+ *
+ * @return Pointer to the new entry, or NULL if out of memory.
+ */
+ri_Entry *add_entry(ri_Entry **entries, unsigned *count, unsigned *capacity)
+{
+   ri_Entry *larger;
+
+   if (*count == *capacity)
+   {
+      larger = (ri_Entry*)realloc(*entries, *capacity * 2 * sizeof(ri_Entry));
+      if (!larger)
+      {
+         fprintf(stderr, "Failed to allocate parse memory.");
+         return NULL;
+      }
+
+      *entries = larger;
+      *capacity *= 2;
+   }
+
+   return &(*entries)[(*count)++];
+}
+
+/**
+ * @brief Move the entries of a parse into the arena, with their lines.
+ *
+ * Each section's entries are a contiguous run of the array, and its
+ * compatibility **ri_Line** chain is a contiguous run of a parallel
+ * array of line nodes.
+ *
+ * @return TRUE if successful, FALSE if out of memory.
+ */
+int place_entries(ri_Section *head, const char *pool,
+                  const ri_Entry *entries, unsigned count, Arena *arena)
+{
+   ri_Entry *placed = (ri_Entry*)ri_arena_alloc(arena, count * sizeof(ri_Entry));
+   Line_Node *line = (Line_Node*)ri_arena_alloc(arena, count * sizeof(Line_Node));
+   Section_Node *section;
+   unsigned index;
+
+   if (!placed || !line)
+      return 0;
+
+   memcpy(placed, entries, count * sizeof(ri_Entry));
+
+   for (section = SECTION_NODE(head); section; section = SECTION_NODE(section->section.next))
+   {
+      section->pool = pool;
+      section->entries = placed;
+      section->section.lines = section->entry_count ? &line->line : NULL;
+
+      for (index = 0; index < section->entry_count; ++index, ++placed, ++line)
+      {
+         line->line.tag = &pool[placed->tag_off];
+         line->line.value = placed->value_len ? &pool[placed->value_off] : NULL;
+         line->line.next = index + 1 < section->entry_count ? &line[1].line : NULL;
+         line->section = &section->section;
+         line->typed = 0;
+      }
+   }
+
+   return 1;
+}
+
+/**
+ * @brief Parse a text buffer into a linked list of sections.
+ *
+ * Tags, values and section names are terminated in place in the
+ * text buffer, so the nodes in *arena* point into the buffer instead
+ * of holding copies.  Lines preceding the first section, and lines
+ * following a section head without a closing ']', are ignored.
+ *
+ * The lines of each section are recorded in a contiguous array of
+ * **ri_Entry** offsets into the text, from which a contiguous array
+ * of **ri_Line** nodes is linked for compatibility.
+ *
+ * @param result Set to the head of the sections list, or NULL if no
+ *               sections were found or the text couldn't be parsed.
+ *
+ * @return TRUE if successful, FALSE if the text is too large or out
+ *         of memory, so that a failure isn't taken for a text
+ *         without sections.
+ */
+int parse_text(char *text, size_t len, Arena *arena, ri_Section **result)
+{
+   struct ri_line_info li;
+   ri_Section *head = NULL, *section = NULL, *new_section;
+   ri_Entry *entries, *entry;
+   unsigned count = 0, capacity = len / 32 + 16;
+   char *ptr = text, *end = text + len;
+   char *line, *eol, *close;
+   int section_open = 0, failed = 0;
+   RI_STATS_ONLY(uint64_t lines = 0; uint64_t comment_lines = 0; uint64_t sections = 0;)
+
+   *result = NULL;
+
+   if (len >= UINT_MAX)
+   {
+      fprintf(stderr, "File too large to parse.");
+      return 0;
+   }
+
+   entries = (ri_Entry*)malloc(capacity * sizeof(ri_Entry));
+   if (!entries)
+   {
+      fprintf(stderr, "Failed to allocate parse memory.");
+      return 0;
+   }
+
+   while (ptr < end)
+   {
+      line = ptr;
+
+      // Ignore leading spaces:
+      while (line < end && is_space(line))
+         ++line;
+
+      // Find the newline or comment that ends the line contents
+      eol = (char*)ri_scan.line_end(line, end);
+      RI_STATS_ONLY(++lines; comment_lines += eol == line && eol < end && *eol == '#');
+
+      if (eol < end && *eol == '#')
+      {
+         ptr = (char*)memchr(eol, '\n', end - eol);
+         ptr = ptr ? ptr + 1 : end;
+
+         // Escaped '#' characters must be compacted:
+         if (eol > line && *(eol-1) == '\\')
+         {
+            eol = ptr > eol && *(ptr-1) == '\n' ? ptr - 1 : end;
+            line = cook_line(line, &eol);
+         }
+      }
+      else
+         ptr = eol + 1;
+
+      *eol = '\0';
+
+      if (line_is_section_type(line))
+      {
+         // A head without ']' hides lines until the next section head
+         close = (char*)memchr(line, ']', eol - line);
+         section_open = close != NULL;
+
+         if (close)
+         {
+            *close = '\0';
+
+            new_section = (ri_Section*)ri_arena_alloc(arena, sizeof(Section_Node));
+            if (!new_section)
+            {
+               failed = 1;
+               break;
+            }
+
+            memset(new_section, 0, sizeof(Section_Node));
+            new_section->section_name = line + 1;
+
+            if (section)
+               section->next = new_section;
+            else
+               head = new_section;
+
+            section = new_section;
+            RI_STATS_ONLY(++sections);
+         }
+      }
+      else if (section_open && ri_parse_line_slice(line, eol, &li))
+      {
+         if (!(entry = add_entry(&entries, &count, &capacity)))
+         {
+            failed = 1;
+            break;
+         }
+
+         entry->tag_off = li.tag - text;
+         entry->tag_len = li.len_tag;
+         ((char*)li.tag)[li.len_tag] = '\0';
+
+         entry->value_off = li.len_value ? li.value - text : 0;
+         entry->value_len = li.len_value;
+         if (li.len_value)
+            ((char*)li.value)[li.len_value] = '\0';
+
+         ++SECTION_NODE(section)->entry_count;
+      }
+   }
+
+   // A partial list would pass for the whole file:
+   if (failed || !place_entries(head, text, entries, count, arena))
+      failed = 1;
+   else
+      *result = head;
+
+   free(entries);
+
+   RI_STAT_ADD(lines, lines);
+   RI_STAT_ADD(comment_lines, comment_lines);
+   RI_STAT_ADD(sections, sections);
+   RI_STAT_ADD(keys, count);
+
+   return !failed;
+}
+
+/**
+ * @brief Allocate a '\0'-terminated copy of *len* characters in an arena.
+ */
+char *arena_strndup(Arena *arena, const char *str, int len)
+{
+   char *copy = (char*)ri_arena_alloc(arena, len+1);
+   if (copy)
+   {
+      memcpy(copy, str, len);
+      copy[len] = '\0';
+   }
+
+   return copy;
+}
+
+/**
+ * @brief Reads the lines of a section into an arena.
+ *
+ * @param rdr    Reader positioned at the first content line of a section.
+ * @param arena  Arena in which to allocate nodes and strings, or NULL
+ *               to skip the section without collecting the lines.
+ * @param head   On return, set to a slice of the following section
+ *               head, as by *read_line()*.
+ * @param len    On return, set to the length of *head*, or 0 at EOF.
+ * @param section Section to which the lines belong, if any.
+ * @param names  Set in which to intern the tags, instead of copying
+ *               each, or NULL.
+ * @param result On success, set to the head of the linked list of
+ *               lines, or NULL if the section has none.
+ *
+ * @return TRUE if successful, FALSE if out of memory.
+ */
+int read_section_lines(Reader *rdr, Arena *arena, const char **head, int *len,
+                       const ri_Section *section, Name_Set *names, ri_Line **result)
+{
+   struct ri_line_info li;
+   ri_Line *new_line, *root = NULL, *tail = NULL;
+   int failed = 0;
+   RI_STATS_ONLY(uint64_t keys = 0;)
+
+   while (read_line(rdr, head, len))
+   {
+      if (*len && line_is_section_type(*head))
+         break;
+      else if (arena && ri_parse_line_slice(*head, *head + *len, &li))
+      {
+         new_line = (ri_Line*)ri_arena_alloc(arena, sizeof(Line_Node));
+         if (!new_line)
+         {
+            failed = 1;
+            break;
+         }
+
+         memset(new_line, 0, sizeof(Line_Node));
+         LINE_NODE(new_line)->section = section;
+
+         if (names)
+            new_line->tag = name_set_add(names, li.tag, li.len_tag, arena);
+         else
+            new_line->tag = arena_strndup(arena, li.tag, li.len_tag);
+
+         // A partial list would pass for the whole section:
+         if (!new_line->tag
+             || (li.len_value && !(new_line->value = arena_strndup(arena, li.value, li.len_value))))
+         {
+            failed = 1;
+            break;
+         }
+
+         if (tail)
+            tail->next = new_line;
+         else
+            root = new_line;
+
+         tail = new_line;
+         RI_STATS_ONLY(++keys);
+      }
+   }
+
+   RI_STAT_ADD(keys, keys);
+
+   // Keep the following section head, unless stopped by EOF or failure:
+   if (failed || !*len || !line_is_section_type(*head))
+      *len = 0;
+
+   if (!failed)
+      *result = root;
+
+   return !failed;
+}
+
+/**
+ * @brief Reads all the sections of a file into an arena.
+ *
+ * The file is read in a loop rather than by recursion, so the stack
+ * use doesn't depend on the number of sections in the file.  A
+ * section head without a closing ']' is skipped with its lines.
+ * Tags are interned, so a tag repeated through the sections of the
+ * file is stored once.  Section names, which seldom repeat, are not.
+ *
+ * @param result On success, set to the head of the linked list of
+ *               sections, or NULL if the file has none.
+ *
+ * @return TRUE if successful, FALSE if out of memory.
+ */
+int read_sections(Reader *rdr, Arena *arena, ri_Section **result)
+{
+   ri_Section *new_section, *head = NULL, *tail = NULL;
+   ri_Line *lines;
+   const char *line, *close;
+   Name_Set names;
+   int len, failed = 0;
+
+   memset(&names, 0, sizeof(Name_Set));
+
+   // Read lines until the first section
+   while (read_line(rdr, &line, &len) && !(len && line_is_section_type(line)))
+      ;
+
+   // Each pass through the loop starts with a section head in the line
+   while (len && line_is_section_type(line))
+   {
+      close = (const char*)memchr(line, ']', len);
+      if (!close)
+      {
+         read_section_lines(rdr, NULL, &line, &len, NULL, NULL, &lines);
+         continue;
+      }
+
+      new_section = (ri_Section*)ri_arena_alloc(arena, sizeof(Section_Node));
+      if (!new_section)
+      {
+         failed = 1;
+         break;
+      }
+
+      memset(new_section, 0, sizeof(Section_Node));
+
+      if (!(new_section->section_name = arena_strndup(arena, line + 1, close - line - 1)))
+      {
+         failed = 1;
+         break;
+      }
+
+      if (tail)
+         tail->next = new_section;
+      else
+         head = new_section;
+
+      tail = new_section;
+      RI_STAT_ADD(sections, 1);
+
+      if (!read_section_lines(rdr, arena, &line, &len, new_section, &names, &lines))
+         failed = 1;
+      else
+         new_section->lines = lines;
+   }
+
+   // A partial list would pass for the whole file:
+   if (!failed)
+      *result = head;
+
+   return !failed;
+}
+
+/**
+ * @brief Opens a file, invokes callback with file descriptor, then closes file.
+ *
+ * A simple implementation of my model of resource cleanup: call this function
+ * with a callback argument that is invoked when the resources are available.
+ * When the callback function returns, the resources are unwound.
+ *
+ * @param[in] path         Path to configuration file.
+ * @param[in] cb_file_user Function pointer called with an open file descriptor.
+ * @param[in] data         Castable void pointer to custom application data.
+ */
+void ri_open(const char *path, ri_File_User cb_file_user, void* data)
+{
+   Reader reader;
+
+   int fh = open(path, O_RDONLY);
+   if (fh == -1)
+   {
+      fprintf(stderr, "Failed to open \"%s\".", path);
+   }
+   else
+   {
+      if (reader_init(&reader, fh))
+      {
+         // Register the reader for use by ri_open_section():
+         reader.next = open_readers;
+         open_readers = &reader;
+
+         (*cb_file_user)(fh, data);
+
+         open_readers = reader.next;
+         reader_release(&reader);
+      }
+
+      close(fh);
+   }
+}
+
+/**
+ * @brief Primary interface for acquiring the contents of a section.
+ *
+ * This function is used with an open file descriptor to retrieve
+ * the lines of a specific section.  It works with a file descriptor
+ * to support loading multiple sections without closing and opening
+ * the file between section readings.
+ *
+ * Sections are read at absolute offsets, so the file position of
+ * *fh* is neither used nor moved, and threads can read sections
+ * through the same descriptor at the same time.
+
+ * @param fh               File descriptor of an open file.
+ * @param section_name     Name of section to retrieve.
+ * @param cb_lines_browser Callback function that will be called with a
+ *                         pointer to the head of a **ri_line** linked list.
+ * @param[in] data         Castable void pointer to custom application data.
+ */
+void ri_open_section(int fh, const char *section_name, ri_Lines_Browser cb_lines_browser, void* data)
+{
+   Reader local_reader, *rdr = find_reader(fh);
+   off_t saved_offset;
+
+   const char *head;
+   int len;
+   Arena arena;
+   ri_Line *root = NULL;
+
+   // Use a temporary reader if *fh* wasn't opened with ri_open():
+   if (!rdr)
+   {
+      if (!reader_init(&local_reader, fh))
+         return;
+      rdr = &local_reader;
+   }
+
+   saved_offset = reader_tell(rdr);
+
+   ri_arena_init(&arena, 0);
+
+   // A partial list would pass for the whole section:
+   if (find_section(rdr, section_name)
+       && !read_section_lines(rdr, &arena, &head, &len, NULL, NULL, &root))
+      fprintf(stderr, "Failed to read section \"%s\".", section_name);
+   else
+      (*cb_lines_browser)(fh, root, data);
+
+   ri_arena_release(&arena);
+   reader_seek(rdr, saved_offset);
+
+   if (rdr == &local_reader)
+      reader_release(rdr);
+}
+
+/**
+ * @brief Return value string associated with a tag name.
+ *
+ * Scans a linked list of lines info for a line whose tag
+ * value matches the *tag_name* parameter.
+ *
+ * @param lines_head Pointer to first node of a linked list
+ *                   of lines info.
+ * @param tag_name   Name of tag to match in the linked lines
+ *                   list.
+ *
+ * @return Pointer to value string if tag is found and it
+ *         has a value.  Nonexistent tags and empty found
+ *         tags will return NULL;
+ */
+const char* ri_find_value(const struct ri_line* lines_head,
+                          const char* tag_name)
+{
+   const struct ri_line *line = ri_find_line(lines_head, tag_name);
+   return line ? line->value : NULL;
+}
+
+/**
+ * @brief Return the line of a tag name, as found by *ri_find_value()*.
+ *
+ * The line can be passed to a typed conversion like
+ * *ri_line_int64()*, or kept to convert again later.
+ *
+ * *lines_head* must belong to a list made by the library, whose
+ * nodes carry private members after the public structure.
+ *
+ * @return Pointer to the first line with the tag, or NULL.
+ */
+const ri_Line* ri_find_line(const ri_Line* lines_head, const char* tag_name)
+{
+   const struct ri_line *ptr = lines_head;
+   const ri_Section *section = ptr ? LINE_NODE(ptr)->section : NULL;
+
+   // Use the index only if *lines_head* is the first line of its section:
+   if (section && SECTION_NODE(section)->index && section->lines == ptr)
+      return ri_index_find_line(section, tag_name, ri_hash(tag_name));
+
+   while (ptr)
+   {
+      if (0 == strcmp(ptr->tag, tag_name))
+         return ptr;
+
+      ptr = ptr->next;
+   }
+
+   return NULL;
+}
+
+/**
+ * @brief Retrieve a named section in order to scan its contents.
+ *
+ * Note that scanning sections can only find sections that are or
+ * follow the **root** section.  This is because the sections are
+ * single-link chains that do not know which or whether another
+ * section is pointing at it.
+ *
+ * Sections of a document loaded with RI_INDEX are found without
+ * scanning.  *root* must belong to a list made by the library, whose
+ * nodes carry private members after the public structure.
+ */
+const ri_Section* ri_get_section(const ri_Section* root, const char *name)
+{
+   const ri_Section* ptr = root;
+
+   if (ptr && SECTION_NODE(ptr)->index)
+   {
+      ptr = ri_index_get_section(ptr, name);
+      return ptr ? section_parsed(ptr) : NULL;
+   }
+   while (ptr)
+   {
+      if (0 == strcmp(ptr->section_name, name))
+         return section_parsed(ptr);
+      else
+         ptr = ptr->next;
+   }
+
+   return NULL;
+}
+
+
+/**
+ * @brief Prepare to iterate over the lines of a section as entries.
+ *
+ * Entries are only available for sections parsed in memory, by
+ * *ri_load()*, *ri_load_layers()* or *ri_read_file_mmap()*.  Walking
+ * entries touches only the contiguous entries array and the text
+ * they describe, rather than the line nodes.
+ *
+ * @param section Section whose lines will be iterated.
+ * @param iter    Iterator to initialize, usually on the stack.
+ *
+ * @return TRUE if the section has entries, FALSE if it has no
+ *         lines or was read by *ri_read_file()*.
+ *
+ * @code
+ * ri_Entry_Iter iter;
+ * const char *tag, *value;
+ * if (ri_entries(section, &iter))
+ *    while (ri_entry_next(&iter, &tag, &value))
+ *       printf("%s : %s\n", tag, value ? value : "");
+ * @endcode
+ */
+int ri_entries(const ri_Section *section, ri_Entry_Iter *iter)
+{
+   const Section_Node *node = SECTION_NODE(section_parsed(section));
+
+   iter->pool = node->pool;
+   iter->next = node->entries;
+   iter->end = node->entries ? node->entries + node->entry_count : NULL;
+
+   return iter->next != iter->end;
+}
+
+/**
+ * @brief Return the next entry of a section, or NULL if there are no more.
+ *
+ * @param iter  Iterator initialized by *ri_entries()*.
+ * @param tag   Optional, set to the '\0'-terminated tag of the entry.
+ * @param value Optional, set to the '\0'-terminated value of the entry,
+ *              or NULL if the tag has no value.
+ */
+const ri_Entry* ri_entry_next(ri_Entry_Iter *iter, const char **tag, const char **value)
+{
+   const ri_Entry *entry = iter->next;
+
+   if (entry == iter->end)
+      return NULL;
+
+   if (tag)
+      *tag = &iter->pool[entry->tag_off];
+   if (value)
+      *value = entry->value_len ? &iter->pool[entry->value_off] : NULL;
+
+   iter->next = entry + 1;
+   return entry;
+}
+
+/**
+ * @brief Reads an entire configuration file into a linked list.
+ *
+ * Opens and reads the configuration file into a linked list of
+ * sections, leaving out the comments and empty lines.  The callback
+ * isn't called for a file without sections.
+ *
+ * @param filepath            Path to the configuration file.
+ * @param cb_sections_browser Pointer to function that will consume the
+ *                            sections linked list.  **Do not** quote
+ *                            the function name.  See example below.
+ * @param data                This parameter value will be passed back
  *                            to the calling process and can be recast
  *                            as appropriate.
  *
@@ -529,39 +1437,543 @@ const ri_Section* ri_get_section(const ri_Section* root, const char *name)
  */
 void ri_read_file(const char *filepath, ri_Sections_Browser cb_sections_browser, void *data)
 {
-   char buffer[MAX_CLINE];
-   struct read_inifile_bundle bundle;
+   Reader reader;
+   Arena arena;
+   ri_Section *sections;
+   int parsed;
 
    int fh = open(filepath, O_RDONLY);
    if (fh == -1)
    {
       fprintf(stderr, "Failed to open \"%s\".", filepath);
    }
+   else if (!reader_init(&reader, fh))
+      close(fh);
    else
    {
-      // Initialize the bundle
-      memset(&bundle, 0, sizeof(struct read_inifile_bundle));
-      bundle.fh = fh;
-      bundle.buffer = buffer;
-      bundle.ifu = cb_sections_browser;
-      bundle.data = data;
+      ri_arena_init(&arena, RI_BLOCK_SIZE);
+
+      RI_TRACE(RI_PHASE_PARSE, 0);
+      parsed = read_sections(&reader, &arena, &sections);
+      RI_TRACE(RI_PHASE_PARSE, 1);
+
+      // We'll close the file handle before invoking the callback
+      // to preserve system resources.
+      reader_release(&reader);
+      close(fh);
+
+      // Make linked data available to requesting function
+      if (!parsed)
+         fprintf(stderr, "Failed to read \"%s\".", filepath);
+      else if (sections)
+         (*cb_sections_browser)(sections, data);
+
+      ri_arena_release(&arena);
+   }
+}
+
+/**
+ * @brief Reads an entire configuration file through a memory mapping.
+ *
+ * Works like *ri_read_file()*, except that the file is mapped into
+ * memory and the linked list nodes point into the mapping instead
+ * of holding copies of the tags, values and section names.  The
+ * mapping is private, so the file is not changed when lines are
+ * terminated in place.  Lines are not truncated.
+ *
+ * The linked list and the mapping remain valid until the callback
+ * function returns.
+ *
+ * @param filepath            Path to the configuration file.
+ * @param cb_sections_browser Pointer to function that will consume the
+ *                            sections linked list.
+ * @param data                This parameter value will be passed back
+ *                            to the calling process and can be recast
+ *                            as appropriate.
+ */
+void ri_read_file_mmap(const char *filepath, ri_Sections_Browser cb_sections_browser, void *data)
+{
+   struct stat st;
+   Arena arena;
+   ri_Section *sections;
+   char *text = NULL;
+   int parsed;
+
+   int fh = open(filepath, O_RDONLY);
+   if (fh == -1)
+   {
+      fprintf(stderr, "Failed to open \"%s\".", filepath);
+      return;
+   }
+
+   if (fstat(fh, &st) == 0)
+      text = map_text(fh, st.st_size);
+
+   // The mapping survives closing the file:
+   close(fh);
+
+   if (!text)
+   {
+      fprintf(stderr, "Failed to map \"%s\".", filepath);
+      return;
+   }
+
+   ri_arena_init(&arena, st.st_size);
+
+   RI_TRACE(RI_PHASE_PARSE, 0);
+   parsed = parse_text(text, st.st_size, &arena, &sections);
+   RI_TRACE(RI_PHASE_PARSE, 1);
+
+   if (!parsed)
+      fprintf(stderr, "Failed to parse \"%s\".", filepath);
+   else if (sections)
+      (*cb_sections_browser)(sections, data);
+
+   ri_arena_release(&arena);
+   unmap_text(text, st.st_size);
+}
+
+/**
+ * @brief Read up to *len* bytes of a file into a buffer.
+ *
+ * @return Number of bytes read, which is less than *len* only if the
+ *         file was shorter than expected, or -1 on error.
+ */
+ssize_t read_text(int fh, char *text, size_t len)
+{
+   size_t total = 0;
+   ssize_t bytes_read;
+
+   while (total < len)
+   {
+      bytes_read = read(fh, &text[total], len - total);
+      RI_STAT_ADD(read_calls, 1);
+      if (bytes_read > 0)
+         RI_STAT_ADD(bytes_read, bytes_read);
 
-      // Read lines until the first section, beginning work if one is found
-      while (read_line(fh, buffer, MAX_CLINE))
+      if (bytes_read == 0)
+         break;
+      else if (bytes_read == -1)
       {
-         if (line_contains_section_head(buffer))
-         {
-            read_inifile_section_recursive(&bundle);
+         if (errno == EINTR)
+            continue;
+         return -1;
+      }
+
+      total += bytes_read;
+   }
+
+   return total;
+}
+
+/**
+ * @brief Reads an entire configuration file into a persistent document.
+ *
+ * Unlike *ri_read_file()*, the parsed contents are not limited to the
+ * life of a callback function: they remain valid until the document
+ * is passed to *ri_free()*.
+ *
+ * The document is built in a single arena.  The file is read into the
+ * arena with one read() (or mapped, with RI_MMAP), and the linked list
+ * nodes point into that copy, so tags and values are not copied again.
+ *
+ * @param filepath Path to the configuration file.
+ * @param flags    RI_MMAP to parse in a memory mapping instead of a copy,
+ *                 RI_INDEX to build hash tables for faster lookups,
+ *                 RI_INCLUDES to merge the files named by include
+ *                 directives, as by *ri_load_layers()*, RI_LAZY to
+ *                 parse each section only when first looked up,
+ *                 RI_INTERN to share one copy of each name, RI_SORTED
+ *                 to sort the names for *ri_match_sections()* and
+ *                 *ri_match_lines()*.
+ *
+ * @return Pointer to the new document, or NULL on failure.
+ *
+ * With RI_LAZY, only the section heads are parsed at first, and a
+ * section's lines are parsed when it is found by *ri_get_section()*,
+ * a lookup or *ri_entries()*.  The sections listed by
+ * *ri_document_sections()* have no lines until then.  Without
+ * RI_MMAP, the whole file is still read into memory by *ri_load()*;
+ * with it, the pages of sections never looked up aren't read.
+ *
+ * With RI_INTERN, the section names and tags are replaced by interned
+ * copies, one for each distinct name, and *ri_document_value()* finds
+ * a line with one hash of each name and pointer compares.  The copy
+ * of a name is given by *ri_interned()*.
+ *
+ * @code
+ * ri_Document *doc = ri_load("~/.mymail.conf", 0);
+ * if (doc)
+ * {
+ *    const ri_Section *sections = ri_document_sections(doc);
+ *    const char* user = ri_find_section_value(sections, "bogus", "user");
+ *    ri_free(doc);
+ * }
+ * @endcode
+ */
+ri_Document* ri_load(const char *filepath, int flags)
+{
+   return ri_load_parallel(filepath, flags, 1);
+}
+
+/**
+ * @brief Read or map an open file into a new, unparsed document.
+ *
+ * The document is allocated from its own arena, with the text and
+ * *reserve* more bytes, to hold the nodes without further blocks.
+ *
+ * @return Pointer to the document, or NULL on failure.
+ */
+ri_Document *read_document(int fh, size_t size, int flags, size_t reserve)
+{
+   Arena arena;
+   ri_Document *doc;
+   char *text = NULL;
+   ssize_t len = -1;
+
+   ri_arena_init(&arena, (flags & RI_MMAP ? 0 : size + 1) + reserve + 4096);
+
+   RI_TRACE(RI_PHASE_READ, 0);
+
+   doc = (ri_Document*)ri_arena_alloc(&arena, sizeof(ri_Document));
+   if (!doc)
+      ;
+   else if (flags & RI_MMAP)
+   {
+      if ((text = map_text(fh, size)))
+         len = size;
+   }
+   else if ((text = (char*)ri_arena_alloc(&arena, size + 1)))
+      len = read_text(fh, text, size);
+
+   RI_TRACE(RI_PHASE_READ, 1);
+
+   if (len == -1)
+   {
+      ri_arena_release(&arena);
+      return NULL;
+   }
+
+   memset(doc, 0, sizeof(ri_Document));
+   doc->text = text;
+   doc->len = len;
+   doc->flags = flags;
+
+   // The document owns the arena that contains it:
+   doc->arena = arena;
+
+   return doc;
+}
+
+/**
+ * @brief Parse the text of a document, and intern its names and
+ *        index it if requested.
+ *
+ * A document loaded with RI_INTERN that has no interner yet gets its
+ * own.  If the names can't all be interned, the flag is cleared, so
+ * that lookups compare strings rather than pointers.
+ *
+ * @return TRUE if successful, FALSE if the text couldn't be parsed,
+ *         in which case the document must be freed, not used.
+ */
+int parse_document(ri_Document *doc, int threads)
+{
+   RI_TRACE(RI_PHASE_PARSE, 0);
+   if (doc->flags & RI_LAZY)
+      doc->sections = lazy_sections(doc);
+   else if (!parse_text_parallel(doc->text, doc->len, &doc->arena, threads, &doc->sections))
+   {
+      RI_TRACE(RI_PHASE_PARSE, 1);
+      return 0;
+   }
+
+   if ((doc->flags & RI_INTERN) && !doc->interner)
+      doc->interner = interner_create();
+
+   if ((doc->flags & RI_INTERN)
+       && !(doc->interner && intern_sections(doc->interner, doc->sections)))
+      doc->flags &= ~RI_INTERN;
+   RI_TRACE(RI_PHASE_PARSE, 1);
+
+   if (doc->flags & RI_INDEX)
+   {
+      RI_TRACE(RI_PHASE_INDEX, 0);
+      if (!ri_build_index(doc->sections, &doc->arena))
+         clear_index(doc->sections);
+      RI_TRACE(RI_PHASE_INDEX, 1);
+   }
+
+   if (doc->flags & RI_SORTED)
+   {
+      RI_TRACE(RI_PHASE_INDEX, 0);
+      sort_document(doc);
+      RI_TRACE(RI_PHASE_INDEX, 1);
+   }
+
+   return 1;
+}
+
+/**
+ * @brief Load a document, parsing the file on several threads.
+ *
+ * The file is read or mapped as by *ri_load()*, then split at
+ * section heads into pieces that are parsed by a pool of *threads*
+ * threads.  The sections are joined in file order, and the index,
+ * if requested, is built afterwards, so the document is the same as
+ * one returned by *ri_load()*.  Small files are parsed on the calling
+ * thread only.
+ *
+ * @param filepath Path to the configuration file.
+ * @param flags    Flags as for *ri_load()*.
+ * @param threads  Number of threads, or 0 for one per CPU.
+ *
+ * @return Pointer to the new document, or NULL on failure.
+ */
+ri_Document* ri_load_parallel(const char *filepath, int flags, int threads)
+{
+   return load_file(filepath, flags, threads, NULL);
+}
+
+/**
+ * @brief Load a document as by *ri_load_parallel()*, interning its
+ *        names with RI_INTERN in *interner*, if not NULL, so that
+ *        successive loads share their names.
+ *
+ * @return Pointer to the new document, or NULL on failure.
+ */
+ri_Document *load_file(const char *filepath, int flags, int threads, Interner *interner)
+{
+   struct stat st;
+   ri_Document *doc = NULL;
+   int fh;
+
+   if (flags & RI_INCLUDES)
+      return load_layers(&filepath, 1, flags, threads, interner);
+
+   fh = open(filepath, O_RDONLY);
+   if (fh == -1)
+   {
+      fprintf(stderr, "Failed to open \"%s\".", filepath);
+      return NULL;
+   }
+
+   // Workers parse into their own arenas, and lazy sections mostly not at all:
+   if (fstat(fh, &st) == 0
+       && (doc = read_document(fh, st.st_size, flags,
+                               threads == 1 && !(flags & RI_LAZY) ? st.st_size : 0)))
+   {
+      if ((flags & RI_INTERN) && interner)
+         doc->interner = interner_retain(interner);
+
+      if (!parse_document(doc, threads))
+      {
+         ri_free(doc);
+         doc = NULL;
+      }
+   }
+
+   close(fh);
+
+   if (!doc)
+      fprintf(stderr, "Failed to read \"%s\".", filepath);
+
+   return doc;
+}
+
+/**
+ * @brief Read from a descriptor until EOF, into a block of its own
+ *        at the head of an arena.
+ *
+ * The block is doubled with *realloc()* as it fills, which for large
+ * blocks moves the pages rather than copying them, so the text is
+ * never held twice, and is trimmed to the text at EOF.  No more is
+ * allocated from the block, which is freed with the arena.
+ *
+ * @return Number of bytes read, with *text* set to the text, which
+ *         has a spare byte following it, or -1 on failure.
+ */
+ssize_t read_stream(int fh, Arena *arena, char **text)
+{
+   size_t len = 0, capacity = RI_BLOCK_SIZE;
+   ssize_t bytes_read;
+   Arena_Block *block, *grown;
+
+   if (!(block = (Arena_Block*)malloc(sizeof(Arena_Block) + capacity)))
+      return -1;
+
+   while (1)
+   {
+      // Keep a byte following the text to terminate its last line:
+      if (len + 1 == capacity)
+      {
+         if (!(grown = (Arena_Block*)realloc(block, sizeof(Arena_Block) + capacity * 2)))
             break;
-         };
+
+         block = grown;
+         capacity *= 2;
+      }
+
+      bytes_read = read(fh, &block->data[len], capacity - 1 - len);
+      RI_STAT_ADD(read_calls, 1);
+      if (bytes_read > 0)
+         RI_STAT_ADD(bytes_read, bytes_read);
+
+      if (bytes_read == 0)
+      {
+         if ((grown = (Arena_Block*)realloc(block, sizeof(Arena_Block) + len + 1)))
+            block = grown;
+
+         block->size = block->used = len + 1;
+         block->next = arena->head;
+         arena->head = block;
+
+         *text = block->data;
+         return len;
       }
+      else if (bytes_read > 0)
+         len += bytes_read;
+      else if (errno != EINTR)
+         break;
+   }
+
+   free(block);
+   return -1;
+}
+
+/**
+ * @brief Load a document from a descriptor that may not be a file.
+ *
+ * The descriptor is read sequentially to its end, so the text can
+ * come from a pipe, a socket or standard input.  The descriptor is
+ * not closed.
+ *
+ * @param fh    Descriptor to read.
+ * @param flags Flags as for *ri_load()*, except that RI_MMAP is
+ *              ignored, since a stream can't be mapped, and
+ *              RI_INCLUDES is refused, since a stream has no
+ *              directory to resolve relative includes in.
+ *
+ * @return Pointer to the new document, or NULL on failure.
+ */
+ri_Document* ri_load_fd(int fh, int flags)
+{
+   Arena arena;
+   ri_Document *doc;
+   char *text;
+   ssize_t len;
+
+   if (flags & RI_INCLUDES)
+   {
+      fprintf(stderr, "Includes can't be merged into a stream.");
+      return NULL;
+   }
+
+   // The text is read into the arena, to be freed with the document:
+   ri_arena_init(&arena, 0);
+
+   RI_TRACE(RI_PHASE_READ, 0);
+   len = read_stream(fh, &arena, &text);
+   RI_TRACE(RI_PHASE_READ, 1);
+
+   if (len == -1)
+   {
+      fprintf(stderr, "Failed to read stream.");
+      return NULL;
+   }
+
+   doc = (ri_Document*)ri_arena_alloc(&arena, sizeof(ri_Document));
+   if (!doc)
+   {
+      ri_arena_release(&arena);
+      return NULL;
+   }
+
+   memset(doc, 0, sizeof(ri_Document));
+   doc->text = text;
+   doc->len = len;
+   doc->flags = flags & ~RI_MMAP;
+   doc->arena = arena;
+
+   if (!parse_document(doc, 1))
+   {
+      ri_free(doc);
+      fprintf(stderr, "Failed to parse stream.");
+      return NULL;
+   }
+
+   return doc;
+}
+
+/** @brief Remove a partially-built index to fall back to scanning. */
+void clear_index(ri_Section *head)
+{
+   for (; head; head = head->next)
+      SECTION_NODE(head)->index = NULL;
+}
+
+/** @brief Release all memory held by a document returned by *ri_load()*. */
+void ri_free(ri_Document *doc)
+{
+   Arena arena;
+
+   if (doc)
+   {
+      if (doc->cache || (doc->flags & RI_LAZY))
+         pthread_mutex_destroy(&doc->lock);
+
+      if (doc->cache)
+         unmap_cache(doc->cache);
+      else if (doc->flags & RI_MMAP)
+         unmap_text(doc->text, doc->len);
+
+      interner_release(doc->interner);
 
-      // Close file if not already closed:
-      if (bundle.fh != -1)
-         close(bundle.fh);
+      // Copy the arena out of the memory it is about to free:
+      arena = doc->arena;
+      ri_arena_release(&arena);
    }
 }
 
+/** @brief Returns the head of the sections linked list of a document. */
+const ri_Section* ri_document_sections(const ri_Document *doc)
+{
+   const ri_Section *sections = __atomic_load_n(&doc->sections, __ATOMIC_ACQUIRE);
+
+   // The sections of a cached document are made when first needed:
+   if (!sections && doc->cache)
+      sections = cache_sections((ri_Document*)doc);
+
+   return sections;
+}
+
+/**
+ * @brief Find the value of a tag in a named section of a document.
+ *
+ * The same as *ri_find_section_value()* with the sections of the
+ * document, except that a document loaded from a cache is searched
+ * with the perfect hash of the cache, if it has one, without making
+ * its sections, and one loaded with RI_INTERN by its interned names.
+ */
+const char* ri_document_value(const ri_Document *doc, const char *section_name, const char *tag_name)
+{
+   const ri_Line *line;
+
+   if (doc->cache && doc->cache->slot_count)
+   {
+      RI_STAT_ADD(lookups, 1);
+      RI_STAT_ADD(lookup_probes, 1);
+      return cache_find_value(doc->cache, section_name, tag_name);
+   }
+
+   if (doc->flags & RI_INTERN)
+   {
+      line = interned_line(doc, section_name, tag_name);
+      return line ? line->value : NULL;
+   }
+
+   return ri_find_section_value(ri_document_sections(doc), section_name, tag_name);
+}
+
 /**
  * @brief Return value string associated with a tag name in the
  *        named section.
@@ -580,22 +1992,55 @@ void ri_read_file(const char *filepath, ri_Sections_Browser cb_sections_browser,
  * @return Pointer to value string if tag is found and it
  *         has a value.  Nonexistent tags and empty found
  *         tags will return NULL;
+ *
+ * For a document loaded with RI_INDEX, the section and tag are
+ * found through hash tables instead of by scanning.
  */
 const char* ri_find_section_value(const ri_Section* sections_head,
                                   const char* section_name,
                                   const char* tag_name)
 {
-   const ri_Line* lptr;
+   const ri_Line *line = ri_find_section_line(sections_head, section_name, tag_name);
+   return line ? line->value : NULL;
+}
+
+/**
+ * @brief Return the line of a tag name in the named section, as
+ *        found by *ri_find_section_value()*.
+ *
+ * @return Pointer to the line, or NULL if not found.
+ */
+const ri_Line* ri_find_section_line(const ri_Section* sections_head,
+                                    const char* section_name,
+                                    const char* tag_name)
+{
+   const ri_Line* lptr = NULL;
    const ri_Section* sptr = sections_head;
-   while (sptr)
+   unsigned hash;
+   RI_STATS_ONLY(uint64_t probes = 0;)
+
+   if (sptr && SECTION_NODE(sptr)->index)
+   {
+      hash = ri_hash(tag_name);
+      for (sptr = ri_index_get_section(sptr, section_name);
+           sptr && !lptr;
+           sptr = SECTION_NODE(sptr)->index->same_name)
+      {
+         RI_STATS_ONLY(++probes);
+         lptr = ri_index_find_line(section_parsed(sptr), tag_name, hash);
+      }
+   }
+   while (sptr && !lptr)
    {
+      RI_STATS_ONLY(++probes);
       if (0 == strcmp(sptr->section_name, section_name))
       {
-         lptr = sptr->lines;
+         lptr = section_parsed(sptr)->lines;
          while (lptr)
          {
+            RI_STATS_ONLY(++probes);
             if (0 == strcmp(lptr->tag, tag_name))
-               return lptr->value;
+               break;
 
             lptr = lptr->next;
          }
@@ -604,5 +2049,8 @@ const char* ri_find_section_value(const ri_Section* sections_head,
       sptr = sptr->next;
    }
 
-   return NULL;
+   RI_STAT_ADD(lookups, 1);
+   RI_STAT_ADD(lookup_probes, probes);
+
+   return lptr;
 }
@@ -1,8 +1,14 @@
 #ifndef READINI_H
 #define READINI_H
 
+#include <stddef.h>  // for size_t
+#include <stdint.h>  // for int64_t, uint64_t
+
 /**
  * Structure for node of linked list of line contents.
+ *
+ * Lines and sections are made by the library, which keeps private
+ * members beyond these, so only those it returns may be passed to it.
  */
 typedef struct ri_line
 {
@@ -11,6 +17,19 @@ typedef struct ri_line
    struct ri_line *next;
 } ri_Line;
 
+/**
+ * Compact description of a line in a document loaded by *ri_load()*:
+ * the offsets and lengths of its tag and value in the string pool
+ * of its section.  A tag without a value has a *value_len* of 0.
+ */
+typedef struct ri_entry
+{
+   unsigned tag_off;
+   unsigned tag_len;
+   unsigned value_off;
+   unsigned value_len;
+} ri_Entry;
+
 /**
  * Structore for node of linked list of sections info.
  */
@@ -21,6 +40,28 @@ typedef struct ri_section
    struct ri_section *next;
 } ri_Section;
 
+/**
+ * Iterator for walking the entries of a section without allocating.
+ * See *ri_entries()*.
+ */
+typedef struct ri_entry_iter
+{
+   const char *pool;
+   const ri_Entry *next;
+   const ri_Entry *end;
+} ri_Entry_Iter;
+
+/**
+ * Iterator over the sections or lines whose names match a pattern,
+ * in order of name, without allocating.  See *ri_match_sections()*.
+ */
+typedef struct ri_match_iter
+{
+   const void * const *next;
+   const void * const *end;
+   const char *pattern;
+} ri_Match_Iter;
+
 /**
  * Callback function pointer typedefs for *ri_open_section()* and *ri_open_file()*
  */
@@ -40,11 +81,289 @@ const char* ri_find_value(const ri_Line* lines_head,
 
 const ri_Section* ri_get_section(const ri_Section* root, const char *name);
 
+/** Iterate over the lines of a section as compact entries. **/
+int ri_entries(const ri_Section *section, ri_Entry_Iter *iter);
+const ri_Entry* ri_entry_next(ri_Entry_Iter *iter, const char **tag, const char **value);
+
+/**
+ * Lines of any length are read whole.  Set a limit to truncate
+ * longer lines, with a warning, in files read by the calling thread.
+ */
+int ri_set_line_limit(int limit);
+
 /** Simplest access: open file, fully-read it, then query the contents. **/
 void ri_read_file(const char *filepath, ri_Sections_Browser cb_sections_browser, void *data);
 
+/** Same as *ri_read_file()*, but parses the file in a memory mapping without copying. **/
+void ri_read_file_mmap(const char *filepath, ri_Sections_Browser cb_sections_browser, void *data);
+
 const char* ri_find_section_value(const ri_Section* sections_head,
                                   const char* section_name,
                                   const char* tag_name);
 
+/**
+ * Batch access: find many values in one pass over the sections or
+ * the file.  Each lookup names a section and tag, and points to
+ * where the value found, or NULL, is set.
+ */
+typedef struct ri_lookup
+{
+   const char *section_name;
+   const char *tag_name;
+   const char **value;
+} ri_Lookup;
+
+int ri_find_batch(const ri_Section *sections_head, ri_Lookup *lookups, int count);
+int ri_open_batch(int fh, ri_Lookup *lookups, int count, ri_File_User cb_file_user, void *data);
+
+/**
+ * Typed access: find a line, then convert its value.  A conversion
+ * is saved on the line, so converting the line again only reads it.
+ * Each conversion returns RI_OK and sets its result, or an error.
+ */
+#define RI_OK      0
+#define RI_MISSING 1   /* no line, or a tag without a value */
+#define RI_INVALID 2   /* the value isn't of the type */
+#define RI_RANGE   3   /* the value doesn't fit in the type */
+
+const ri_Line* ri_find_line(const ri_Line* lines_head, const char* tag_name);
+const ri_Line* ri_find_section_line(const ri_Section* sections_head,
+                                    const char* section_name,
+                                    const char* tag_name);
+int ri_line_int64(const ri_Line *line, int64_t *result);
+int ri_line_uint64(const ri_Line *line, uint64_t *result);
+int ri_line_double(const ri_Line *line, double *result);
+int ri_line_bool(const ri_Line *line, int *result);
+int ri_line_duration(const ri_Line *line, int64_t *nanoseconds);
+int ri_line_bytes(const ri_Line *line, uint64_t *bytes);
+
+/**
+ * Event access: report the contents of a file to callbacks as it is
+ * read, without keeping it in memory.  Each callback gets slices of
+ * the read buffer, valid until it returns, and returns TRUE to
+ * continue reading or FALSE to stop.
+ */
+typedef struct ri_events
+{
+   int (*on_section)(const char *name, int len, void *data);
+   int (*on_key_value)(const char *tag, int len_tag,
+                       const char *value, int len_value, void *data);
+   int (*on_comment)(const char *text, int len, void *data);
+   int (*on_error)(const char *message, long line_number, void *data);
+} ri_Events;
+
+int ri_parse_events(const char *filepath, const ri_Events *events, void *data);
+int ri_parse_events_fd(int fh, const ri_Events *events, void *data);
+
+/**
+ * Schema access: declare the tags of a configuration once, as a
+ * list macro of members, sections, tags, types and defaults, and
+ * load a file in one pass straight into a struct made from the list:
+ *
+ *    #define SERVER_CONFIG(X) \
+ *       X(host,    "server", "host",    STRING,   "localhost") \
+ *       X(port,    "server", "port",    INT64,    "8080") \
+ *       X(timeout, "server", "timeout", DURATION, "30s")
+ *
+ *    RI_SCHEMA_STRUCT(server_config, SERVER_CONFIG);
+ *    static RI_SCHEMA_TABLE(server_config, SERVER_CONFIG)
+ *
+ * declares *struct server_config* and a function *server_config_schema()*
+ * returning its schema.  The section and tag names must be string
+ * literals, whose hashes are computed by the compiler.
+ */
+#define RI_SCHEMA_STRING   0
+#define RI_SCHEMA_INT64    1
+#define RI_SCHEMA_UINT64   2
+#define RI_SCHEMA_DOUBLE   3
+#define RI_SCHEMA_BOOL     4
+#define RI_SCHEMA_DURATION 5   /* nanoseconds, as by *ri_line_duration()* */
+#define RI_SCHEMA_BYTES    6
+
+typedef const char *ri_Schema_STRING;
+typedef int64_t ri_Schema_INT64;
+typedef uint64_t ri_Schema_UINT64;
+typedef double ri_Schema_DOUBLE;
+typedef int ri_Schema_BOOL;
+typedef int64_t ri_Schema_DURATION;
+typedef uint64_t ri_Schema_BYTES;
+
+typedef struct ri_schema_key
+{
+   const char *section_name;
+   const char *tag_name;
+   unsigned hash;              // RI_SCHEMA_HASH() of the names, or 0
+   int type;                   // RI_SCHEMA_STRING to RI_SCHEMA_BYTES
+   size_t offset;              // offset of the member in the struct
+   const char *default_value;  // NULL for 0, or NULL for a string
+} ri_Schema_Key;
+
+typedef struct ri_schema
+{
+   const ri_Schema_Key *keys;
+   int count;
+   size_t strings_offset;      // offset of the *ri_strings* member
+} ri_Schema;
+
+/**
+ * FNV-1a hash of "section]tag", as computed while loading, unrolled
+ * for the compiler.  Names longer than RI_SCHEMA_NAME_MAX get 0, and
+ * are hashed when loading instead.
+ */
+#define RI_SCHEMA_NAME_MAX 32
+#define RI_FNV_BASIS 2166136261u
+#define RI_FNV_PRIME 16777619u
+#define RI_FNV_CHAR(s, i) ((i) < sizeof(s) - 1 ? (unsigned char)(s)[(i) < sizeof(s) - 1 ? (i) : 0] : 0u)
+#define RI_FNV_STEP(h, s, i) (((h) ^ RI_FNV_CHAR(s, i)) * ((i) < sizeof(s) - 1 ? RI_FNV_PRIME : 1u))
+#define RI_FNV_4(h, s, i) \
+   RI_FNV_STEP(RI_FNV_STEP(RI_FNV_STEP(RI_FNV_STEP(h, s, i), s, i + 1), s, i + 2), s, i + 3)
+#define RI_FNV_16(h, s, i) \
+   RI_FNV_4(RI_FNV_4(RI_FNV_4(RI_FNV_4(h, s, i), s, i + 4), s, i + 8), s, i + 12)
+#define RI_FNV_32(h, s) RI_FNV_16(RI_FNV_16(h, s, 0), s, 16)
+#define RI_SCHEMA_HASH(section, tag) \
+   (sizeof("" section) <= RI_SCHEMA_NAME_MAX + 1 && sizeof("" tag) <= RI_SCHEMA_NAME_MAX + 1 \
+    ? RI_FNV_32((RI_FNV_32(RI_FNV_BASIS, "" section) ^ ']') * RI_FNV_PRIME, "" tag) : 0u)
+
+#define RI_SCHEMA_MEMBER(member, section, tag, type, default_value) \
+   ri_Schema_##type member;
+#define RI_SCHEMA_KEY(member, section, tag, type, default_value) \
+   { section, tag, RI_SCHEMA_HASH(section, tag), RI_SCHEMA_##type, \
+     offsetof(ri_Schema_Target, member), default_value },
+
+#define RI_SCHEMA_STRUCT(name, LIST) \
+   struct name                      \
+   {                                \
+      LIST(RI_SCHEMA_MEMBER)        \
+      void *ri_strings;             \
+   }
+
+#define RI_SCHEMA_TABLE(name, LIST)                                        \
+   const ri_Schema *name##_schema(void)                                    \
+   {                                                                       \
+      typedef struct name ri_Schema_Target;                                \
+      static const ri_Schema_Key keys[] = { LIST(RI_SCHEMA_KEY) };         \
+      static const ri_Schema schema = {                                    \
+         keys, sizeof(keys) / sizeof(keys[0]),                             \
+         offsetof(ri_Schema_Target, ri_strings) };                         \
+      return &schema;                                                      \
+   }
+
+/** Flags for *ri_load_schema()* **/
+#define RI_STRICT 0x0100  /* Stop at an unknown tag or invalid value */
+
+int ri_load_schema(const char *filepath, const ri_Schema *schema, void *target, int flags);
+void ri_schema_free(const ri_Schema *schema, void *target);
+
+/**
+ * Push parser: report the contents of text fed in pieces of any
+ * size, for text from pipes and sockets.
+ */
+typedef struct ri_parser ri_Parser;
+
+ri_Parser* ri_parser_create(const ri_Events *events, void *data);
+int ri_parser_feed(ri_Parser *parser, const char *buffer, size_t len);
+int ri_parser_finish(ri_Parser *parser);
+void ri_parser_destroy(ri_Parser *parser);
+
+/**
+ * Persistent access: parse the file into heap memory that lasts
+ * until *ri_free()* is called, without a callback.  A document is
+ * not modified after *ri_load()* returns, so any number of threads
+ * can make lookups in it at once.
+ */
+typedef struct ri_document ri_Document;
+
+/** Flags for *ri_load()* **/
+#define RI_MMAP     0x0001   /* Parse in a private file mapping instead of a copy */
+#define RI_INDEX    0x0002   /* Build hash tables for section and tag lookups */
+#define RI_INCLUDES 0x0004   /* Merge the files named by include directives,
+                                 except with ri_load_fd(), which refuses it */
+#define RI_LAZY     0x0008   /* Parse each section when it is first looked up */
+#define RI_INTERN   0x0010   /* Share one copy of each section name and tag */
+#define RI_SORTED   0x0020   /* Sort section names and tags for pattern queries */
+
+ri_Document* ri_load(const char *filepath, int flags);
+ri_Document* ri_load_parallel(const char *filepath, int flags, int threads);
+ri_Document* ri_load_fd(int fh, int flags);
+ri_Document* ri_load_layers(const char **filepaths, int count, int flags);
+
+void ri_free(ri_Document *doc);
+const ri_Section* ri_document_sections(const ri_Document *doc);
+const char* ri_interned(const ri_Document *doc, const char *name);
+
+int ri_match_sections(const ri_Document *doc, const char *pattern, ri_Match_Iter *iter);
+const ri_Section* ri_next_section(ri_Match_Iter *iter);
+int ri_match_lines(const ri_Section *section, const char *pattern, ri_Match_Iter *iter);
+const ri_Line* ri_next_line(ri_Match_Iter *iter);
+
+/**
+ * Directory access: load every file of a directory at once, as a
+ * document for each, found by file name.
+ */
+typedef struct ri_directory ri_Directory;
+
+ri_Directory* ri_load_dir(const char *dirpath, int flags, int threads);
+void ri_dir_free(ri_Directory *dir);
+int ri_dir_count(const ri_Directory *dir);
+const char* ri_dir_name(const ri_Directory *dir, int index);
+const ri_Document* ri_dir_document(const ri_Directory *dir, int index);
+const ri_Document* ri_dir_find(const ri_Directory *dir, const char *filename);
+
+/**
+ * Cached access: save a parsed file in a binary cache that later
+ * loads map and use without parsing, while the file is unchanged.
+ */
+int ri_compile(const char *filepath, const char *cache_path);
+ri_Document* ri_load_cached(const char *filepath, const char *cache_path, int flags);
+const char* ri_document_value(const ri_Document *doc, const char *section_name, const char *tag_name);
+
+/**
+ * Hot reload: keep a document loaded while its file changes.  Any
+ * number of threads can read the current document without locking.
+ */
+typedef struct ri_watcher ri_Watcher;
+typedef void (*ri_Document_User)(const ri_Document *doc, void *data);
+
+ri_Watcher* ri_watch(const char *filepath, int flags);
+void ri_unwatch(ri_Watcher *watcher);
+int ri_watch_reload(ri_Watcher *watcher);
+const ri_Document* ri_watch_acquire(ri_Watcher *watcher, int *token);
+void ri_watch_release(ri_Watcher *watcher, int token);
+void ri_watch_use(ri_Watcher *watcher, ri_Document_User cb_document_user, void *data);
+unsigned long ri_watch_generation(ri_Watcher *watcher);
+
+/**
+ * Instrumentation: counters of the work done by the library, and
+ * hooks called as each phase of a load begins and ends.  Both are
+ * built only if the library is compiled with RI_STATS defined, as by
+ * "make STATS=1"; otherwise *ri_get_stats()* and *ri_set_trace_hook()*
+ * return FALSE, and cost nothing elsewhere.
+ */
+typedef struct ri_stats
+{
+   uint64_t bytes_read;       // bytes returned by read() and pread()
+   uint64_t read_calls;       // calls to read() and pread()
+   uint64_t bytes_mapped;     // bytes of files mapped rather than read
+   uint64_t lines;            // lines parsed
+   uint64_t sections;         // section heads parsed
+   uint64_t keys;             // tags parsed
+   uint64_t truncated_lines;  // lines cut at the line limit
+   uint64_t comment_lines;    // lines holding only a comment
+   uint64_t parse_ns;         // wall time of RI_PHASE_PARSE, in nanoseconds
+   uint64_t lookups;          // calls to ri_find_section_value() and ri_document_value()
+   uint64_t lookup_probes;    // sections, lines and slots compared by the lookups
+} ri_Stats;
+
+/** Phases reported to the trace hook **/
+#define RI_PHASE_READ  0   /* reading or mapping a whole file */
+#define RI_PHASE_PARSE 1   /* parsing, including reads while parsing */
+#define RI_PHASE_INDEX 2   /* building the RI_INDEX tables and RI_SORTED arrays */
+#define RI_PHASE_COUNT 3
+
+typedef void (*ri_Trace_Hook)(int phase, int end, void *data);
+
+int ri_get_stats(ri_Stats *stats);
+void ri_reset_stats(void);
+int ri_set_trace_hook(ri_Trace_Hook hook, void *data);
+
 #endif
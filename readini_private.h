@@ -1,3 +1,8 @@
+#include <stdint.h>    // for the fixed sizes of cache files
+#include <pthread.h>
+#include <dirent.h>    // for DIR
+#include <sys/stat.h>
+
 /**
  * ir_line_info and parse_line_info work together to read a
  * line buffer and mark the beginning and end of its
@@ -14,27 +19,663 @@ struct ri_line_info
    int len_value;
 };
 
+/**
+ * Value of a line converted by a typed function like *ri_line_int64()*.
+ */
+typedef union ri_typed_value
+{
+   int64_t i;
+   uint64_t u;
+   double d;
+} ri_Typed_Value;
+
+/**
+ * Nodes in which the library makes each **ri_Line** and **ri_Section**,
+ * holding the members it keeps private after the public structure,
+ * which is the first member so that a pointer to either is a pointer
+ * to both.  LINE_NODE() and SECTION_NODE() find the node of a line
+ * or section made by the library.
+ */
+typedef struct ri_line_node
+{
+   ri_Line line;
+   const ri_Section *section;        // Section to which line belongs, if known
+   int typed;                        // type and result of *converted*, 0 if none
+   ri_Typed_Value converted;         // first typed conversion of *value*
+} Line_Node;
+
+typedef struct ri_section_node
+{
+   ri_Section section;
+   const struct ri_index *index;     // lookup index, NULL if not indexed
+   const char *pool;                 // string pool for *entries*
+   const ri_Entry *entries;          // array of *entry_count* line descriptions,
+   unsigned entry_count;             //   NULL if read by ri_read_file()
+   const struct ri_lazy *lazy;       // unparsed text, until looked up with RI_LAZY
+   const struct ri_sorted *sorted;   // lines in order of tag, with RI_SORTED
+} Section_Node;
+
+#define LINE_NODE(line) ((Line_Node*)(line))
+#define SECTION_NODE(section) ((Section_Node*)(section))
+
+int is_space(const char *val);
+int line_is_section_type(const char *buffer);
 int ri_parse_line_info(const char *buffer, struct ri_line_info *li);
+int ri_parse_line_slice(const char *line, const char *end, struct ri_line_info *li);
 
 /**
- * Internal structure used to collect data from configuration file.
+ * Character scanning kernels, chosen for the CPU when the library
+ * is loaded.  Each returns a pointer to the first matching character
+ * at or after *ptr*, or *end* if there is none.
  */
-typedef struct read_inifile_bundle
+typedef struct ri_scan_kernels
 {
-   char *buffer;
+   const char *name;
+   const char *(*line_end)(const char *ptr, const char *end);  // '\n' or '#'
+   const char *(*tag_end)(const char *ptr, const char *end);   // '#', ':', '=', ' ' or '\t'
+} Scan_Kernels;
+
+extern Scan_Kernels ri_scan;
+
+void select_scan_kernels(void);
+
+/**
+ * Instrumentation, built only with RI_STATS defined.  Counters are
+ * added to *ri_stats* with relaxed atomic adds, once per parse or
+ * reader for counts of lines, and once per lookup.  Without
+ * RI_STATS, RI_STAT_ADD and RI_TRACE expand to empty expressions, so
+ * they can stand alone as the body of an *if*, and RI_STATS_ONLY to
+ * nothing.
+ */
+#ifdef RI_STATS
+extern ri_Stats ri_stats;
+extern ri_Trace_Hook trace_hook;
+extern void *trace_data;
+uint64_t stats_now(void);
+void trace_phase(int phase, int end);
+
+#define RI_STATS_ONLY(code) code
+#define RI_STAT_ADD(counter, count) \
+   __atomic_fetch_add(&ri_stats.counter, (count), __ATOMIC_RELAXED)
+#define RI_TRACE(phase, end) trace_phase((phase), (end))
+#else
+#define RI_STATS_ONLY(code)
+#define RI_STAT_ADD(counter, count) ((void)0)
+#define RI_TRACE(phase, end) ((void)0)
+#endif
+
+/**
+ * Block allocator for parsed nodes.  Allocations are carved from
+ * large blocks that are all freed together by *ri_arena_release()*.
+ */
+typedef struct ri_arena_block
+{
+   struct ri_arena_block *next;
+   size_t size;
+   size_t used;
+   char data[];
+} Arena_Block;
+
+typedef struct ri_arena
+{
+   Arena_Block *head;
+   size_t block_size;
+} Arena;
+
+void ri_arena_init(Arena *arena, size_t block_size);
+void *ri_arena_alloc(Arena *arena, size_t size);
+void ri_arena_release(Arena *arena);
+void ri_arena_adopt(Arena *arena, Arena *other);
+
+/**
+ * Functions for parsing a whole file in memory.  The text buffer
+ * must have a writable byte following its last character, so
+ * lines can be terminated in place.
+ */
+char *map_text(int fh, size_t len);
+void unmap_text(char *text, size_t len);
+char *cook_line(char *line, char **end);
+ri_Entry *add_entry(ri_Entry **entries, unsigned *count, unsigned *capacity);
+int place_entries(ri_Section *head, const char *pool,
+                  const ri_Entry *entries, unsigned count, Arena *arena);
+int parse_text(char *text, size_t len, Arena *arena, ri_Section **result);
+
+/**
+ * A piece of text, starting at a section head, parsed by one of
+ * the workers of *parse_text_parallel()* into its own arena.
+ */
+typedef struct ri_parse_chunk
+{
+   char *text;
+   size_t len;
+   Arena arena;
    ri_Section *head;
-   ri_Section *tail;
-   ri_Sections_Browser ifu;
+   int failed;           // out of memory, so *head* may be missing sections
+} Parse_Chunk;
+
+/**
+ * State of the event parser, carried from line to line.
+ */
+typedef struct ri_event_state
+{
+   const ri_Events *events;
    void *data;
+   long line_number;
+   int section_open;     // lines belong to a section
+   RI_STATS_ONLY(uint64_t sections; uint64_t keys; uint64_t comment_lines;)
+} Event_State;
+
+const char *find_comment(const char *line, const char *end);
+int emit_line_events(Event_State *state, char *line, char *end);
+int parser_reserve(ri_Parser *parser, size_t size);
+int parser_line(ri_Parser *parser, const char *line, size_t len, int truncated);
+void parser_carry(ri_Parser *parser, const char *text, size_t len);
+void parser_flush_stats(ri_Parser *parser);
+
+/**
+ * Types of the conversions saved on an **ri_Line**.  The *typed*
+ * member holds the type in its low bits and the result of the
+ * conversion above them.  RI_TYPED_BUSY marks a line on which a
+ * thread is saving its conversion.
+ */
+#define RI_TYPE_INT64    1
+#define RI_TYPE_UINT64   2
+#define RI_TYPE_DOUBLE   3
+#define RI_TYPE_BOOL     4
+#define RI_TYPE_DURATION 5
+#define RI_TYPE_BYTES    6
+#define RI_TYPED_BUSY    0xff
+#define RI_TYPED_MASK    0xff
+#define RI_TYPED_RESULT_SHIFT 8
+
+int typed_value(const ri_Line *line, int type, ri_Typed_Value *value,
+                int (*convert)(const char *text, ri_Typed_Value *value));
+int number_base(const char *text);
+int convert_int64(const char *text, ri_Typed_Value *value);
+int convert_uint64(const char *text, ri_Typed_Value *value);
+int convert_double(const char *text, ri_Typed_Value *value);
+int convert_bool(const char *text, ri_Typed_Value *value);
+int read_decimal(const char **ptr, uint64_t *whole, double *fraction);
+int add_units(uint64_t *total, uint64_t whole, double fraction, uint64_t unit);
+uint64_t duration_unit(const char **ptr);
+int convert_duration(const char *text, ri_Typed_Value *value);
+int convert_bytes(const char *text, ri_Typed_Value *value);
+
+/**
+ * State of *ri_load_schema()*.  The keys of the schema are found by
+ * the hash of "section]tag" in an open-addressing table of key
+ * numbers, so each line read costs one hash of its tag.
+ */
+typedef struct ri_schema_load
+{
+   const ri_Schema *schema;
+   char *target;
+   Arena *strings;          // string values, owned by the target
+   Arena arena;             // table and copies of values to convert
+   unsigned mask;           // number of slots - 1
+   int *slots;              // key number + 1, or 0 for an empty slot
+   unsigned *hashes;        // hash of each key
+   char *seen;              // key already set from the file
+   char *section;           // name of the current section
+   int section_size;
+   unsigned section_hash;   // hash of "section]"
+   int flags;
+   int problems;            // unknown tags and invalid values
+   int failed;
+} Schema_Load;
+
+int schema_init(Schema_Load *load, const ri_Schema *schema, void *target, int flags);
+int schema_set(Schema_Load *load, int key, const char *value, int len);
+int schema_on_section(const char *name, int len, void *data);
+int schema_on_key_value(const char *tag, int len_tag,
+                        const char *value, int len_value, void *data);
+int schema_on_error(const char *message, long line_number, void *data);
+
+size_t next_chunk_start(const char *text, size_t len, size_t offset);
+void *parse_chunks(void *arg);
+void parse_chunks_parallel(Parse_Chunk *chunks, int count, int threads);
+int parse_text_parallel(char *text, size_t len, Arena *arena, int threads, ri_Section **result);
+
+/**
+ * Open-addressing hash table of names, used for the lookup index.
+ * Each slot holds the hash of the name, so most mismatches are
+ * rejected without a string compare.  A NULL *node* marks an empty slot.
+ */
+typedef struct ri_name_slot
+{
+   unsigned hash;
+   const char *name;
+   const void *node;
+} Name_Slot;
+
+typedef struct ri_name_table
+{
+   unsigned mask;     // number of slots - 1
+   Name_Slot *slots;
+} Name_Table;
+
+int name_table_init(Name_Table *table, unsigned count, Arena *arena);
+Name_Slot *name_table_probe(const Name_Table *table, const char *name, unsigned hash);
+Name_Slot *name_table_probe_slice(const Name_Table *table, const char *name, int len,
+                                  unsigned hash);
+const void *name_table_add(Name_Table *table, const char *name, const void *node);
+int name_table_grow(Name_Table *table, unsigned count, Arena *arena);
+
+/**
+ * Set of interned names, each stored once and compared by pointer.
+ * Names are only added, and a table that must grow is replaced by a
+ * larger copy, so one thread can add names while others find them.
+ */
+typedef struct ri_name_set
+{
+   Name_Table *table;   // NULL until the first name is added
+   unsigned count;
+} Name_Set;
+
+const char *name_set_add(Name_Set *set, const char *name, int len, Arena *arena);
+const char *name_set_find(const Name_Set *set, const char *name, unsigned hash);
+
+/**
+ * Names of the documents loaded with RI_INTERN, shared by the loads
+ * of one watcher.  Names are added under *lock*, and the interner is
+ * freed with the last document or watcher that holds a reference.
+ */
+typedef struct ri_interner
+{
+   Arena arena;
+   Name_Set names;
+   int refs;
+   pthread_mutex_t lock;
+} Interner;
+
+Interner *interner_create(void);
+Interner *interner_retain(Interner *interner);
+void interner_release(Interner *interner);
+int intern_sections(Interner *interner, ri_Section *head);
+
+/**
+ * Size of the block read from a file descriptor with each refill
+ * of a **Reader** buffer.
+ */
+#define RI_BLOCK_SIZE 65536
+
+/**
+ * Block buffer through which all lines are read from a file
+ * descriptor.  Lines are sliced out of *block*, which is refilled
+ * with a single read() when it runs out of complete lines, and
+ * doubled in size when a line doesn't fit.
+ *
+ * Readers opened by *ri_open()* are kept in a list so that
+ * *ri_open_section()* can reuse the buffer of the descriptor
+ * it is given.
+ */
+typedef struct ri_reader
+{
    int fh;
-} Bundle;
+   char *block;
+   int pos;             // index of first unread byte in block
+   int end;             // index following last valid byte in block
+   int capacity;        // size of block, grown to hold the longest line
+   int skip_to_newline; // discard remainder of a too-long line
+   int line_limit;      // longest line before truncation, 0 for none
+   int sequential;      // read() from a descriptor that can't pread()
+   char *cooked;        // copy of a line with escaped '#' compacted
+   int cooked_size;
+   off_t offset;        // file offset of block[0]
+   struct ri_reader *next;
+
+   // Offsets of section heads, recorded as the file is scanned:
+   Arena heads_arena;
+   Name_Table heads;     // offset of first content line by section name
+   unsigned heads_count;
+   off_t heads_scanned;  // all heads preceding this offset are recorded
+   int heads_complete;   // the whole file has been scanned
+   off_t file_size;      // file size and time when scanning began, or -1
+   struct timespec file_mtime;
 
+   RI_STATS_ONLY(uint64_t lines; uint64_t comment_lines;)  // added to ri_stats on release
+} Reader;
+
+extern __thread int line_limit;
+
+int reader_init(Reader *rdr, int fh);
+void reader_release(Reader *rdr);
+int reader_grow(Reader *rdr);
+int reader_next_line(Reader *rdr, const char **line, int *len);
+off_t reader_tell(const Reader *rdr);
+void reader_seek(Reader *rdr, off_t offset);
+void reader_discard(Reader *rdr);
+void reader_forget_heads(Reader *rdr);
+int reader_check_file(Reader *rdr);
+int reader_record_head(Reader *rdr, const char *name, int len, off_t offset);
+Reader *find_reader(int fh);
 
 /**
- * Internal functions, supporting public functions further down.
+ * Lookup index of an **ri_Section**, built by *ri_load()* with
+ * RI_INDEX.  Each section has its own table of tags, and all sections
+ * of a document share one table of section names.
  */
+struct ri_index
+{
+   const Name_Table *sections;   // first section of each name
+   const ri_Section *head;       // head of indexed sections list
+   const ri_Section *same_name;  // next section with the same name
+   unsigned ordinal;             // position of section in list
+   Name_Table tags;              // first line of each tag in section
+};
+
+unsigned ri_hash(const char *str);
+unsigned ri_hash_slice(const char *str, int len);
+unsigned ri_hash_more(unsigned hash, const char *str, int len);
+int index_tags(struct ri_index *index, const ri_Line *lines, Arena *arena);
+int ri_build_index(ri_Section *head, Arena *arena);
+const ri_Section *ri_index_get_section(const ri_Section *root, const char *name);
+const ri_Line *ri_index_find_line(const ri_Section *section, const char *tag, unsigned hash);
+
+/**
+ * Lookups of *ri_find_batch()* and *ri_open_batch()*, arranged for
+ * one pass: a table of the sections named, each with a table of the
+ * tags asked for in it.  Lookups of the same section and tag share
+ * a key, whose value is set by the first line found.
+ */
+typedef struct ri_batch_key
+{
+   const char *value;
+   int found;
+} Batch_Key;
+
+typedef struct ri_batch_section
+{
+   Name_Table tags;      // Batch_Key of each tag
+   unsigned tag_count;
+} Batch_Section;
+
+typedef struct ri_batch
+{
+   Arena arena;
+   Name_Table sections;  // Batch_Section of each section name
+   unsigned section_count;
+   Batch_Key **keys;     // key of each lookup
+   int unresolved;       // keys not yet found
+} Batch;
+
+int batch_init(Batch *batch, const ri_Lookup *lookups, int count);
+Batch_Section *batch_section(const Batch *batch, const char *name, int len);
+Batch_Key *batch_match(const Batch_Section *section, const char *tag, int len);
+void batch_resolve(Batch *batch, Batch_Key *key, const char *value);
+int batch_finish(const Batch *batch, ri_Lookup *lookups, int count);
+
+/**
+ * Layout of a cache file written by *ri_compile()*.  All offsets are
+ * from the start of the file, except those of strings, which are from
+ * *strings_off*, so the file can be mapped anywhere and used as is.
+ *
+ * Values are found by (section name, tag) with a perfect hash: the
+ * key hash selects a bucket, whose seed displaces the key hash to a
+ * slot that no other key uses.  Only the first line with a tag in the
+ * first section with a name that has the tag is in the table, as
+ * *ri_find_section_value()* would find.  A cache whose keys defeated
+ * the seeds has no buckets or slots, and is searched through its
+ * sections instead.
+ */
+#define RI_CACHE_MAGIC      "RICACHE"
+#define RI_CACHE_VERSION    1
+#define RI_CACHE_BYTE_ORDER 0x01020304
+#define RI_CACHE_EMPTY      0xFFFFFFFF
+
+typedef struct ri_cache_header
+{
+   char magic[8];
+   uint32_t version;
+   uint32_t byte_order;        // RI_CACHE_BYTE_ORDER as written
+   uint64_t total_size;
+
+   // Source file, to detect a stale cache:
+   uint64_t source_size;
+   int64_t source_mtime_sec;
+   int64_t source_mtime_nsec;
+   uint64_t source_hash;
+
+   uint32_t section_count;
+   uint32_t entry_count;
+   uint32_t bucket_count;
+   uint32_t slot_count;        // a power of 2, or 0 without a perfect hash
+
+   uint64_t sections_off;      // Cache_Section[section_count]
+   uint64_t entries_off;       // ri_Entry[entry_count], in section order
+   uint64_t seeds_off;         // uint32_t[bucket_count]
+   uint64_t slots_off;         // Cache_Slot[slot_count]
+   uint64_t strings_off;       // terminated names, tags and values
+   uint64_t strings_len;
+} Cache_Header;
+
+typedef struct ri_cache_section
+{
+   uint32_t name_off;
+   uint32_t first_entry;
+   uint32_t entry_count;
+   uint32_t reserved;
+} Cache_Section;
+
+typedef struct ri_cache_slot
+{
+   uint32_t section;
+   uint32_t entry;             // RI_CACHE_EMPTY for an unused slot
+} Cache_Slot;
+
+uint64_t cache_mix(uint64_t hash);
+uint64_t ri_hash_text(const char *text, size_t len);
+uint64_t cache_key_hash(const char *section_name, const char *tag_name);
+uint32_t cache_bucket(uint64_t hash, uint32_t bucket_count);
+uint32_t cache_slot(uint64_t hash, uint32_t seed, uint32_t slot_count);
+int compare_bucket_sizes(const void *left, const void *right);
+int place_buckets(const uint64_t *hashes, const uint32_t *order, const uint32_t *starts,
+                  const uint64_t *by_size, uint32_t bucket_count,
+                  uint32_t *seeds, uint32_t *keys, uint32_t slot_count, uint32_t *slots);
+int build_perfect_hash(const uint64_t *hashes, uint32_t count,
+                       uint32_t *seeds, uint32_t bucket_count,
+                       uint32_t *keys, uint32_t slot_count);
+int write_all(int fh, const void *buffer, size_t len);
+int replace_file(const char *path, const void *head, size_t head_len,
+                 const void *body, size_t body_len);
+uint64_t cache_align(uint64_t offset);
+struct ri_cache_keys;
+void add_cache_key(struct ri_cache_keys *keys, const char *buffer, uint32_t si, uint32_t ei);
+void fill_cache(const ri_Document *doc, char *buffer, struct ri_cache_keys *keys);
+int write_cache(const ri_Document *doc, const char *cache_path,
+                const struct stat *source, uint64_t hash);
+int cache_region_fits(uint64_t offset, uint64_t count, uint64_t size, uint64_t total);
+const Cache_Header *map_cache(const char *cache_path);
+void unmap_cache(const Cache_Header *cache);
+int refresh_cache(const Cache_Header *cache, const char *cache_path, const struct stat *source);
+ri_Document *cached_document(const Cache_Header *cache, int flags);
+ri_Section *cache_sections(ri_Document *doc);
+const char *cache_find_value(const Cache_Header *cache, const char *section_name, const char *tag_name);
+
+/**
+ * Contents of the opaque **ri_Document**.  The document itself, its
+ * nodes and, unless mapped, its text are all allocated from *arena*.
+ *
+ * A document loaded from a cache has no text: its sections are made
+ * from the mapped *cache* when first asked for, under *lock*.
+ */
+struct ri_document
+{
+   Arena arena;
+   ri_Section *sections;
+   char *text;
+   size_t len;
+   int flags;
+
+   const Cache_Header *cache;
+   pthread_mutex_t lock;
+
+   Interner *interner;   // names of a document loaded with RI_INTERN
+   const struct ri_sorted *sorted;   // sections in order of name, with RI_SORTED
+};
+
+ssize_t read_text(int fh, char *text, size_t len);
+ssize_t read_stream(int fh, Arena *arena, char **text);
+ri_Document *read_document(int fh, size_t size, int flags, size_t reserve);
+int parse_document(ri_Document *doc, int threads);
+void clear_index(ri_Section *head);
+ri_Document *load_file(const char *filepath, int flags, int threads, Interner *interner);
+const ri_Line *interned_line(const ri_Document *doc, const char *section_name,
+                             const char *tag_name);
+
+/**
+ * Text of a section of a document loaded with RI_LAZY, from its head
+ * to the next head, parsed under the lock of the document when the
+ * section is first looked up.
+ */
+typedef struct ri_lazy
+{
+   ri_Document *doc;
+   char *text;
+   size_t len;
+} Lazy_Section;
+
+/**
+ * Sections of a document, or lines of a section, in order of name,
+ * for the pattern queries of a document loaded with RI_SORTED.  Nodes
+ * of the same name keep their order in the file.  The name of a
+ * section or line is its first member, so both are sorted alike.
+ */
+typedef struct ri_sorted
+{
+   unsigned count;
+   const void *nodes[];
+} Sorted_Nodes;
+
+const char *node_name(const void *node);
+int sort_nodes(const void **nodes, unsigned count);
+int sort_lines(ri_Section *section, Arena *arena);
+int sort_document(ri_Document *doc);
+int match_range(const Sorted_Nodes *sorted, const char *pattern, ri_Match_Iter *iter);
+const void *match_next(ri_Match_Iter *iter);
+
+ri_Section *lazy_sections(ri_Document *doc);
+int lazy_parse(ri_Section *section, const Lazy_Section *lazy);
+const ri_Section *section_parsed(const ri_Section *section);
+
+/**
+ * Files of a layered load by *ri_load_layers()*, in order of
+ * precedence: each file follows the files it includes, so that its
+ * own lines override theirs.  The texts are read into the scratch
+ * arena, and each is parsed into the arena of its chunk, so only the
+ * merged lines, copied to the document arena, outlast the load.
+ */
+#define RI_INCLUDE_DEPTH 16
+
+typedef struct ri_layers
+{
+   Arena scratch;         // paths, texts, the table of files and merge tables
+   Name_Table files;      // real path of each file read
+   unsigned file_count;
+   Parse_Chunk *chunks;   // text and sections of each file
+   int count;
+   int capacity;
+   int depth;             // nesting of the includes being read
+   int failed;
+} Layers;
+
+/**
+ * A section of the merged document, with the line of each tag and
+ * the number of the layer that last set it.
+ */
+typedef struct ri_merge_section
+{
+   ri_Section *section;
+   ri_Line *tail;
+   Name_Table tags;       // Merge_Key of each tag
+   unsigned tag_count;
+} Merge_Section;
+
+typedef struct ri_merge_key
+{
+   ri_Line *line;
+   int layer;
+} Merge_Key;
+
+char *include_path(Layers *layers, const char *from, const char *path, int len);
+int compare_names(const void *left, const void *right);
+void layers_include(Layers *layers, const char *from, const char *text, size_t len);
+int layers_add_dir(Layers *layers, const char *path);
+int layers_add_file(Layers *layers, const char *path);
+int merge_line(Merge_Section *merged, const ri_Line *line, int layer, Arena *arena,
+               Arena *scratch);
+ri_Section *merge_layers(Layers *layers, Arena *arena);
+int place_merged(ri_Section *head, Arena *arena);
+ri_Document *load_layers(const char **filepaths, int count, int flags, int threads,
+                         Interner *interner);
 
-void read_inifile_section_lines(struct read_inifile_bundle* bundle);
-void read_inifile_section_recursive(struct read_inifile_bundle* bundle);
+/**
+ * A file of a directory loaded by *ri_load_dir()*, with the state of
+ * its read: a file the ring read has its *text*, and the others are
+ * read by the worker that parses them.
+ */
+typedef struct ri_dir_file
+{
+   const char *name;      // first, for compare_names()
+   ri_Document *doc;
+   char *text;
+   ssize_t len;           // length read, or -1
+   int fh;                // descriptor opened by the ring, or -1
+} Dir_File;
+
+struct ri_directory
+{
+   Arena arena;           // the directory, names, texts and documents
+   Name_Table names;      // Dir_File of each name
+   Dir_File *files;       // in order of name
+   int count;
+};
+
+/**
+ * Work shared by the workers of *ri_load_dir()*: each takes the next
+ * file, and parses it into the arena of the worker.
+ */
+typedef struct ri_dir_work
+{
+   ri_Directory *dir;
+   const char *dirpath;
+   int dirfd;
+   int flags;
+   int next;
+   int failed;
+} Dir_Work;
+
+typedef struct ri_dir_worker
+{
+   Dir_Work *work;
+   Arena arena;
+   pthread_t thread;
+} Dir_Worker;
+
+typedef struct ri_uring Uring;
+struct io_uring_sqe;
+
+int uring_init(Uring *ring, unsigned entries);
+void uring_release(Uring *ring);
+struct io_uring_sqe *uring_sqe(Uring *ring, int opcode, int fd, uint64_t user_data);
+int uring_enter(Uring *ring, unsigned submit, unsigned wait);
+int uring_reap(Uring *ring, uint64_t *user_data, int *res);
+int dir_list(ri_Directory *dir, DIR *handle);
+void dir_read_ring(ri_Directory *dir, int dirfd, Uring *ring);
+int dir_read_file(Dir_File *file, int dirfd, Arena *arena);
+void *dir_parse(void *arg);
+
+void wait_for_readers(ri_Watcher *watcher);
+void *watch_thread(void *arg);
+int start_watch_thread(ri_Watcher *watcher);
+
+/**
+ * Internal functions, supporting public functions further down.
+ */
 
+char *arena_strndup(Arena *arena, const char *str, int len);
+int read_line(Reader *rdr, const char **line, int *len);
+int read_section_lines(Reader *rdr, Arena *arena, const char **head, int *len,
+                       const ri_Section *section, Name_Set *names, ri_Line **result);
+int read_sections(Reader *rdr, Arena *arena, ri_Section **result);
 
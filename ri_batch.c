@@ -0,0 +1,305 @@
+#include <stdio.h>
+#include <stdlib.h>  // for malloc(), free()
+#include <string.h>  // for memset()
+#include <sys/types.h>
+
+#include "readini.h"
+#include "readini_private.h"
+
+/**
+ * @brief Prepare to resolve a batch of lookups in one pass.
+ *
+ * The distinct section names of the lookups are entered in a table,
+ * each with a table of the distinct tags asked for in the section,
+ * so each section and line met in the pass is matched with a hash
+ * probe.  Repeated lookups share a key.
+ *
+ * @return TRUE if successful, FALSE if out of memory.
+ */
+int batch_init(Batch *batch, const ri_Lookup *lookups, int count)
+{
+   Name_Slot *slot;
+   Batch_Section *section;
+   Batch_Key *key;
+   unsigned hash;
+   int index;
+
+   memset(batch, 0, sizeof(Batch));
+   ri_arena_init(&batch->arena, 0);
+
+   batch->keys = (Batch_Key**)ri_arena_alloc(&batch->arena, (count + 1) * sizeof(Batch_Key*));
+   if (!batch->keys)
+      return 0;
+
+   for (index = 0; index < count; ++index)
+   {
+      if (!name_table_grow(&batch->sections, batch->section_count + 1, &batch->arena))
+         return 0;
+
+      hash = ri_hash(lookups[index].section_name);
+      slot = name_table_probe(&batch->sections, lookups[index].section_name, hash);
+      if (!(section = (Batch_Section*)slot->node))
+      {
+         section = (Batch_Section*)ri_arena_alloc(&batch->arena, sizeof(Batch_Section));
+         if (!section)
+            return 0;
+
+         memset(section, 0, sizeof(Batch_Section));
+         slot->hash = hash;
+         slot->name = lookups[index].section_name;
+         slot->node = section;
+         ++batch->section_count;
+      }
+
+      if (!name_table_grow(&section->tags, section->tag_count + 1, &batch->arena))
+         return 0;
+
+      hash = ri_hash(lookups[index].tag_name);
+      slot = name_table_probe(&section->tags, lookups[index].tag_name, hash);
+      if (!(key = (Batch_Key*)slot->node))
+      {
+         key = (Batch_Key*)ri_arena_alloc(&batch->arena, sizeof(Batch_Key));
+         if (!key)
+            return 0;
+
+         memset(key, 0, sizeof(Batch_Key));
+         slot->hash = hash;
+         slot->name = lookups[index].tag_name;
+         slot->node = key;
+         ++section->tag_count;
+         ++batch->unresolved;
+      }
+
+      batch->keys[index] = key;
+   }
+
+   return 1;
+}
+
+/**
+ * @brief Find the entry of a section name among the lookups.
+ *
+ * @return The section's tags, or NULL if no lookup names the section.
+ */
+Batch_Section *batch_section(const Batch *batch, const char *name, int len)
+{
+   if (!batch->section_count)
+      return NULL;
+
+   return (Batch_Section*)name_table_probe_slice(&batch->sections, name, len,
+                                                 ri_hash_slice(name, len))->node;
+}
+
+/**
+ * @brief Find the key of a tag among the lookups of a section.
+ *
+ * @return The key, or NULL if the tag isn't asked for or was
+ *         already found in an earlier line or section.
+ */
+Batch_Key *batch_match(const Batch_Section *section, const char *tag, int len)
+{
+   Batch_Key *key = (Batch_Key*)name_table_probe_slice(&section->tags, tag, len,
+                                                       ri_hash_slice(tag, len))->node;
+
+   return key && !key->found ? key : NULL;
+}
+
+/** @brief Record the value of a key found for the first time. */
+void batch_resolve(Batch *batch, Batch_Key *key, const char *value)
+{
+   key->found = 1;
+   key->value = value;
+   --batch->unresolved;
+}
+
+/**
+ * @brief Set the results of the lookups.
+ *
+ * @return Number of lookups whose tag was found.
+ */
+int batch_finish(const Batch *batch, ri_Lookup *lookups, int count)
+{
+   int index, found = 0;
+
+   for (index = 0; index < count; ++index)
+   {
+      *lookups[index].value = batch->keys[index]->value;
+      found += batch->keys[index]->found;
+   }
+
+   return found;
+}
+
+/**
+ * @brief Find the values of many tags in one pass over the sections.
+ *
+ * Each lookup names a section and a tag, and points to where the
+ * value found is set, or NULL if the tag isn't found or has no
+ * value, exactly as *ri_find_section_value()* would find it.  Making
+ * the lookups one by one scans the sections from the head for each;
+ * here, each section and line is visited once for all of them, and
+ * the pass stops as soon as every tag is found.
+ *
+ * Sections loaded with RI_INDEX are searched through the index
+ * instead, one lookup at a time, since that needs no scan.
+ *
+ * @param sections_head Head of the sections list.
+ * @param lookups       Array of sections, tags and value pointers.
+ * @param count         Number of lookups in the array.
+ *
+ * @return Number of lookups whose tag was found, or -1 if out of
+ *         memory, in which case no value was set.
+ */
+int ri_find_batch(const ri_Section *sections_head, ri_Lookup *lookups, int count)
+{
+   const ri_Section *section;
+   const ri_Line *line;
+   Batch_Section *wanted;
+   Batch_Key *key;
+   Batch batch;
+   int index, found = 0;
+
+   if (sections_head && SECTION_NODE(sections_head)->index)
+   {
+      for (index = 0; index < count; ++index)
+      {
+         line = ri_find_section_line(sections_head, lookups[index].section_name,
+                                     lookups[index].tag_name);
+         *lookups[index].value = line ? line->value : NULL;
+         found += line != NULL;
+      }
+
+      return found;
+   }
+
+   if (!batch_init(&batch, lookups, count))
+   {
+      ri_arena_release(&batch.arena);
+      fprintf(stderr, "Failed to allocate lookup memory.");
+      return -1;
+   }
+
+   for (section = sections_head; section && batch.unresolved; section = section->next)
+   {
+      wanted = batch_section(&batch, section->section_name, strlen(section->section_name));
+      if (!wanted)
+         continue;
+
+      for (line = section_parsed(section)->lines; line; line = line->next)
+         if ((key = batch_match(wanted, line->tag, strlen(line->tag))))
+            batch_resolve(&batch, key, line->value);
+   }
+
+   found = batch_finish(&batch, lookups, count);
+   ri_arena_release(&batch.arena);
+
+   return found;
+}
+
+/**
+ * @brief Find the values of many tags in one pass over a file.
+ *
+ * The batch equivalent of calling *ri_open_section()* for each
+ * section: the file is read once from the top, stopping when every
+ * tag is found, and only the values asked for are kept.  The values
+ * are set in the lookups as by *ri_find_batch()*, and remain valid
+ * until *cb_file_user* returns.
+ *
+ * Section heads passed are recorded as by *ri_open_section()*, and
+ * the file position of *fh* is neither used nor moved.
+ *
+ * @param fh           File descriptor of an open file.
+ * @param lookups      Array of sections, tags and value pointers.
+ * @param count        Number of lookups in the array.
+ * @param cb_file_user Function called with the values set.
+ * @param data         Castable void pointer to custom application data.
+ *
+ * @return Number of lookups whose tag was found, or -1 if the file
+ *         couldn't be read or memory allocated, in which case the
+ *         callback isn't called.
+ */
+int ri_open_batch(int fh, ri_Lookup *lookups, int count, ri_File_User cb_file_user, void *data)
+{
+   Reader local_reader, *rdr = find_reader(fh);
+   struct ri_line_info li;
+   Batch_Section *wanted = NULL;
+   Batch_Key *key;
+   Batch batch;
+   const char *line, *close;
+   const char *value;
+   off_t saved_offset;
+   int len, found = -1, recording, failed = 0;
+
+   // Use a temporary reader if *fh* wasn't opened with ri_open():
+   if (!rdr)
+   {
+      if (!reader_init(&local_reader, fh))
+         return -1;
+      rdr = &local_reader;
+   }
+
+   saved_offset = reader_tell(rdr);
+   reader_check_file(rdr);
+   recording = !rdr->heads_complete;
+
+   if (!batch_init(&batch, lookups, count))
+      failed = 1;
+   else
+   {
+      reader_seek(rdr, 0);
+
+      while (!failed && batch.unresolved && read_line(rdr, &line, &len))
+      {
+         if (len && line_is_section_type(line))
+         {
+            close = (const char*)memchr(line, ']', len);
+            wanted = close ? batch_section(&batch, line + 1, close - line - 1) : NULL;
+
+            // Record heads following those recorded by find_section():
+            if (close && recording && reader_tell(rdr) > rdr->heads_scanned)
+            {
+               if (reader_record_head(rdr, line + 1, close - line - 1, reader_tell(rdr)))
+                  rdr->heads_scanned = reader_tell(rdr);
+               else
+               {
+                  reader_forget_heads(rdr);
+                  recording = 0;
+               }
+            }
+         }
+         else if (wanted && ri_parse_line_slice(line, line + len, &li)
+                  && (key = batch_match(wanted, li.tag, li.len_tag)))
+         {
+            value = NULL;
+            if (li.len_value && !(value = arena_strndup(&batch.arena, li.value, li.len_value)))
+               failed = 1;
+            else
+               batch_resolve(&batch, key, value);
+         }
+      }
+
+      // A pass that reached the end has seen every head:
+      if (!failed && batch.unresolved && recording && reader_tell(rdr) >= rdr->heads_scanned)
+      {
+         rdr->heads_scanned = reader_tell(rdr);
+         rdr->heads_complete = 1;
+      }
+   }
+
+   if (failed)
+      fprintf(stderr, "Failed to allocate lookup memory.");
+   else
+   {
+      // The values are in the batch arena until the callback returns:
+      found = batch_finish(&batch, lookups, count);
+      (*cb_file_user)(fh, data);
+   }
+
+   ri_arena_release(&batch.arena);
+   reader_seek(rdr, saved_offset);
+
+   if (rdr == &local_reader)
+      reader_release(rdr);
+
+   return found;
+}
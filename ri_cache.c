@@ -0,0 +1,852 @@
+#include <stdio.h>
+#include <stdlib.h>  // for malloc(), qsort(), mkstemp()
+#include <string.h>  // for strcmp(), memcpy()
+#include <unistd.h>  // for write(), close(), unlink()
+#include <fcntl.h>
+#include <errno.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+
+#include "readini.h"
+#include "readini_private.h"
+
+/** Keys per bucket of the perfect hash, on average. */
+#define CACHE_BUCKET_KEYS 4
+
+/**
+ * Seeds to try for a bucket before giving up on the perfect hash.
+ * Buckets are placed while most slots are free, so an ordinary key
+ * set needs only a few tries, and a pathological one is written
+ * without a perfect hash rather than searched for long.
+ */
+#define CACHE_SEED_TRIES (1 << 12)
+
+/** @brief Scramble the bits of a hash (the MurmurHash3 finalizer). */
+uint64_t cache_mix(uint64_t hash)
+{
+   hash ^= hash >> 33;
+   hash *= 0xff51afd7ed558ccdULL;
+   hash ^= hash >> 33;
+   hash *= 0xc4ceb9fe1a85ec53ULL;
+   hash ^= hash >> 33;
+   return hash;
+}
+
+/**
+ * @brief Hash the contents of a file, eight bytes at a time.
+ *
+ * Only used to tell whether a file has changed, so speed matters
+ * more than resistance to contrived collisions.
+ */
+uint64_t ri_hash_text(const char *text, size_t len)
+{
+   uint64_t hash = 0xcbf29ce484222325ULL ^ len;
+   uint64_t word;
+
+   for (; len >= 8; text += 8, len -= 8)
+   {
+      memcpy(&word, text, 8);
+      hash = (hash ^ word) * 0x9e3779b97f4a7c15ULL;
+      hash ^= hash >> 29;
+   }
+
+   word = 0;
+   memcpy(&word, text, len);
+
+   return cache_mix(hash ^ word);
+}
+
+/** @brief 64-bit FNV-1a hash of a section name and tag, as one key. */
+uint64_t cache_key_hash(const char *section_name, const char *tag_name)
+{
+   uint64_t hash = 0xcbf29ce484222325ULL;
+
+   for (; *section_name; ++section_name)
+      hash = (hash ^ (unsigned char)*section_name) * 0x100000001b3ULL;
+
+   // The terminator separates the two names:
+   hash *= 0x100000001b3ULL;
+
+   for (; *tag_name; ++tag_name)
+      hash = (hash ^ (unsigned char)*tag_name) * 0x100000001b3ULL;
+
+   return hash;
+}
+
+/** @brief Bucket of a key, from the high bits of its mixed hash. */
+uint32_t cache_bucket(uint64_t hash, uint32_t bucket_count)
+{
+   return (uint32_t)(cache_mix(hash) >> 32) % bucket_count;
+}
+
+/** @brief Slot of a key when its bucket has the given seed. */
+uint32_t cache_slot(uint64_t hash, uint32_t seed, uint32_t slot_count)
+{
+   return (uint32_t)cache_mix(hash ^ (seed * 0x9e3779b97f4a7c15ULL)) & (slot_count - 1);
+}
+
+/** @brief Order for *qsort()*: largest bucket first. */
+int compare_bucket_sizes(const void *left, const void *right)
+{
+   uint64_t l = *(const uint64_t*)left, r = *(const uint64_t*)right;
+   return l < r ? 1 : l > r ? -1 : 0;
+}
+
+/**
+ * @brief Find a seed for each bucket that puts its keys in free slots.
+ *
+ * @param order   Keys grouped by bucket.
+ * @param starts  Index in *order* of the first key of each bucket.
+ * @param by_size Size and index of each bucket, largest first.
+ * @param slots   Room for the slots of the largest bucket.
+ *
+ * @return TRUE if every key was placed.
+ */
+int place_buckets(const uint64_t *hashes, const uint32_t *order, const uint32_t *starts,
+                  const uint64_t *by_size, uint32_t bucket_count,
+                  uint32_t *seeds, uint32_t *keys, uint32_t slot_count, uint32_t *slots)
+{
+   uint32_t index, bucket, size, seed, placed, other;
+
+   for (index = 0; index < bucket_count; ++index)
+   {
+      bucket = (uint32_t)by_size[index];
+      size = (uint32_t)(by_size[index] >> 32);
+      if (!size)
+         break;
+
+      for (seed = 0; seed < CACHE_SEED_TRIES; ++seed)
+      {
+         for (placed = 0; placed < size; ++placed)
+         {
+            slots[placed] = cache_slot(hashes[order[starts[bucket] + placed]], seed, slot_count);
+            if (keys[slots[placed]] != RI_CACHE_EMPTY)
+               break;
+
+            for (other = 0; other < placed && slots[other] != slots[placed]; ++other)
+               ;
+            if (other < placed)
+               break;
+         }
+
+         if (placed == size)
+            break;
+      }
+
+      if (seed == CACHE_SEED_TRIES)
+         return 0;
+
+      seeds[bucket] = seed;
+      for (placed = 0; placed < size; ++placed)
+         keys[slots[placed]] = order[starts[bucket] + placed];
+   }
+
+   return 1;
+}
+
+/**
+ * @brief Build a perfect hash of a set of keys.
+ *
+ * Keys are grouped in buckets, which are placed largest first, while
+ * most slots are free.
+ *
+ * @param hashes Hash of each key.
+ * @param seeds  Set to the seed of each bucket.
+ * @param keys   Set to the key in each slot, or RI_CACHE_EMPTY.
+ *
+ * @return TRUE if every key was placed, FALSE if out of memory or
+ *         if no seed could be found for a bucket.
+ */
+int build_perfect_hash(const uint64_t *hashes, uint32_t count,
+                       uint32_t *seeds, uint32_t bucket_count,
+                       uint32_t *keys, uint32_t slot_count)
+{
+   uint32_t *starts = (uint32_t*)calloc(bucket_count + 1, sizeof(uint32_t));
+   uint32_t *order = (uint32_t*)malloc((count + 1) * sizeof(uint32_t));
+   uint64_t *by_size = (uint64_t*)malloc(bucket_count * sizeof(uint64_t));
+   uint32_t *slots = NULL;
+   uint32_t index, key, bucket, size, max_size = 0;
+   int success = 0;
+
+   if (starts && order && by_size)
+   {
+      memset(seeds, 0, bucket_count * sizeof(uint32_t));
+      for (index = 0; index < slot_count; ++index)
+         keys[index] = RI_CACHE_EMPTY;
+
+      // Group the keys by bucket:
+      for (key = 0; key < count; ++key)
+         ++starts[cache_bucket(hashes[key], bucket_count) + 1];
+
+      for (bucket = 0; bucket < bucket_count; ++bucket)
+      {
+         size = starts[bucket + 1];
+         if (size > max_size)
+            max_size = size;
+
+         by_size[bucket] = (uint64_t)size << 32 | bucket;
+         starts[bucket + 1] += starts[bucket];
+      }
+
+      for (key = 0; key < count; ++key)
+         order[starts[cache_bucket(hashes[key], bucket_count)]++] = key;
+
+      // Each start was advanced to the next bucket's start:
+      memmove(&starts[1], starts, bucket_count * sizeof(uint32_t));
+      starts[0] = 0;
+
+      qsort(by_size, bucket_count, sizeof(uint64_t), compare_bucket_sizes);
+
+      if ((slots = (uint32_t*)malloc((max_size + 1) * sizeof(uint32_t))))
+         success = place_buckets(hashes, order, starts, by_size, bucket_count,
+                                 seeds, keys, slot_count, slots);
+   }
+
+   free(starts);
+   free(order);
+   free(by_size);
+   free(slots);
+   return success;
+}
+
+/** @brief Write a whole buffer, returning FALSE on failure. */
+int write_all(int fh, const void *buffer, size_t len)
+{
+   const char *ptr = (const char*)buffer;
+   ssize_t written;
+
+   while (len > 0)
+   {
+      written = write(fh, ptr, len);
+      if (written == -1)
+      {
+         if (errno == EINTR)
+            continue;
+         return 0;
+      }
+
+      ptr += written;
+      len -= written;
+   }
+
+   return 1;
+}
+
+/**
+ * @brief Replace a file with new contents in one step.
+ *
+ * The contents are written to a temporary file in the same directory,
+ * which is then renamed over *path*, so a process mapping the file
+ * sees either the old or the new file, never a mix.
+ *
+ * @return TRUE on success.
+ */
+int replace_file(const char *path, const void *head, size_t head_len,
+                 const void *body, size_t body_len)
+{
+   char *temp = (char*)malloc(strlen(path) + 8);
+   int fh, success = 0;
+
+   if (!temp)
+      return 0;
+
+   sprintf(temp, "%s.XXXXXX", path);
+
+   if ((fh = mkstemp(temp)) != -1)
+   {
+      success = fchmod(fh, 0644) == 0
+         && write_all(fh, head, head_len)
+         && write_all(fh, body, body_len);
+
+      success = close(fh) == 0 && success && rename(temp, path) == 0;
+
+      if (!success)
+         unlink(temp);
+   }
+
+   free(temp);
+   return success;
+}
+
+/** @brief Round up to a multiple of 8, to align the parts of a cache. */
+uint64_t cache_align(uint64_t offset)
+{
+   return (offset + 7) & ~(uint64_t)7;
+}
+
+/**
+ * Keys of a cache being written, each the first line with a tag in
+ * the first section with a name that has the tag.  The keys found so
+ * far are in an open-addressing *table*, to reject later duplicates.
+ */
+typedef struct ri_cache_keys
+{
+   uint64_t *hashes;
+   uint32_t *sections;
+   uint32_t *entries;
+   uint32_t count;
+   uint32_t *table;
+   uint32_t table_mask;
+} Cache_Keys;
+
+/**
+ * @brief Add a key unless it is already present.
+ *
+ * Keys are compared by the names already copied to the cache.
+ */
+void add_cache_key(Cache_Keys *keys, const char *buffer, uint32_t si, uint32_t ei)
+{
+   const Cache_Header *header = (const Cache_Header*)buffer;
+   const Cache_Section *sections = (const Cache_Section*)(buffer + header->sections_off);
+   const ri_Entry *entries = (const ri_Entry*)(buffer + header->entries_off);
+   const char *strings = buffer + header->strings_off;
+   const char *name = &strings[sections[si].name_off];
+   const char *tag = &strings[entries[ei].tag_off];
+   uint64_t hash = cache_key_hash(name, tag);
+   uint32_t pos, key;
+
+   for (pos = hash & keys->table_mask;
+        (key = keys->table[pos]) != RI_CACHE_EMPTY;
+        pos = (pos + 1) & keys->table_mask)
+   {
+      if (keys->hashes[key] == hash
+          && 0 == strcmp(&strings[sections[keys->sections[key]].name_off], name)
+          && 0 == strcmp(&strings[entries[keys->entries[key]].tag_off], tag))
+         return;
+   }
+
+   keys->table[pos] = keys->count;
+   keys->hashes[keys->count] = hash;
+   keys->sections[keys->count] = si;
+   keys->entries[keys->count] = ei;
+   ++keys->count;
+}
+
+/**
+ * @brief Copy the sections, entries and strings of a document to a
+ *        cache buffer whose header is complete, and collect its keys.
+ */
+void fill_cache(const ri_Document *doc, char *buffer, Cache_Keys *keys)
+{
+   const Cache_Header *header = (const Cache_Header*)buffer;
+   Cache_Section *sections = (Cache_Section*)(buffer + header->sections_off);
+   ri_Entry *entries = (ri_Entry*)(buffer + header->entries_off);
+   char *strings = buffer + header->strings_off;
+   const ri_Section *section;
+   const ri_Entry *entry;
+   ri_Entry_Iter iter;
+   const char *tag, *value;
+   uint32_t si, ei = 0, strings_len = 0, len;
+
+   for (si = 0, section = ri_document_sections(doc); section; section = section->next, ++si)
+   {
+      len = strlen(section->section_name) + 1;
+      memcpy(&strings[strings_len], section->section_name, len);
+      sections[si].name_off = strings_len;
+      sections[si].first_entry = ei;
+      sections[si].entry_count = SECTION_NODE(section)->entry_count;
+      strings_len += len;
+
+      if (!ri_entries(section, &iter))
+         continue;
+
+      for (; (entry = ri_entry_next(&iter, &tag, &value)); ++ei)
+      {
+         entries[ei].tag_off = strings_len;
+         entries[ei].tag_len = entry->tag_len;
+         memcpy(&strings[strings_len], tag, entry->tag_len + 1);
+         strings_len += entry->tag_len + 1;
+
+         entries[ei].value_len = entry->value_len;
+         if (entry->value_len)
+         {
+            entries[ei].value_off = strings_len;
+            memcpy(&strings[strings_len], value, entry->value_len + 1);
+            strings_len += entry->value_len + 1;
+         }
+
+         add_cache_key(keys, buffer, si, ei);
+      }
+   }
+}
+
+/**
+ * @brief Write the contents of a parsed document to a cache file.
+ *
+ * @param doc        Document parsed from the text of *source*.
+ * @param cache_path Path of the cache file to replace.
+ * @param source     Status of the source file when it was read.
+ * @param hash       *ri_hash_text()* of the source file.
+ *
+ * @return TRUE on success.
+ */
+int write_cache(const ri_Document *doc, const char *cache_path,
+                const struct stat *source, uint64_t hash)
+{
+   const ri_Section *section;
+   const ri_Entry *entry;
+   ri_Entry_Iter iter;
+   Cache_Header header;
+   Cache_Keys keys;
+   Cache_Slot *slots;
+   uint32_t *slot_keys, index, table_size;
+   uint32_t section_count = 0, entry_count = 0;
+   uint64_t strings_len = 0;
+   char *buffer;
+   int success = 0;
+
+   for (section = ri_document_sections(doc); section; section = section->next)
+   {
+      ++section_count;
+      entry_count += SECTION_NODE(section)->entry_count;
+      strings_len += strlen(section->section_name) + 1;
+
+      if (ri_entries(section, &iter))
+         while ((entry = ri_entry_next(&iter, NULL, NULL)))
+            strings_len += entry->tag_len + 1 + (entry->value_len ? entry->value_len + 1 : 0);
+   }
+
+   // Offsets into the strings and indexes of entries are 32-bit:
+   if (strings_len >= UINT32_MAX || entry_count >= RI_CACHE_EMPTY / 2)
+      return 0;
+
+   memset(&header, 0, sizeof(Cache_Header));
+   memcpy(header.magic, RI_CACHE_MAGIC, sizeof(header.magic));
+   header.version = RI_CACHE_VERSION;
+   header.byte_order = RI_CACHE_BYTE_ORDER;
+   header.source_size = source->st_size;
+   header.source_mtime_sec = source->st_mtim.tv_sec;
+   header.source_mtime_nsec = source->st_mtim.tv_nsec;
+   header.source_hash = hash;
+   header.section_count = section_count;
+   header.entry_count = entry_count;
+
+   header.bucket_count = entry_count / CACHE_BUCKET_KEYS + 1;
+   for (header.slot_count = 1;
+        header.slot_count < entry_count + entry_count / 4;
+        header.slot_count *= 2)
+      ;
+
+   header.sections_off = cache_align(sizeof(Cache_Header));
+   header.entries_off = cache_align(header.sections_off + (uint64_t)section_count * sizeof(Cache_Section));
+   header.seeds_off = cache_align(header.entries_off + (uint64_t)entry_count * sizeof(ri_Entry));
+   header.slots_off = cache_align(header.seeds_off + (uint64_t)header.bucket_count * sizeof(uint32_t));
+   header.strings_off = cache_align(header.slots_off + (uint64_t)header.slot_count * sizeof(Cache_Slot));
+   header.strings_len = strings_len;
+   header.total_size = header.strings_off + strings_len;
+
+   for (table_size = 1; table_size < entry_count * 2; table_size *= 2)
+      ;
+
+   memset(&keys, 0, sizeof(Cache_Keys));
+   keys.table_mask = table_size - 1;
+
+   buffer = (char*)calloc(1, header.total_size);
+   keys.hashes = (uint64_t*)malloc((entry_count + 1) * sizeof(uint64_t));
+   keys.sections = (uint32_t*)malloc((entry_count + 1) * sizeof(uint32_t));
+   keys.entries = (uint32_t*)malloc((entry_count + 1) * sizeof(uint32_t));
+   keys.table = (uint32_t*)malloc(table_size * sizeof(uint32_t));
+   slot_keys = (uint32_t*)malloc(header.slot_count * sizeof(uint32_t));
+
+   if (buffer && keys.hashes && keys.sections && keys.entries && keys.table && slot_keys)
+   {
+      memset(keys.table, 0xff, table_size * sizeof(uint32_t));
+      memcpy(buffer, &header, sizeof(Cache_Header));
+
+      fill_cache(doc, buffer, &keys);
+
+      if (build_perfect_hash(keys.hashes, keys.count,
+                             (uint32_t*)(buffer + header.seeds_off), header.bucket_count,
+                             slot_keys, header.slot_count))
+      {
+         slots = (Cache_Slot*)(buffer + header.slots_off);
+         for (index = 0; index < header.slot_count; ++index)
+         {
+            if (slot_keys[index] == RI_CACHE_EMPTY)
+               slots[index].section = slots[index].entry = RI_CACHE_EMPTY;
+            else
+            {
+               slots[index].section = keys.sections[slot_keys[index]];
+               slots[index].entry = keys.entries[slot_keys[index]];
+            }
+         }
+      }
+      else
+      {
+         // Without a perfect hash, lookups search the sections, and
+         // the room left for the seeds and slots is unused:
+         ((Cache_Header*)buffer)->bucket_count = 0;
+         ((Cache_Header*)buffer)->slot_count = 0;
+      }
+
+      success = replace_file(cache_path, buffer, header.total_size, NULL, 0);
+   }
+
+   free(buffer);
+   free(keys.hashes);
+   free(keys.sections);
+   free(keys.entries);
+   free(keys.table);
+   free(slot_keys);
+   return success;
+}
+
+/** @brief Check that a part of a cache lies within the file. */
+int cache_region_fits(uint64_t offset, uint64_t count, uint64_t size, uint64_t total)
+{
+   return offset <= total && (size == 0 || count <= (total - offset) / size);
+}
+
+/**
+ * @brief Map a cache file, and check its layout.
+ *
+ * The parts of the file must fit in the file, but their contents
+ * aren't checked: a cache is trusted to have been written by
+ * *ri_compile()* or *ri_load_cached()*.
+ *
+ * @return Pointer to the mapped header, or NULL if the file can't be
+ *         read or wasn't written by this version of the library.
+ */
+const Cache_Header *map_cache(const char *cache_path)
+{
+   const Cache_Header *cache;
+   struct stat st;
+   uint64_t total;
+
+   int fh = open(cache_path, O_RDONLY);
+   if (fh == -1)
+      return NULL;
+
+   if (fstat(fh, &st) || st.st_size < (off_t)sizeof(Cache_Header))
+   {
+      close(fh);
+      return NULL;
+   }
+
+   cache = (const Cache_Header*)mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fh, 0);
+   close(fh);
+
+   if (cache == MAP_FAILED)
+      return NULL;
+
+   RI_STAT_ADD(bytes_mapped, st.st_size);
+   total = st.st_size;
+   if (memcmp(cache->magic, RI_CACHE_MAGIC, sizeof(cache->magic))
+       || cache->version != RI_CACHE_VERSION
+       || cache->byte_order != RI_CACHE_BYTE_ORDER
+       || cache->total_size != total
+       || !cache->bucket_count != !cache->slot_count
+       || (cache->slot_count & (cache->slot_count - 1))
+       || !cache_region_fits(cache->sections_off, cache->section_count, sizeof(Cache_Section), total)
+       || !cache_region_fits(cache->entries_off, cache->entry_count, sizeof(ri_Entry), total)
+       || !cache_region_fits(cache->seeds_off, cache->bucket_count, sizeof(uint32_t), total)
+       || !cache_region_fits(cache->slots_off, cache->slot_count, sizeof(Cache_Slot), total)
+       || !cache_region_fits(cache->strings_off, cache->strings_len, 1, total))
+   {
+      munmap((void*)cache, st.st_size);
+      return NULL;
+   }
+
+   return cache;
+}
+
+/** @brief Unmap a cache mapped by *map_cache()*. */
+void unmap_cache(const Cache_Header *cache)
+{
+   munmap((void*)cache, cache->total_size);
+}
+
+/**
+ * @brief Rewrite a cache whose source file has a new time, but the
+ *        same contents, so the next load needn't read the source.
+ */
+int refresh_cache(const Cache_Header *cache, const char *cache_path, const struct stat *source)
+{
+   Cache_Header header = *cache;
+
+   header.source_mtime_sec = source->st_mtim.tv_sec;
+   header.source_mtime_nsec = source->st_mtim.tv_nsec;
+
+   return replace_file(cache_path, &header, sizeof(Cache_Header),
+                       cache + 1, cache->total_size - sizeof(Cache_Header));
+}
+
+/** @brief Make a document from a mapped cache, which it then owns. */
+ri_Document *cached_document(const Cache_Header *cache, int flags)
+{
+   Arena arena;
+   ri_Document *doc;
+
+   ri_arena_init(&arena, 0);
+
+   doc = (ri_Document*)ri_arena_alloc(&arena, sizeof(ri_Document));
+   if (!doc)
+   {
+      unmap_cache(cache);
+      return NULL;
+   }
+
+   memset(doc, 0, sizeof(ri_Document));
+   doc->flags = flags & ~(RI_MMAP | RI_LAZY | RI_INTERN | RI_SORTED);
+   doc->cache = cache;
+   pthread_mutex_init(&doc->lock, NULL);
+   doc->arena = arena;
+
+   return doc;
+}
+
+/**
+ * @brief Make the sections and lines of a cached document.
+ *
+ * Nodes are made only when the sections are first asked for, since
+ * *ri_document_value()* needs none.  Tags, values and entries are
+ * used in place in the mapped cache.
+ */
+ri_Section *cache_sections(ri_Document *doc)
+{
+   const Cache_Header *cache = doc->cache;
+   const Cache_Section *cached = (const Cache_Section*)((const char*)cache + cache->sections_off);
+   const ri_Entry *entries = (const ri_Entry*)((const char*)cache + cache->entries_off);
+   const char *strings = (const char*)cache + cache->strings_off;
+   Section_Node *sections, *section;
+   Line_Node *lines, *line;
+   const ri_Entry *entry;
+   uint32_t si, ei;
+
+   // A cache without sections never gets any, so it needs no lock:
+   if (!cache->section_count)
+      return NULL;
+
+   pthread_mutex_lock(&doc->lock);
+
+   if (!doc->sections && cache->section_count)
+   {
+      sections = (Section_Node*)ri_arena_alloc(&doc->arena, cache->section_count * sizeof(Section_Node));
+      lines = (Line_Node*)ri_arena_alloc(&doc->arena, (cache->entry_count + 1) * sizeof(Line_Node));
+
+      if (sections && lines)
+      {
+         for (si = 0; si < cache->section_count; ++si)
+         {
+            section = &sections[si];
+            memset(section, 0, sizeof(Section_Node));
+            section->section.section_name = &strings[cached[si].name_off];
+            section->section.next = si + 1 < cache->section_count ? &section[1].section : NULL;
+            section->pool = strings;
+
+            // A section that doesn't fit in the entries is left empty:
+            if (cached[si].first_entry > cache->entry_count
+                || cached[si].entry_count > cache->entry_count - cached[si].first_entry)
+               continue;
+
+            section->entries = &entries[cached[si].first_entry];
+            section->entry_count = cached[si].entry_count;
+            section->section.lines = section->entry_count ? &lines[cached[si].first_entry].line : NULL;
+
+            for (ei = 0; ei < section->entry_count; ++ei)
+            {
+               entry = &section->entries[ei];
+               line = &lines[cached[si].first_entry + ei];
+               line->line.tag = &strings[entry->tag_off];
+               line->line.value = entry->value_len ? &strings[entry->value_off] : NULL;
+               line->line.next = ei + 1 < section->entry_count ? &line[1].line : NULL;
+               line->section = &section->section;
+               line->typed = 0;
+            }
+         }
+
+         if (doc->flags & RI_INDEX)
+         {
+            RI_TRACE(RI_PHASE_INDEX, 0);
+            if (!ri_build_index(&sections->section, &doc->arena))
+               clear_index(&sections->section);
+            RI_TRACE(RI_PHASE_INDEX, 1);
+         }
+
+         __atomic_store_n(&doc->sections, &sections->section, __ATOMIC_RELEASE);
+      }
+   }
+
+   pthread_mutex_unlock(&doc->lock);
+
+   return doc->sections;
+}
+
+/** @brief Find a value in a cache with its perfect hash. */
+const char *cache_find_value(const Cache_Header *cache, const char *section_name, const char *tag_name)
+{
+   const char *base = (const char*)cache;
+   const char *strings = base + cache->strings_off;
+   const uint32_t *seeds = (const uint32_t*)(base + cache->seeds_off);
+   const Cache_Slot *slot;
+   const ri_Entry *entry;
+   const Cache_Section *section;
+   uint64_t hash = cache_key_hash(section_name, tag_name);
+
+   slot = (const Cache_Slot*)(base + cache->slots_off)
+      + cache_slot(hash, seeds[cache_bucket(hash, cache->bucket_count)], cache->slot_count);
+
+   // A missing key lands in an empty slot or on another key:
+   if (slot->entry >= cache->entry_count || slot->section >= cache->section_count)
+      return NULL;
+
+   section = (const Cache_Section*)(base + cache->sections_off) + slot->section;
+   entry = (const ri_Entry*)(base + cache->entries_off) + slot->entry;
+
+   if (strcmp(&strings[section->name_off], section_name)
+       || strcmp(&strings[entry->tag_off], tag_name))
+      return NULL;
+
+   return entry->value_len ? &strings[entry->value_off] : NULL;
+}
+
+/**
+ * @brief Parse a file and save the result in a cache file.
+ *
+ * The cache holds the sections, tags and values of the file and a
+ * perfect hash of its (section, tag) pairs, so *ri_load_cached()* can
+ * map it and answer lookups without parsing.  The cache records the
+ * size, time and a hash of the contents of the file, to tell when it
+ * has become stale.
+ *
+ * @param filepath   Path to the configuration file.
+ * @param cache_path Path to the cache file, which is replaced.
+ *
+ * @return TRUE if the cache was written.
+ */
+int ri_compile(const char *filepath, const char *cache_path)
+{
+   struct stat st;
+   ri_Document *doc = NULL;
+   uint64_t hash = 0;
+   int written = 0;
+
+   int fh = open(filepath, O_RDONLY);
+   if (fh == -1)
+   {
+      fprintf(stderr, "Failed to open \"%s\".", filepath);
+      return 0;
+   }
+
+   if (fstat(fh, &st) == 0 && (doc = read_document(fh, st.st_size, 0, st.st_size)))
+   {
+      hash = ri_hash_text(doc->text, doc->len);
+      if (!parse_document(doc, 1))
+      {
+         ri_free(doc);
+         doc = NULL;
+      }
+   }
+
+   close(fh);
+
+   if (doc)
+   {
+      written = write_cache(doc, cache_path, &st, hash);
+      ri_free(doc);
+   }
+
+   if (!written)
+      fprintf(stderr, "Failed to write \"%s\".", cache_path);
+
+   return written;
+}
+
+/**
+ * @brief Load a document from a cache file if it is current, or
+ *        from the text file if not.
+ *
+ * A cache whose source has the recorded size and time is mapped and
+ * used without reading the source.  If the time differs, the source
+ * is read and hashed, and the cache is still used if the contents
+ * are unchanged.  Otherwise the text is parsed as by *ri_load()*, and
+ * the cache is rewritten for the next load.  Failing to write the
+ * cache doesn't prevent loading.
+ *
+ * Lookups with *ri_document_value()* use the perfect hash of a cached
+ * document directly, or search its sections if no perfect hash could
+ * be built for its keys.  Its sections and lines are made when
+ * *ri_document_sections()* is first needed.
+ *
+ * @param filepath   Path to the configuration file.
+ * @param cache_path Path to the cache file.
+ * @param flags      Flags as for *ri_load()*.  With RI_INCLUDES, the
+ *                   cache isn't used, since it can't tell whether the
+ *                   included files changed.
+ *
+ * @return Pointer to the new document, or NULL on failure.
+ */
+ri_Document* ri_load_cached(const char *filepath, const char *cache_path, int flags)
+{
+   const Cache_Header *cache;
+   struct stat st;
+   ri_Document *doc = NULL;
+   uint64_t hash;
+   int fh;
+
+   if (flags & RI_INCLUDES)
+      return ri_load(filepath, flags);
+
+   // The cache is written from every section, makes them when needed anyway,
+   // and is searched by its own hash rather than by interned or sorted names:
+   flags &= ~(RI_LAZY | RI_INTERN | RI_SORTED);
+
+   fh = open(filepath, O_RDONLY);
+   if (fh == -1)
+   {
+      fprintf(stderr, "Failed to open \"%s\".", filepath);
+      return NULL;
+   }
+
+   if (fstat(fh, &st))
+   {
+      close(fh);
+      fprintf(stderr, "Failed to read \"%s\".", filepath);
+      return NULL;
+   }
+
+   if ((cache = map_cache(cache_path))
+       && cache->source_size == (uint64_t)st.st_size
+       && cache->source_mtime_sec == st.st_mtim.tv_sec
+       && cache->source_mtime_nsec == st.st_mtim.tv_nsec)
+   {
+      close(fh);
+      return cached_document(cache, flags);
+   }
+
+   doc = read_document(fh, st.st_size, flags, st.st_size);
+   close(fh);
+
+   if (!doc)
+   {
+      if (cache)
+         unmap_cache(cache);
+      fprintf(stderr, "Failed to read \"%s\".", filepath);
+      return NULL;
+   }
+
+   hash = ri_hash_text(doc->text, doc->len);
+
+   // A file that was touched or copied, but not changed, still matches:
+   if (cache && cache->source_size == doc->len && cache->source_hash == hash)
+   {
+      refresh_cache(cache, cache_path, &st);
+      ri_free(doc);
+      return cached_document(cache, flags);
+   }
+
+   if (cache)
+      unmap_cache(cache);
+
+   if (!parse_document(doc, 1))
+   {
+      ri_free(doc);
+      fprintf(stderr, "Failed to parse \"%s\".", filepath);
+      return NULL;
+   }
+
+   write_cache(doc, cache_path, &st, hash);
+
+   return doc;
+}
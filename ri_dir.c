@@ -0,0 +1,612 @@
+#include <stdio.h>
+#include <stdlib.h>  // for malloc(), realloc(), free(), getenv(), qsort()
+#include <string.h>  // for memset(), strcmp(), strlen()
+#include <unistd.h>  // for close(), syscall(), sysconf()
+#include <fcntl.h>   // for openat()
+#include <dirent.h>  // for opendir(), readdir()
+#include <errno.h>
+#include <pthread.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>     // for mmap(), munmap()
+#include <sys/syscall.h>  // for __NR_io_uring_setup, __NR_io_uring_enter
+#include <linux/io_uring.h>
+
+#include "readini.h"
+#include "readini_private.h"
+
+/** Files whose opens, then reads, are submitted to the ring at once. */
+#define RING_FILES 128
+
+/** Bytes read by the ring from each file; larger files are read again. */
+#define RING_READ 4096
+
+/**
+ * Submission and completion rings shared with the kernel, used
+ * through the raw system calls, so no library is needed.
+ */
+struct ri_uring
+{
+   int fd;
+   unsigned tail;          // tail of the entries queued, not yet submitted
+   unsigned pending;       // entries submitted whose completions aren't reaped
+   unsigned *sq_tail;
+   unsigned *sq_mask;
+   unsigned *sq_array;
+   unsigned *cq_head;
+   unsigned *cq_tail;
+   unsigned *cq_mask;
+   struct io_uring_sqe *sqes;
+   struct io_uring_cqe *cqes;
+   void *sq_ring;
+   void *cq_ring;
+   size_t sq_size;
+   size_t cq_size;
+   size_t sqes_size;
+};
+
+/**
+ * @brief Set up a ring with room for *entries* submissions.
+ *
+ * Rings are not used if the environment variable RI_URING is "off",
+ * or the kernel lacks the operations needed, which came with
+ * IORING_FEAT_RW_CUR_POS.
+ *
+ * @return TRUE if successful, FALSE if the ring can't be used.
+ */
+int uring_init(Uring *ring, unsigned entries)
+{
+#ifdef __NR_io_uring_setup
+   const char *setting = getenv("RI_URING");
+   struct io_uring_params params;
+
+   memset(ring, 0, sizeof(Uring));
+   memset(&params, 0, sizeof(params));
+   ring->fd = -1;
+
+   if (setting && 0 == strcmp(setting, "off"))
+      return 0;
+
+   ring->fd = (int)syscall(__NR_io_uring_setup, entries, &params);
+   if (ring->fd < 0)
+      return 0;
+
+   if (!(params.features & IORING_FEAT_RW_CUR_POS))
+   {
+      uring_release(ring);
+      return 0;
+   }
+
+   ring->sq_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+   ring->cq_size = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+   ring->sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+
+   // Both rings may share one mapping:
+   if (params.features & IORING_FEAT_SINGLE_MMAP)
+   {
+      if (ring->cq_size > ring->sq_size)
+         ring->sq_size = ring->cq_size;
+      ring->cq_size = 0;
+   }
+
+   ring->sq_ring = mmap(NULL, ring->sq_size, PROT_READ | PROT_WRITE,
+                        MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQ_RING);
+   ring->cq_ring = ring->sq_ring;
+   if (ring->sq_ring != MAP_FAILED && ring->cq_size)
+      ring->cq_ring = mmap(NULL, ring->cq_size, PROT_READ | PROT_WRITE,
+                           MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_CQ_RING);
+   ring->sqes = (struct io_uring_sqe*)mmap(NULL, ring->sqes_size, PROT_READ | PROT_WRITE,
+                                           MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQES);
+
+   if (ring->sq_ring == MAP_FAILED || ring->cq_ring == MAP_FAILED
+       || ring->sqes == (struct io_uring_sqe*)MAP_FAILED)
+   {
+      uring_release(ring);
+      return 0;
+   }
+
+   ring->sq_tail = (unsigned*)((char*)ring->sq_ring + params.sq_off.tail);
+   ring->sq_mask = (unsigned*)((char*)ring->sq_ring + params.sq_off.ring_mask);
+   ring->sq_array = (unsigned*)((char*)ring->sq_ring + params.sq_off.array);
+   ring->cq_head = (unsigned*)((char*)ring->cq_ring + params.cq_off.head);
+   ring->cq_tail = (unsigned*)((char*)ring->cq_ring + params.cq_off.tail);
+   ring->cq_mask = (unsigned*)((char*)ring->cq_ring + params.cq_off.ring_mask);
+   ring->cqes = (struct io_uring_cqe*)((char*)ring->cq_ring + params.cq_off.cqes);
+   ring->tail = *ring->sq_tail;
+
+   return 1;
+#else
+   (void)ring;
+   (void)entries;
+   return 0;
+#endif
+}
+
+/** @brief Unmap and close a ring set up by *uring_init()*. */
+void uring_release(Uring *ring)
+{
+   if (ring->sqes && ring->sqes != (struct io_uring_sqe*)MAP_FAILED)
+      munmap(ring->sqes, ring->sqes_size);
+   if (ring->cq_size && ring->cq_ring && ring->cq_ring != MAP_FAILED)
+      munmap(ring->cq_ring, ring->cq_size);
+   if (ring->sq_ring && ring->sq_ring != MAP_FAILED)
+      munmap(ring->sq_ring, ring->sq_size);
+
+   if (ring->fd >= 0)
+      close(ring->fd);
+   ring->fd = -1;
+}
+
+/**
+ * @brief Queue a cleared submission, to be filled in by the caller
+ *        and submitted by *uring_enter()*.
+ */
+struct io_uring_sqe *uring_sqe(Uring *ring, int opcode, int fd, uint64_t user_data)
+{
+   unsigned index = ring->tail++ & *ring->sq_mask;
+   struct io_uring_sqe *sqe = &ring->sqes[index];
+
+   memset(sqe, 0, sizeof(struct io_uring_sqe));
+   sqe->opcode = opcode;
+   sqe->fd = fd;
+   sqe->user_data = user_data;
+   ring->sq_array[index] = index;
+
+   return sqe;
+}
+
+/**
+ * @brief Submit *submit* queued entries and wait until *wait*
+ *        completions are ready.
+ *
+ * @return TRUE if successful, FALSE if the ring failed.
+ */
+int uring_enter(Uring *ring, unsigned submit, unsigned wait)
+{
+#ifdef __NR_io_uring_enter
+   long submitted;
+
+   __atomic_store_n(ring->sq_tail, ring->tail, __ATOMIC_RELEASE);
+
+   do
+   {
+      submitted = syscall(__NR_io_uring_enter, ring->fd, submit, wait,
+                          IORING_ENTER_GETEVENTS, NULL, 0);
+      if (submitted > 0)
+      {
+         submit -= submitted;
+         ring->pending += submitted;
+      }
+   }
+   while (submitted < 0 ? errno == EINTR : submit > 0);
+
+   return submitted >= 0;
+#else
+   (void)ring;
+   (void)submit;
+   (void)wait;
+   return 0;
+#endif
+}
+
+/**
+ * @brief Take the next completion, if any.
+ *
+ * @return TRUE with *user_data* and *res* set, or FALSE if none is ready.
+ */
+int uring_reap(Uring *ring, uint64_t *user_data, int *res)
+{
+   unsigned head = *ring->cq_head;
+   const struct io_uring_cqe *cqe;
+
+   if (head == __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE))
+      return 0;
+
+   cqe = &ring->cqes[head & *ring->cq_mask];
+   *user_data = cqe->user_data;
+   *res = cqe->res;
+   __atomic_store_n(ring->cq_head, head + 1, __ATOMIC_RELEASE);
+   --ring->pending;
+
+   return 1;
+}
+
+/**
+ * @brief List the regular files of a directory, in order of name,
+ *        skipping hidden files.
+ *
+ * @return TRUE if successful, FALSE if out of memory.
+ */
+int dir_list(ri_Directory *dir, DIR *handle)
+{
+   struct dirent *entry;
+   struct stat st;
+   Dir_File *larger;
+   int capacity = 0, regular;
+
+   while ((entry = readdir(handle)))
+   {
+      if (entry->d_name[0] == '.')
+         continue;
+
+      // Only regular files are loaded; opening a FIFO would block:
+      regular = entry->d_type == DT_REG;
+      if (entry->d_type == DT_LNK || entry->d_type == DT_UNKNOWN)
+         regular = fstatat(dirfd(handle), entry->d_name, &st, 0) == 0 && S_ISREG(st.st_mode);
+
+      if (!regular)
+         continue;
+
+      if (dir->count == capacity)
+      {
+         capacity = capacity ? capacity * 2 : 64;
+         if (!(larger = (Dir_File*)realloc(dir->files, capacity * sizeof(Dir_File))))
+            return 0;
+         dir->files = larger;
+      }
+
+      memset(&dir->files[dir->count], 0, sizeof(Dir_File));
+      dir->files[dir->count].name = arena_strndup(&dir->arena, entry->d_name,
+                                                  strlen(entry->d_name));
+      dir->files[dir->count].fh = -1;
+      dir->files[dir->count].len = -1;
+
+      if (!dir->files[dir->count++].name)
+         return 0;
+   }
+
+   // The name is the first member of a Dir_File:
+   qsort(dir->files, dir->count, sizeof(Dir_File), compare_names);
+
+   return 1;
+}
+
+/**
+ * @brief Read the files of a directory through a ring, in batches:
+ *        each batch of files is opened by one system call, and read
+ *        and closed by another.
+ *
+ * Each file is read into a staging slot of RING_READ bytes, without
+ * asking its size, and copied to the arena at its exact length.  A
+ * file that fills its slot, or that the ring fails to read, keeps a
+ * NULL *text*, so that the worker parsing it reads it whole, and
+ * reports any failure.
+ *
+ * After the ring fails, the completions of the entries it did take
+ * are still waited for, so that no read lands in a freed stage and
+ * no file is closed twice.
+ */
+void dir_read_ring(ri_Directory *dir, int dirfd, Uring *ring)
+{
+   char *stage;
+   Dir_File *file;
+   uint64_t user_data;
+   struct io_uring_sqe *sqe;
+   int first, last, index, res, queued, ok = 1;
+
+   if (!(stage = (char*)malloc(RING_FILES * RING_READ)))
+      return;
+
+   for (first = 0; first < dir->count && ok; first += RING_FILES)
+   {
+      last = first + RING_FILES < dir->count ? first + RING_FILES : dir->count;
+
+      for (index = first; index < last; ++index)
+      {
+         sqe = uring_sqe(ring, IORING_OP_OPENAT, dirfd, index);
+         sqe->addr = (uint64_t)(uintptr_t)dir->files[index].name;
+         sqe->open_flags = O_RDONLY;
+      }
+
+      ok = uring_enter(ring, last - first, last - first);
+
+      do
+         while (uring_reap(ring, &user_data, &res))
+            dir->files[user_data].fh = res >= 0 ? res : -1;
+      while (!ok && ring->pending && uring_enter(ring, 0, ring->pending));
+
+      // The hard link closes the file even after a failed or short read:
+      queued = 0;
+      for (index = first; index < last && ok; ++index)
+      {
+         file = &dir->files[index];
+         if (file->fh == -1)
+            continue;
+
+         sqe = uring_sqe(ring, IORING_OP_READ, file->fh, (uint64_t)index * 2);
+         sqe->addr = (uint64_t)(uintptr_t)&stage[(index - first) * RING_READ];
+         sqe->len = RING_READ;
+         sqe->flags = IOSQE_IO_HARDLINK;
+
+         uring_sqe(ring, IORING_OP_CLOSE, file->fh, (uint64_t)index * 2 + 1);
+         queued += 2;
+      }
+
+      ok = ok && uring_enter(ring, queued, queued);
+
+      do
+         while (uring_reap(ring, &user_data, &res))
+         {
+            file = &dir->files[user_data / 2];
+            if (user_data & 1)
+               file->fh = -1;
+            else if (res >= 0 && res < RING_READ)
+            {
+               RI_STAT_ADD(read_calls, 1);
+               RI_STAT_ADD(bytes_read, res);
+
+               // A failed copy leaves the file to be read again:
+               file->text = arena_strndup(&dir->arena,
+                                          &stage[(user_data / 2 - first) * RING_READ], res);
+               file->len = res;
+            }
+         }
+      while (!ok && ring->pending && uring_enter(ring, 0, ring->pending));
+
+      // Files still in flight belong to the ring, which can't be waited for:
+      if (ring->pending)
+         break;
+
+      // Files opened by a batch the ring failed to read are closed here:
+      for (index = first; index < last; ++index)
+         if (dir->files[index].fh != -1)
+         {
+            close(dir->files[index].fh);
+            dir->files[index].fh = -1;
+         }
+   }
+
+   // A stage the ring may still read into is left allocated:
+   if (!ring->pending)
+      free(stage);
+}
+
+/**
+ * @brief Read a file of a directory with plain system calls.
+ *
+ * @return TRUE if successful, FALSE if the file couldn't be read.
+ */
+int dir_read_file(Dir_File *file, int dirfd, Arena *arena)
+{
+   struct stat st;
+   int fh = openat(dirfd, file->name, O_RDONLY);
+
+   if (fh == -1)
+      return 0;
+
+   file->len = -1;
+   if (fstat(fh, &st) == 0 && (file->text = (char*)ri_arena_alloc(arena, st.st_size + 1)))
+      file->len = read_text(fh, file->text, st.st_size);
+
+   close(fh);
+
+   return file->len != -1;
+}
+
+/**
+ * @brief Worker: parse files until none are left, reading those the
+ *        ring didn't, into the arena of the worker.
+ */
+void *dir_parse(void *arg)
+{
+   Dir_Worker *worker = (Dir_Worker*)arg;
+   Dir_Work *work = worker->work;
+   Dir_File *file;
+   ri_Document *doc;
+   int index;
+
+   while ((index = __atomic_fetch_add(&work->next, 1, __ATOMIC_RELAXED)) < work->dir->count
+          && !__atomic_load_n(&work->failed, __ATOMIC_RELAXED))
+   {
+      file = &work->dir->files[index];
+
+      if (!file->text && !dir_read_file(file, work->dirfd, &worker->arena))
+      {
+         fprintf(stderr, "Failed to read \"%s/%s\".\n", work->dirpath, file->name);
+         __atomic_store_n(&work->failed, 1, __ATOMIC_RELAXED);
+         break;
+      }
+
+      if (!(doc = (ri_Document*)ri_arena_alloc(&worker->arena, sizeof(ri_Document))))
+      {
+         __atomic_store_n(&work->failed, 1, __ATOMIC_RELAXED);
+         break;
+      }
+
+      memset(doc, 0, sizeof(ri_Document));
+      doc->text = file->text;
+      doc->len = file->len;
+      doc->flags = work->flags & RI_INDEX;
+      if (!parse_text(file->text, file->len, &worker->arena, &doc->sections))
+      {
+         fprintf(stderr, "Failed to parse \"%s/%s\".\n", work->dirpath, file->name);
+         __atomic_store_n(&work->failed, 1, __ATOMIC_RELAXED);
+         break;
+      }
+
+      if ((doc->flags & RI_INDEX) && !ri_build_index(doc->sections, &worker->arena))
+         clear_index(doc->sections);
+
+      file->doc = doc;
+   }
+
+   return NULL;
+}
+
+/**
+ * @brief Load every file of a directory as a separate document.
+ *
+ * Loading many small files one by one pays several system calls and
+ * a few allocations for each.  Here, where the kernel supports
+ * io_uring, the files are opened in batches with one system call
+ * per batch, then read and closed with another; a pool of *threads*
+ * workers, including the calling thread, then parses them, each into
+ * its own arena.  Otherwise the workers read the files as well as
+ * parse them.
+ *
+ * The files are the regular files of the directory, except hidden
+ * ones, in order of name.  The documents are as *ri_load()* would
+ * load them, and belong to the directory: they remain valid until
+ * *ri_dir_free()* is called, and must not be passed to *ri_free()*.
+ *
+ * @param dirpath Path to the directory.
+ * @param flags   RI_INDEX, or 0.
+ * @param threads Number of threads, or 0 for one per CPU.
+ *
+ * @return Pointer to the loaded directory, or NULL if it or any of
+ *         its files couldn't be read.
+ *
+ * @code
+ * ri_Directory *tenants = ri_load_dir("/etc/app/conf.d", RI_INDEX, 0);
+ * if (tenants)
+ * {
+ *    const ri_Document *doc = ri_dir_find(tenants, "acme.ini");
+ *    // ...
+ *    ri_dir_free(tenants);
+ * }
+ * @endcode
+ */
+ri_Directory* ri_load_dir(const char *dirpath, int flags, int threads)
+{
+   Arena arena;
+   ri_Directory *dir;
+   Dir_Work work;
+   Dir_Worker *workers;
+   Uring ring;
+   DIR *handle;
+   int index, started = 0;
+
+   if (!(handle = opendir(dirpath)))
+   {
+      fprintf(stderr, "Failed to open directory \"%s\".\n", dirpath);
+      return NULL;
+   }
+
+   ri_arena_init(&arena, 0);
+   if (!(dir = (ri_Directory*)ri_arena_alloc(&arena, sizeof(ri_Directory))))
+   {
+      closedir(handle);
+      ri_arena_release(&arena);
+      return NULL;
+   }
+
+   memset(dir, 0, sizeof(ri_Directory));
+   dir->arena = arena;
+
+   memset(&work, 0, sizeof(Dir_Work));
+   work.dir = dir;
+   work.dirpath = dirpath;
+   work.dirfd = dirfd(handle);
+   work.flags = flags;
+
+   if (!dir_list(dir, handle))
+   {
+      fprintf(stderr, "Failed to allocate directory memory.\n");
+      work.failed = 1;
+   }
+
+   RI_TRACE(RI_PHASE_READ, 0);
+   if (!work.failed && dir->count && uring_init(&ring, 2 * RING_FILES))
+   {
+      dir_read_ring(dir, work.dirfd, &ring);
+      uring_release(&ring);
+   }
+   RI_TRACE(RI_PHASE_READ, 1);
+
+   if (threads <= 0)
+      threads = (int)sysconf(_SC_NPROCESSORS_ONLN);
+   if (threads > dir->count)
+      threads = dir->count;
+   if (threads < 1)
+      threads = 1;
+
+   workers = (Dir_Worker*)malloc(threads * sizeof(Dir_Worker));
+   if (!workers)
+      work.failed = 1;
+
+   RI_TRACE(RI_PHASE_PARSE, 0);
+   if (!work.failed)
+   {
+      for (index = 0; index < threads; ++index)
+      {
+         workers[index].work = &work;
+         ri_arena_init(&workers[index].arena, RI_BLOCK_SIZE);
+      }
+
+      // If workers can't be started, the calling thread parses the rest:
+      for (started = 1; started < threads; ++started)
+         if (pthread_create(&workers[started].thread, NULL, dir_parse, &workers[started]))
+            break;
+
+      dir_parse(&workers[0]);
+
+      for (index = 1; index < started; ++index)
+         pthread_join(workers[index].thread, NULL);
+
+      for (index = 0; index < threads; ++index)
+         ri_arena_adopt(&dir->arena, &workers[index].arena);
+   }
+   RI_TRACE(RI_PHASE_PARSE, 1);
+
+   free(workers);
+   closedir(handle);
+
+   if (!work.failed && !name_table_init(&dir->names, dir->count, &dir->arena))
+      work.failed = 1;
+
+   for (index = 0; index < dir->count && !work.failed; ++index)
+      name_table_add(&dir->names, dir->files[index].name, &dir->files[index]);
+
+   if (work.failed)
+   {
+      ri_dir_free(dir);
+      return NULL;
+   }
+
+   return dir;
+}
+
+/** @brief Free a directory and all of its documents. */
+void ri_dir_free(ri_Directory *dir)
+{
+   Arena arena;
+
+   if (dir)
+   {
+      free(dir->files);
+
+      // Copy the arena out of the memory it is about to free:
+      arena = dir->arena;
+      ri_arena_release(&arena);
+   }
+}
+
+/** @brief Returns the number of files loaded from a directory. */
+int ri_dir_count(const ri_Directory *dir)
+{
+   return dir->count;
+}
+
+/** @brief Returns the name of a file of a directory, by position. */
+const char* ri_dir_name(const ri_Directory *dir, int index)
+{
+   return dir->files[index].name;
+}
+
+/** @brief Returns the document of a file of a directory, by position. */
+const ri_Document* ri_dir_document(const ri_Directory *dir, int index)
+{
+   return dir->files[index].doc;
+}
+
+/**
+ * @brief Find the document of a file of a directory by its name.
+ *
+ * @return The document, or NULL if the directory has no such file.
+ */
+const ri_Document* ri_dir_find(const ri_Directory *dir, const char *filename)
+{
+   const Dir_File *file = (const Dir_File*)name_table_probe(&dir->names, filename,
+                                                            ri_hash(filename))->node;
+   return file ? file->doc : NULL;
+}
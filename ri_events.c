@@ -0,0 +1,424 @@
+#include <stdio.h>
+#include <stdlib.h>  // for malloc(), free()
+#include <string.h>  // for memchr()
+#include <unistd.h>  // for read(), close()
+#include <fcntl.h>   // for open()
+#include <errno.h>
+#include <sys/types.h>
+
+#include "readini.h"
+#include "readini_private.h"
+
+/**
+ * @brief Find the comment that ends a line, skipping escaped '#'.
+ *
+ * @return Pointer to the '#' introducing the comment, or *end* if
+ *         the line has no comment.
+ *
+ * Follows the rule of *cook_line()*: a '#' is escaped if it follows
+ * a backslash that isn't itself part of an escaped '#'.
+ */
+const char *find_comment(const char *line, const char *end)
+{
+   char previous = '\0';
+
+   for (; line < end; ++line)
+   {
+      if (*line == '#')
+      {
+         if (previous != '\\')
+            return line;
+         previous = '#';
+      }
+      else
+         previous = *line;
+   }
+
+   return end;
+}
+
+/**
+ * @brief Report the contents of one line to the event callbacks.
+ *
+ * @param state State carried from line to line.
+ * @param line  First character of the line, which may be modified
+ *              to compact escaped '#' characters.
+ * @param end   Pointer following the last character, excluding
+ *              the newline.
+ *
+ * @return FALSE if a callback asked to stop, otherwise TRUE.
+ *
+ * Lines are interpreted as by *parse_text()*: lines preceding the
+ * first section head, or following a head without a closing ']',
+ * belong to no section and are ignored.
+ */
+int emit_line_events(Event_State *state, char *line, char *end)
+{
+   const ri_Events *events = state->events;
+   struct ri_line_info li;
+   const char *close;
+   char *eol;
+
+   // Ignore leading spaces:
+   while (line < end && is_space(line))
+      ++line;
+
+   eol = (char*)ri_scan.line_end(line, end);
+
+   // An escaped '#' doesn't begin a comment, and must be compacted:
+   if (eol < end && eol > line && *(eol-1) == '\\')
+   {
+      eol = (char*)find_comment(line, end);
+      if (events->on_comment && eol < end
+          && !(*events->on_comment)(eol + 1, end - eol - 1, state->data))
+         return 0;
+
+      line = cook_line(line, &eol);
+   }
+   else if (events->on_comment && eol < end
+            && !(*events->on_comment)(eol + 1, end - eol - 1, state->data))
+      return 0;
+
+   RI_STATS_ONLY(state->comment_lines += eol == line && eol < end);
+
+   if (line < eol && line_is_section_type(line))
+   {
+      close = (const char*)memchr(line, ']', eol - line);
+      state->section_open = close != NULL;
+      RI_STATS_ONLY(state->sections += close != NULL);
+
+      if (close)
+         return !events->on_section
+            || (*events->on_section)(line + 1, close - line - 1, state->data);
+      else
+         return !events->on_error
+            || (*events->on_error)("Section head without ']'.", state->line_number, state->data);
+   }
+   else if (state->section_open && ri_parse_line_slice(line, eol, &li))
+   {
+      RI_STATS_ONLY(++state->keys);
+      return !events->on_key_value
+         || (*events->on_key_value)(li.tag, li.len_tag, li.value, li.len_value, state->data);
+   }
+
+   return 1;
+}
+
+/**
+ * Contents of the opaque **ri_Parser**.  A line split between fed
+ * chunks is collected in *carry*, which also holds copies of lines
+ * that must be cooked, since fed buffers can't be modified.  The
+ * carry buffer grows to hold the longest such line.
+ */
+struct ri_parser
+{
+   Event_State state;
+   char *carry;
+   size_t carry_size;
+   size_t carry_len;
+   size_t line_limit;    // longest line before truncation, 0 for none
+   int carry_overflow;   // the carried line is too long, and truncated
+   int stopped;          // a callback asked to stop
+};
+
+/**
+ * @brief Make room for *size* characters in the carry buffer.
+ *
+ * @return TRUE if successful, FALSE if out of memory.
+ */
+int parser_reserve(ri_Parser *parser, size_t size)
+{
+   size_t new_size = parser->carry_size;
+   char *larger;
+
+   if (size <= parser->carry_size)
+      return 1;
+
+   while (new_size < size)
+      new_size *= 2;
+
+   if (!(larger = (char*)realloc(parser->carry, new_size)))
+      return 0;
+
+   parser->carry = larger;
+   parser->carry_size = new_size;
+   return 1;
+}
+
+/**
+ * @brief Report one complete line.
+ *
+ * Lines longer than the parser's line limit are truncated, as by the
+ * block reader, so results don't depend on how the input was divided.
+ *
+ * @return FALSE if a callback asked to stop, otherwise TRUE.
+ */
+int parser_line(ri_Parser *parser, const char *line, size_t len, int truncated)
+{
+   const ri_Events *events = parser->state.events;
+
+   ++parser->state.line_number;
+
+   if (parser->line_limit && len > parser->line_limit)
+   {
+      len = parser->line_limit;
+      truncated = 1;
+   }
+
+   if (truncated)
+      RI_STAT_ADD(truncated_lines, 1);
+
+   if (truncated && events->on_error
+       && !(*events->on_error)("Line too long, truncated.",
+                               parser->state.line_number, parser->state.data))
+      return 0;
+
+   // Only a line with a backslash may be cooked, so only it is copied:
+   if (line != parser->carry && memchr(line, '\\', len))
+   {
+      if (!parser_reserve(parser, len))
+         return !events->on_error
+            || (*events->on_error)("Failed to allocate parse memory, line skipped.",
+                                   parser->state.line_number, parser->state.data);
+
+      memcpy(parser->carry, line, len);
+      line = parser->carry;
+   }
+
+   return emit_line_events(&parser->state, (char*)line, (char*)line + len);
+}
+
+/**
+ * @brief Add part of a line to the carry buffer, dropping what is
+ *        beyond the line limit or can't be allocated.
+ */
+void parser_carry(ri_Parser *parser, const char *text, size_t len)
+{
+   if (parser->line_limit && len > parser->line_limit - parser->carry_len)
+   {
+      len = parser->line_limit - parser->carry_len;
+      parser->carry_overflow = 1;
+   }
+
+   if (!parser_reserve(parser, parser->carry_len + len))
+   {
+      len = parser->carry_size - parser->carry_len;
+      parser->carry_overflow = 1;
+   }
+
+   memcpy(&parser->carry[parser->carry_len], text, len);
+   parser->carry_len += len;
+}
+
+/**
+ * @brief Add the counts of a parser to *ri_stats*, if built with
+ *        RI_STATS, and clear them.
+ */
+void parser_flush_stats(ri_Parser *parser)
+{
+   Event_State *state = &parser->state;
+
+   RI_STAT_ADD(lines, state->line_number);
+   RI_STAT_ADD(sections, state->sections);
+   RI_STAT_ADD(keys, state->keys);
+   RI_STAT_ADD(comment_lines, state->comment_lines);
+   RI_STATS_ONLY(state->sections = state->keys = state->comment_lines = 0);
+
+   state->line_number = 0;
+}
+
+/**
+ * @brief Create a parser to which text is fed in pieces.
+ *
+ * The parser reports the contents of the text to the callbacks, as
+ * *ri_parse_events()* does for a file, as soon as each line is
+ * complete.  Use it for text from pipes, sockets or any source that
+ * can't be read as a file.  Lines are truncated only if a limit was
+ * set by *ri_set_line_limit()* in the calling thread.
+ *
+ * @param events Callbacks for sections, tags, comments and errors.
+ * @param data   Castable void pointer to custom application data.
+ *
+ * @return Pointer to the new parser, or NULL if out of memory.
+ */
+ri_Parser* ri_parser_create(const ri_Events *events, void *data)
+{
+   ri_Parser *parser = (ri_Parser*)malloc(sizeof(ri_Parser));
+
+   if (parser)
+   {
+      memset(parser, 0, sizeof(ri_Parser));
+      parser->state.events = events;
+      parser->state.data = data;
+      parser->line_limit = line_limit;
+
+      parser->carry_size = RI_BLOCK_SIZE;
+      parser->carry = (char*)malloc(RI_BLOCK_SIZE);
+      if (!parser->carry)
+      {
+         free(parser);
+         parser = NULL;
+      }
+   }
+
+   if (!parser)
+      fprintf(stderr, "Failed to allocate parse memory.");
+
+   return parser;
+}
+
+/**
+ * @brief Parse the next piece of text.
+ *
+ * The text may be divided anywhere, even within a line: the start
+ * of an incomplete line is kept until the rest is fed.  The buffer
+ * is not modified, and may be reused when the function returns.
+ *
+ * @return FALSE if a callback has asked to stop, otherwise TRUE.
+ */
+int ri_parser_feed(ri_Parser *parser, const char *buffer, size_t len)
+{
+   const char *ptr = buffer, *end = buffer + len;
+   const char *newline;
+
+   while (!parser->stopped && ptr < end)
+   {
+      newline = (const char*)memchr(ptr, '\n', end - ptr);
+
+      if (newline && !parser->carry_len && !parser->carry_overflow)
+         parser->stopped = !parser_line(parser, ptr, newline - ptr, 0);
+      else
+      {
+         parser_carry(parser, ptr, (newline ? newline : end) - ptr);
+
+         if (newline)
+         {
+            parser->stopped = !parser_line(parser, parser->carry, parser->carry_len,
+                                           parser->carry_overflow);
+            parser->carry_len = parser->carry_overflow = 0;
+         }
+      }
+
+      ptr = newline ? newline + 1 : end;
+   }
+
+   return !parser->stopped;
+}
+
+/**
+ * @brief Parse a final line that has no newline.
+ *
+ * The parser is then ready to parse new text from the beginning.
+ *
+ * @return FALSE if a callback asked to stop, otherwise TRUE.
+ */
+int ri_parser_finish(ri_Parser *parser)
+{
+   int completed;
+
+   if (!parser->stopped && (parser->carry_len || parser->carry_overflow))
+      parser->stopped = !parser_line(parser, parser->carry, parser->carry_len,
+                                     parser->carry_overflow);
+
+   completed = !parser->stopped;
+
+   parser_flush_stats(parser);
+   parser->carry_len = parser->carry_overflow = parser->stopped = 0;
+   parser->state.section_open = 0;
+
+   return completed;
+}
+
+/** @brief Free a parser made by *ri_parser_create()*. */
+void ri_parser_destroy(ri_Parser *parser)
+{
+   if (parser)
+   {
+      parser_flush_stats(parser);
+      free(parser->carry);
+      free(parser);
+   }
+}
+
+/**
+ * @brief Read a file descriptor to its end, reporting its contents
+ *        to callbacks.
+ *
+ * The descriptor is read sequentially with *read()*, so it may be a
+ * pipe, a socket or a terminal as well as a file.
+ *
+ * @return TRUE if all the text was read, FALSE if it couldn't be read
+ *         or a callback stopped the reading.
+ */
+int ri_parse_events_fd(int fh, const ri_Events *events, void *data)
+{
+   ri_Parser *parser = ri_parser_create(events, data);
+   char *block = (char*)malloc(RI_BLOCK_SIZE);
+   ssize_t bytes_read = 0;
+   int completed = 0;
+
+   if (parser && block)
+   {
+      RI_TRACE(RI_PHASE_PARSE, 0);
+
+      do
+      {
+         bytes_read = read(fh, block, RI_BLOCK_SIZE);
+         RI_STAT_ADD(read_calls, 1);
+         if (bytes_read > 0)
+            RI_STAT_ADD(bytes_read, bytes_read);
+
+         if (bytes_read > 0 && !ri_parser_feed(parser, block, bytes_read))
+            break;
+      }
+      while (bytes_read > 0 || (bytes_read == -1 && errno == EINTR));
+
+      // Report the final line, unless reading failed or was stopped:
+      completed = bytes_read == 0 && ri_parser_finish(parser);
+
+      RI_TRACE(RI_PHASE_PARSE, 1);
+   }
+
+   free(block);
+   ri_parser_destroy(parser);
+
+   return completed;
+}
+
+/**
+ * @brief Read a file in one pass, reporting its contents to callbacks.
+ *
+ * Unlike *ri_read_file()*, nothing is kept in memory: each section
+ * head, tag and value, and comment is passed to a callback as a
+ * pointer and length in the read buffer as soon as it is read, so
+ * memory use depends only on the longest line, not on the size of
+ * the file.  The slices are
+ * not terminated, and are valid only until the callback returns.
+ *
+ * Any callback may be NULL.  A callback returns TRUE to continue,
+ * or FALSE to stop reading.
+ *
+ * @param filepath Path to the configuration file.
+ * @param events   Callbacks for sections, tags, comments and errors.
+ * @param data     Castable void pointer to custom application data.
+ *
+ * @return TRUE if the whole file was read, FALSE if it couldn't be
+ *         opened or a callback stopped the reading.
+ */
+int ri_parse_events(const char *filepath, const ri_Events *events, void *data)
+{
+   int completed;
+
+   int fh = open(filepath, O_RDONLY);
+   if (fh == -1)
+   {
+      fprintf(stderr, "Failed to open \"%s\".", filepath);
+      return 0;
+   }
+
+   completed = ri_parse_events_fd(fh, events, data);
+
+   close(fh);
+
+   return completed;
+}
@@ -0,0 +1,265 @@
+#include <stdio.h>
+#include <sys/types.h>
+#include <string.h>  // for strcmp(), etc;
+
+#include "readini.h"
+#include "readini_private.h"
+
+/**
+ * @brief FNV-1a hash of a string, used for all index tables.
+ */
+unsigned ri_hash(const char *str)
+{
+   unsigned hash = 2166136261u;
+   while (*str)
+   {
+      hash ^= (unsigned char)*str++;
+      hash *= 16777619u;
+   }
+
+   return hash;
+}
+
+/**
+ * @brief The same hash as *ri_hash()*, of a string of *len* characters.
+ */
+unsigned ri_hash_slice(const char *str, int len)
+{
+   return ri_hash_more(2166136261u, str, len);
+}
+
+/**
+ * @brief Continue a hash with *len* more characters, so a hash of
+ *        joined strings needn't join them.
+ */
+unsigned ri_hash_more(unsigned hash, const char *str, int len)
+{
+   const char *end = str + len;
+
+   while (str < end)
+   {
+      hash ^= (unsigned char)*str++;
+      hash *= 16777619u;
+   }
+
+   return hash;
+}
+
+/**
+ * @brief Allocate an empty table with room for twice *count* names.
+ *
+ * @return TRUE if successful, FALSE if out of memory.
+ */
+int name_table_init(Name_Table *table, unsigned count, Arena *arena)
+{
+   unsigned size = 4;
+   while (size < count * 2)
+      size *= 2;
+
+   table->slots = (Name_Slot*)ri_arena_alloc(arena, size * sizeof(Name_Slot));
+   if (!table->slots)
+      return 0;
+
+   memset(table->slots, 0, size * sizeof(Name_Slot));
+   table->mask = size - 1;
+   return 1;
+}
+
+/**
+ * @brief Find the slot of a name, or the empty slot where it belongs.
+ *        An interned name is matched by pointer, without a compare.
+ */
+Name_Slot *name_table_probe(const Name_Table *table, const char *name, unsigned hash)
+{
+   unsigned index = hash & table->mask;
+   Name_Slot *slot;
+
+   while (1)
+   {
+      slot = &table->slots[index];
+      if (!slot->node
+          || (slot->hash == hash && (slot->name == name || 0 == strcmp(slot->name, name))))
+         return slot;
+
+      index = (index + 1) & table->mask;
+   }
+}
+
+/**
+ * @brief Find the slot of a name of *len* characters, which needn't
+ *        be terminated, or the empty slot where it belongs.
+ */
+Name_Slot *name_table_probe_slice(const Name_Table *table, const char *name, int len,
+                                  unsigned hash)
+{
+   unsigned index = hash & table->mask;
+   Name_Slot *slot;
+
+   while (1)
+   {
+      slot = &table->slots[index];
+      if (!slot->node
+          || (slot->hash == hash
+              && 0 == strncmp(slot->name, name, len)
+              && slot->name[len] == '\0'))
+         return slot;
+
+      index = (index + 1) & table->mask;
+   }
+}
+
+/**
+ * @brief Add a name to a table unless already present.
+ *
+ * @return The node of the earlier entry of the name, if any, or NULL
+ *         if the new node was added.
+ */
+const void *name_table_add(Name_Table *table, const char *name, const void *node)
+{
+   unsigned hash = ri_hash(name);
+   Name_Slot *slot = name_table_probe(table, name, hash);
+
+   if (slot->node)
+      return slot->node;
+
+   slot->hash = hash;
+   slot->name = name;
+   slot->node = node;
+   return NULL;
+}
+
+/**
+ * @brief Build the table of the tags of a section.
+ *
+ * @return TRUE if successful, FALSE if out of memory.
+ */
+int index_tags(struct ri_index *index, const ri_Line *lines, Arena *arena)
+{
+   const ri_Line *line;
+   unsigned count = 0;
+
+   for (line = lines; line; line = line->next)
+      ++count;
+
+   if (!name_table_init(&index->tags, count, arena))
+      return 0;
+
+   for (line = lines; line; line = line->next)
+      name_table_add(&index->tags, line->tag, line);
+
+   return 1;
+}
+
+/**
+ * @brief Build lookup tables for a linked list of sections.
+ *
+ * Every section gets a table of its tags, and a pointer to a shared
+ * table of section names.  Only the first of repeated names is
+ * entered in either table, so lookups find the same line that a scan
+ * from the head of the list would find.  Sections that repeat a name
+ * are chained through *same_name*.  The sections of a document loaded
+ * with RI_LAZY have no lines yet, and get their tables when parsed.
+ *
+ * @return TRUE if successful, FALSE if out of memory.
+ */
+int ri_build_index(ri_Section *head, Arena *arena)
+{
+   Name_Table *sections;
+   ri_Section *section;
+   const ri_Section *first;
+   struct ri_index *index, *dup;
+   unsigned count = 0, ordinal = 0;
+
+   for (section = head; section; section = section->next)
+      ++count;
+
+   sections = (Name_Table*)ri_arena_alloc(arena, sizeof(Name_Table));
+   if (!sections || !name_table_init(sections, count, arena))
+      return 0;
+
+   for (section = head; section; section = section->next)
+   {
+      index = (struct ri_index*)ri_arena_alloc(arena, sizeof(struct ri_index));
+      if (!index)
+         return 0;
+
+      memset(index, 0, sizeof(struct ri_index));
+      index->sections = sections;
+      index->head = head;
+      index->ordinal = ordinal++;
+
+      if (!index_tags(index, section->lines, arena))
+         return 0;
+
+      SECTION_NODE(section)->index = index;
+
+      // Chain a repeated section name to the end of its predecessors:
+      first = (const ri_Section*)name_table_add(sections, section->section_name, section);
+      if (first)
+      {
+         dup = (struct ri_index*)SECTION_NODE(first)->index;
+         while (dup->same_name)
+            dup = (struct ri_index*)SECTION_NODE(dup->same_name)->index;
+         dup->same_name = section;
+      }
+   }
+
+   return 1;
+}
+
+/**
+ * @brief Indexed equivalent of a scan for a section starting at *root*.
+ */
+const ri_Section *ri_index_get_section(const ri_Section *root, const char *name)
+{
+   const struct ri_index *index = SECTION_NODE(root)->index;
+   const Name_Slot *slot = name_table_probe(index->sections, name, ri_hash(name));
+   const ri_Section *section = (const ri_Section*)slot->node;
+
+   // Skip same-named sections that precede *root*:
+   while (section && SECTION_NODE(section)->index->ordinal < index->ordinal)
+      section = SECTION_NODE(section)->index->same_name;
+
+   return section;
+}
+
+/**
+ * @brief Return the first line of an indexed section with a matching tag.
+ */
+const ri_Line *ri_index_find_line(const ri_Section *section, const char *tag, unsigned hash)
+{
+   return (const ri_Line*)name_table_probe(&SECTION_NODE(section)->index->tags, tag, hash)->node;
+}
+
+/**
+ * @brief Make room in a table for *count* names.
+ *
+ * If the table is too small, the names are rehashed into a new table
+ * twice as large.  The old slots are abandoned in the arena.
+ *
+ * @return TRUE if successful, FALSE if out of memory.
+ */
+int name_table_grow(Name_Table *table, unsigned count, Arena *arena)
+{
+   Name_Table larger;
+   unsigned index;
+
+   if (table->slots && count * 2 <= table->mask + 1)
+      return 1;
+
+   if (!name_table_init(&larger, count, arena))
+      return 0;
+
+   if (table->slots)
+   {
+      for (index = 0; index <= table->mask; ++index)
+      {
+         if (table->slots[index].node)
+            *name_table_probe(&larger, table->slots[index].name, table->slots[index].hash)
+               = table->slots[index];
+      }
+   }
+
+   *table = larger;
+   return 1;
+}
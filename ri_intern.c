@@ -0,0 +1,266 @@
+#include <stdio.h>
+#include <string.h>  // for memset(), strcmp()
+#include <pthread.h>
+#include <sys/types.h>
+
+#include "readini.h"
+#include "readini_private.h"
+
+/**
+ * @brief Return the interned copy of a name of *len* characters,
+ *        which needn't be terminated, adding a copy if it is new.
+ *
+ * Only one thread may add names to a set at a time.  A table that
+ * is full is replaced by a larger copy, and the old one is left in
+ * the arena, so that a thread finding names meanwhile never sees a
+ * table rehashed beneath it.
+ *
+ * @return The interned name, or NULL if out of memory.
+ */
+const char *name_set_add(Name_Set *set, const char *name, int len, Arena *arena)
+{
+   unsigned hash = ri_hash_slice(name, len);
+   Name_Table *larger;
+   Name_Slot *slot = NULL;
+   char *copy;
+
+   if (set->table)
+   {
+      slot = name_table_probe_slice(set->table, name, len, hash);
+      if (slot->node)
+         return slot->name;
+   }
+
+   if (!set->table || (set->count + 1) * 2 > set->table->mask + 1)
+   {
+      larger = (Name_Table*)ri_arena_alloc(arena, sizeof(Name_Table));
+      if (!larger)
+         return NULL;
+
+      if (set->table)
+         *larger = *set->table;
+      else
+         memset(larger, 0, sizeof(Name_Table));
+
+      if (!name_table_grow(larger, set->count + 1, arena))
+         return NULL;
+
+      __atomic_store_n(&set->table, larger, __ATOMIC_RELEASE);
+      slot = name_table_probe_slice(larger, name, len, hash);
+   }
+
+   if (!(copy = arena_strndup(arena, name, len)))
+      return NULL;
+
+   // The slot is complete before a thread finding names can see it:
+   slot->hash = hash;
+   slot->name = copy;
+   __atomic_store_n(&slot->node, copy, __ATOMIC_RELEASE);
+   ++set->count;
+
+   return copy;
+}
+
+/**
+ * @brief Find the interned copy of a name, whose hash is *hash*,
+ *        while another thread may be adding names.
+ *
+ * @return The interned name, or NULL if the name isn't in the set.
+ */
+const char *name_set_find(const Name_Set *set, const char *name, unsigned hash)
+{
+   const Name_Table *table = __atomic_load_n(&set->table, __ATOMIC_ACQUIRE);
+   const Name_Slot *slot;
+   const char *found;
+   unsigned index;
+
+   if (!table)
+      return NULL;
+
+   index = hash & table->mask;
+   while (1)
+   {
+      slot = &table->slots[index];
+      found = (const char*)__atomic_load_n(&slot->node, __ATOMIC_ACQUIRE);
+      if (!found || (slot->hash == hash && 0 == strcmp(found, name)))
+         return found;
+
+      index = (index + 1) & table->mask;
+   }
+}
+
+/**
+ * @brief Make an empty interner, with one reference.
+ *
+ * @return Pointer to the interner, or NULL if out of memory.
+ */
+Interner *interner_create(void)
+{
+   Arena arena;
+   Interner *interner;
+
+   ri_arena_init(&arena, RI_BLOCK_SIZE);
+
+   interner = (Interner*)ri_arena_alloc(&arena, sizeof(Interner));
+   if (!interner)
+   {
+      ri_arena_release(&arena);
+      return NULL;
+   }
+
+   memset(interner, 0, sizeof(Interner));
+   interner->refs = 1;
+   pthread_mutex_init(&interner->lock, NULL);
+
+   // The interner owns the arena that contains it:
+   interner->arena = arena;
+
+   return interner;
+}
+
+/** @brief Add a reference to an interner, and return it. */
+Interner *interner_retain(Interner *interner)
+{
+   __atomic_add_fetch(&interner->refs, 1, __ATOMIC_RELAXED);
+   return interner;
+}
+
+/** @brief Drop a reference to an interner, freeing it with the last. */
+void interner_release(Interner *interner)
+{
+   Arena arena;
+
+   if (interner && 0 == __atomic_sub_fetch(&interner->refs, 1, __ATOMIC_ACQ_REL))
+   {
+      pthread_mutex_destroy(&interner->lock);
+
+      // Copy the arena out of the memory it is about to free:
+      arena = interner->arena;
+      ri_arena_release(&arena);
+   }
+}
+
+/**
+ * @brief Replace the section names and tags of a list of sections
+ *        by their interned copies.
+ *
+ * @return TRUE if successful, FALSE if out of memory, in which case
+ *         some names may not have been replaced.
+ */
+int intern_sections(Interner *interner, ri_Section *head)
+{
+   ri_Line *line;
+   const char *name;
+   int failed = 0;
+
+   pthread_mutex_lock(&interner->lock);
+
+   for (; head && !failed; head = head->next)
+   {
+      name = name_set_add(&interner->names, head->section_name,
+                          strlen(head->section_name), &interner->arena);
+      if (name)
+         head->section_name = name;
+      else
+         failed = 1;
+
+      for (line = (ri_Line*)head->lines; line && !failed; line = line->next)
+      {
+         name = name_set_add(&interner->names, line->tag, strlen(line->tag),
+                             &interner->arena);
+         if (name)
+            line->tag = name;
+         else
+            failed = 1;
+      }
+   }
+
+   pthread_mutex_unlock(&interner->lock);
+
+   return !failed;
+}
+
+/**
+ * @brief Find a line of a document loaded with RI_INTERN, as by
+ *        *ri_find_section_line()*.
+ *
+ * Each name is hashed once, to find its interned copy, and is then
+ * matched by pointer.  A name that was never interned is in no
+ * section.  With RI_INDEX, the same hashes probe the index tables.
+ *
+ * @return Pointer to the line, or NULL if not found.
+ */
+const ri_Line *interned_line(const ri_Document *doc, const char *section_name,
+                             const char *tag_name)
+{
+   const Name_Set *names = &doc->interner->names;
+   const ri_Section *sptr = ri_document_sections(doc);
+   const ri_Line *lptr = NULL;
+   const char *section, *tag = NULL;
+   unsigned section_hash = ri_hash(section_name), tag_hash = ri_hash(tag_name);
+   RI_STATS_ONLY(uint64_t probes = 0;)
+
+   section = name_set_find(names, section_name, section_hash);
+   if (!section)
+      sptr = NULL;
+   else if (sptr && SECTION_NODE(sptr)->index)
+      sptr = (const ri_Section*)name_table_probe(SECTION_NODE(sptr)->index->sections, section,
+                                                 section_hash)->node;
+
+   while (sptr && !lptr)
+   {
+      RI_STATS_ONLY(++probes);
+      if (sptr->section_name == section)
+      {
+         sptr = section_parsed(sptr);
+
+         // The tags of a lazy section are interned as it is parsed:
+         if (!tag)
+            tag = name_set_find(names, tag_name, tag_hash);
+
+         if (!tag)
+            ;
+         else if (SECTION_NODE(sptr)->index)
+            lptr = ri_index_find_line(sptr, tag, tag_hash);
+         else
+         {
+            lptr = sptr->lines;
+            while (lptr && lptr->tag != tag)
+            {
+               RI_STATS_ONLY(++probes);
+               lptr = lptr->next;
+            }
+         }
+      }
+
+      sptr = SECTION_NODE(sptr)->index ? SECTION_NODE(sptr)->index->same_name : sptr->next;
+   }
+
+   RI_STAT_ADD(lookups, 1);
+   RI_STAT_ADD(lookup_probes, probes);
+
+   return lptr;
+}
+
+/**
+ * @brief Return the interned copy of a section name or tag of a
+ *        document loaded with RI_INTERN.
+ *
+ * The names of all the documents loaded by one watcher are interned
+ * together, so a name has the same copy in every reload, and names
+ * returned here can be compared by pointer with the *section_name*
+ * and *tag* members of the sections and lines of those documents.
+ *
+ * @return The interned copy, or NULL if no section or line of the
+ *         document, or of an earlier load by the same watcher, has
+ *         the name, or the document wasn't loaded with RI_INTERN.
+ *         With RI_LAZY, the tags of a section are interned when it
+ *         is parsed.
+ */
+const char* ri_interned(const ri_Document *doc, const char *name)
+{
+   if (!(doc->flags & RI_INTERN))
+      return NULL;
+
+   return name_set_find(&doc->interner->names, name, ri_hash(name));
+}
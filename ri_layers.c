@@ -0,0 +1,621 @@
+#include <stdio.h>
+#include <stdlib.h>  // for malloc(), realloc(), free(), realpath(), qsort()
+#include <string.h>  // for memset(), memcpy(), strcpy(), strrchr()
+#include <unistd.h>  // for close(), sysconf()
+#include <fcntl.h>   // for open()
+#include <dirent.h>  // for opendir(), readdir()
+#include <limits.h>  // for PATH_MAX, UINT_MAX
+#include <pthread.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#include "readini.h"
+#include "readini_private.h"
+
+/**
+ * @brief Make the path of an include, relative to the directory of
+ *        the file that names it unless it is absolute.
+ *
+ * @return Terminated path in the scratch arena, or NULL if out of memory.
+ */
+char *include_path(Layers *layers, const char *from, const char *path, int len)
+{
+   const char *slash = strrchr(from, '/');
+   int len_dir = *path == '/' || !slash ? 0 : slash - from + 1;
+   char *joined = (char*)ri_arena_alloc(&layers->scratch, len_dir + len + 1);
+
+   if (joined)
+   {
+      memcpy(joined, from, len_dir);
+      memcpy(joined + len_dir, path, len);
+      joined[len_dir + len] = '\0';
+   }
+
+   return joined;
+}
+
+/** @brief *qsort()* comparison of file names. */
+int compare_names(const void *left, const void *right)
+{
+   return strcmp(*(const char**)left, *(const char**)right);
+}
+
+/**
+ * @brief Read the include directives of a file.
+ *
+ * Directives are lines preceding the first section head, which are
+ * otherwise ignored: "include" names a file, and "include-dir" a
+ * directory whose files are all included, in order of name.
+ *
+ *    include = base.ini
+ *    include-dir = conf.d
+ *
+ * Included files become layers beneath the file that names them.
+ */
+void layers_include(Layers *layers, const char *from, const char *text, size_t len)
+{
+   struct ri_line_info li;
+   const char *ptr = text, *end = text + len;
+   const char *line, *eol;
+   char *path;
+
+   while (ptr < end && !layers->failed)
+   {
+      line = ptr;
+      while (line < end && is_space(line))
+         ++line;
+
+      if (line < end && line_is_section_type(line))
+         break;
+
+      eol = ri_scan.line_end(line, end);
+      ptr = (const char*)memchr(eol, '\n', end - eol);
+      ptr = ptr ? ptr + 1 : end;
+
+      if (!ri_parse_line_slice(line, eol, &li) || !li.len_value)
+         continue;
+
+      if (li.len_tag == 7 && 0 == strncmp(li.tag, "include", 7))
+      {
+         if (!(path = include_path(layers, from, li.value, li.len_value)))
+            layers->failed = 1;
+         else
+            layers_add_file(layers, path);
+      }
+      else if (li.len_tag == 11 && 0 == strncmp(li.tag, "include-dir", 11))
+      {
+         if (!(path = include_path(layers, from, li.value, li.len_value)))
+            layers->failed = 1;
+         else
+            layers_add_dir(layers, path);
+      }
+   }
+}
+
+/**
+ * @brief Add the regular files of a directory, in order of name,
+ *        skipping hidden files.
+ *
+ * @return TRUE if successful, FALSE if the directory or one of its
+ *         files couldn't be read.
+ */
+int layers_add_dir(Layers *layers, const char *path)
+{
+   struct dirent *entry;
+   struct stat st;
+   char **names = NULL, **larger;
+   char *prefix;
+   int count = 0, capacity = 0, index;
+   int len_path = strlen(path);
+   DIR *dir;
+
+   if (!(dir = opendir(path)))
+   {
+      fprintf(stderr, "Failed to open directory \"%s\".", path);
+      layers->failed = 1;
+      return 0;
+   }
+
+   // Names are joined to the directory as if included from a file in it:
+   if ((prefix = (char*)ri_arena_alloc(&layers->scratch, len_path + 2)))
+   {
+      memcpy(prefix, path, len_path);
+      strcpy(prefix + len_path, "/");
+   }
+   else
+      layers->failed = 1;
+
+   while (!layers->failed && (entry = readdir(dir)))
+   {
+      if (entry->d_name[0] == '.')
+         continue;
+
+      if (count == capacity)
+      {
+         capacity = capacity ? capacity * 2 : 16;
+         if (!(larger = (char**)realloc(names, capacity * sizeof(char*))))
+         {
+            layers->failed = 1;
+            break;
+         }
+         names = larger;
+      }
+
+      if (!(names[count++] = include_path(layers, prefix, entry->d_name,
+                                          strlen(entry->d_name))))
+         layers->failed = 1;
+   }
+
+   closedir(dir);
+
+   if (layers->failed)
+      fprintf(stderr, "Failed to allocate layer memory.");
+   else
+   {
+      qsort(names, count, sizeof(char*), compare_names);
+
+      for (index = 0; index < count && !layers->failed; ++index)
+         if (stat(names[index], &st) == 0 && S_ISREG(st.st_mode))
+            layers_add_file(layers, names[index]);
+   }
+
+   free(names);
+
+   return !layers->failed;
+}
+
+/**
+ * @brief Read a file and the files it includes as layers.
+ *
+ * The includes of a file are added before the file, so it overrides
+ * them.  A file is read only once, at the first place it is named,
+ * which also ends include cycles.
+ *
+ * @return TRUE if successful, FALSE if a file couldn't be read.
+ */
+int layers_add_file(Layers *layers, const char *path)
+{
+   char real[PATH_MAX];
+   struct stat st;
+   Parse_Chunk *larger;
+   Name_Slot *slot;
+   char *name, *text = NULL;
+   ssize_t len = -1;
+   unsigned hash;
+   int fh;
+
+   if (!realpath(path, real))
+   {
+      fprintf(stderr, "Failed to open \"%s\".", path);
+      layers->failed = 1;
+      return 0;
+   }
+
+   if (!name_table_grow(&layers->files, layers->file_count + 1, &layers->scratch))
+   {
+      fprintf(stderr, "Failed to allocate layer memory.");
+      layers->failed = 1;
+      return 0;
+   }
+
+   hash = ri_hash(real);
+   slot = name_table_probe(&layers->files, real, hash);
+   if (slot->node)
+      return 1;
+
+   // Record the file before reading its includes, which may name it:
+   if (!(name = arena_strndup(&layers->scratch, real, strlen(real))))
+   {
+      fprintf(stderr, "Failed to allocate layer memory.");
+      layers->failed = 1;
+      return 0;
+   }
+
+   slot->hash = hash;
+   slot->name = name;
+   slot->node = name;
+   ++layers->file_count;
+
+   fh = open(name, O_RDONLY);
+   if (fh != -1)
+   {
+      if (fstat(fh, &st) == 0
+          && (text = (char*)ri_arena_alloc(&layers->scratch, st.st_size + 1)))
+         len = read_text(fh, text, st.st_size);
+
+      close(fh);
+   }
+
+   if (len == -1)
+   {
+      fprintf(stderr, "Failed to read \"%s\".", name);
+      layers->failed = 1;
+      return 0;
+   }
+
+   if (layers->depth == RI_INCLUDE_DEPTH)
+   {
+      fprintf(stderr, "Includes nested too deeply in \"%s\".", name);
+      layers->failed = 1;
+      return 0;
+   }
+
+   ++layers->depth;
+   layers_include(layers, name, text, len);
+   --layers->depth;
+
+   if (layers->failed)
+      return 0;
+
+   if (layers->count == layers->capacity)
+   {
+      larger = (Parse_Chunk*)realloc(layers->chunks,
+                                     (layers->capacity + 8) * sizeof(Parse_Chunk));
+      if (!larger)
+      {
+         fprintf(stderr, "Failed to allocate layer memory.");
+         layers->failed = 1;
+         return 0;
+      }
+
+      layers->chunks = larger;
+      layers->capacity += 8;
+   }
+
+   layers->chunks[layers->count].text = text;
+   layers->chunks[layers->count].len = len;
+   layers->chunks[layers->count].head = NULL;
+   layers->chunks[layers->count].failed = 0;
+   ri_arena_init(&layers->chunks[layers->count].arena, len + 4096);
+   ++layers->count;
+
+   return 1;
+}
+
+/**
+ * @brief Merge a line into a section of the merged document.
+ *
+ * A tag first set by an earlier layer takes the value of the line;
+ * within a layer, the first line with a tag is kept, as
+ * *ri_find_section_value()* would find it in that file alone.
+ *
+ * @return TRUE if successful, FALSE if out of memory.
+ */
+int merge_line(Merge_Section *merged, const ri_Line *line, int layer, Arena *arena,
+               Arena *scratch)
+{
+   Name_Slot *slot;
+   Merge_Key *key;
+   ri_Line *new_line;
+   unsigned hash;
+
+   if (!name_table_grow(&merged->tags, merged->tag_count + 1, scratch))
+      return 0;
+
+   hash = ri_hash(line->tag);
+   slot = name_table_probe(&merged->tags, line->tag, hash);
+
+   if ((key = (Merge_Key*)slot->node))
+   {
+      if (key->layer != layer)
+      {
+         key->line->value = line->value;
+         key->layer = layer;
+      }
+
+      return 1;
+   }
+
+   new_line = (ri_Line*)ri_arena_alloc(arena, sizeof(Line_Node));
+   key = (Merge_Key*)ri_arena_alloc(scratch, sizeof(Merge_Key));
+   if (!new_line || !key)
+      return 0;
+
+   memset(new_line, 0, sizeof(Line_Node));
+   new_line->tag = line->tag;
+   new_line->value = line->value;
+   LINE_NODE(new_line)->section = merged->section;
+
+   if (merged->tail)
+      merged->tail->next = new_line;
+   else
+      merged->section->lines = new_line;
+   merged->tail = new_line;
+
+   key->line = new_line;
+   key->layer = layer;
+
+   slot->hash = hash;
+   slot->name = new_line->tag;
+   slot->node = key;
+   ++merged->tag_count;
+
+   return 1;
+}
+
+/**
+ * @brief Merge the parsed layers into one list of sections.
+ *
+ * Sections of the same name are joined, in order of first
+ * appearance, as are the tags of each section.  The lines point
+ * into the texts of the layers until *place_merged()* copies them.
+ *
+ * @return Head of the merged sections, or NULL if there are none
+ *         or out of memory, in which case *failed* is set.
+ */
+ri_Section *merge_layers(Layers *layers, Arena *arena)
+{
+   Name_Table sections = { 0, NULL };
+   unsigned section_count = 0, hash;
+   ri_Section *head = NULL, *tail = NULL;
+   const ri_Section *section;
+   const ri_Line *line;
+   Merge_Section *merged;
+   Name_Slot *slot;
+   int layer;
+
+   for (layer = 0; layer < layers->count && !layers->failed; ++layer)
+      for (section = layers->chunks[layer].head; section && !layers->failed; section = section->next)
+      {
+         if (!name_table_grow(&sections, section_count + 1, &layers->scratch))
+         {
+            layers->failed = 1;
+            break;
+         }
+
+         hash = ri_hash(section->section_name);
+         slot = name_table_probe(&sections, section->section_name, hash);
+
+         if (!(merged = (Merge_Section*)slot->node))
+         {
+            merged = (Merge_Section*)ri_arena_alloc(&layers->scratch, sizeof(Merge_Section));
+            if (!merged
+                || !(merged->section = (ri_Section*)ri_arena_alloc(arena, sizeof(Section_Node))))
+            {
+               layers->failed = 1;
+               break;
+            }
+
+            memset(merged->section, 0, sizeof(Section_Node));
+            merged->section->section_name = section->section_name;
+            merged->tail = NULL;
+            merged->tags.mask = 0;
+            merged->tags.slots = NULL;
+            merged->tag_count = 0;
+
+            if (tail)
+               tail->next = merged->section;
+            else
+               head = merged->section;
+            tail = merged->section;
+
+            slot->hash = hash;
+            slot->name = merged->section->section_name;
+            slot->node = merged;
+            ++section_count;
+         }
+
+         for (line = section->lines; line && !layers->failed; line = line->next)
+            if (!merge_line(merged, line, layer, arena, &layers->scratch))
+               layers->failed = 1;
+      }
+
+   if (layers->failed)
+   {
+      fprintf(stderr, "Failed to allocate layer memory.");
+      return NULL;
+   }
+
+   return head;
+}
+
+/**
+ * @brief Copy the names, tags and values of the merged sections into
+ *        one pool, and give each section the entries of its lines,
+ *        so the texts of the layers needn't outlast the merge.
+ *
+ * Only the lines that won the merge are copied, so the document
+ * holds no overridden values, comments or include directives.
+ *
+ * @return TRUE if successful, FALSE if out of memory.
+ */
+int place_merged(ri_Section *head, Arena *arena)
+{
+   Section_Node *section;
+   ri_Line *line;
+   ri_Entry *entry;
+   char *pool;
+   size_t size = 0, len;
+   unsigned count = 0;
+
+   for (section = SECTION_NODE(head); section; section = SECTION_NODE(section->section.next))
+   {
+      size += strlen(section->section.section_name) + 1;
+      for (line = (ri_Line*)section->section.lines; line; line = line->next, ++count)
+         size += strlen(line->tag) + 1 + (line->value ? strlen(line->value) + 1 : 0);
+   }
+
+   // Entries hold 32-bit offsets into the pool:
+   if (size >= UINT_MAX)
+   {
+      fprintf(stderr, "Layers too large to merge.");
+      return 0;
+   }
+
+   pool = (char*)ri_arena_alloc(arena, size);
+   entry = (ri_Entry*)ri_arena_alloc(arena, count * sizeof(ri_Entry));
+   if (!pool || !entry)
+      return 0;
+
+   size = 0;
+   for (section = SECTION_NODE(head); section; section = SECTION_NODE(section->section.next))
+   {
+      len = strlen(section->section.section_name) + 1;
+      section->section.section_name = memcpy(&pool[size], section->section.section_name, len);
+      size += len;
+
+      section->pool = pool;
+      section->entries = entry;
+      section->entry_count = 0;
+
+      for (line = (ri_Line*)section->section.lines; line; line = line->next, ++entry)
+      {
+         entry->tag_off = size;
+         entry->tag_len = strlen(line->tag);
+         line->tag = memcpy(&pool[size], line->tag, entry->tag_len + 1);
+         size += entry->tag_len + 1;
+
+         entry->value_off = 0;
+         entry->value_len = 0;
+         if (line->value)
+         {
+            entry->value_off = size;
+            entry->value_len = strlen(line->value);
+            line->value = memcpy(&pool[size], line->value, entry->value_len + 1);
+            size += entry->value_len + 1;
+         }
+
+         ++section->entry_count;
+      }
+   }
+
+   return 1;
+}
+
+/**
+ * @brief Load files as layers of one document, with *threads*
+ *        workers parsing them, or 0 for one per CPU.
+ *
+ * With RI_INTERN, the names are interned in *interner*, if not NULL,
+ * as by *load_file()*, and otherwise in an interner of the document.
+ */
+ri_Document *load_layers(const char **filepaths, int count, int flags, int threads,
+                         Interner *interner)
+{
+   Arena arena;
+   Layers layers;
+   ri_Document *doc;
+   ri_Section *sections = NULL;
+   Interner *names = NULL;
+   size_t total = 0;
+   int index;
+
+   memset(&layers, 0, sizeof(Layers));
+   ri_arena_init(&arena, 0);
+   ri_arena_init(&layers.scratch, 0);
+
+   doc = (ri_Document*)ri_arena_alloc(&arena, sizeof(ri_Document));
+   layers.failed = !doc;
+
+   RI_TRACE(RI_PHASE_READ, 0);
+   for (index = 0; index < count && !layers.failed; ++index)
+      layers_add_file(&layers, filepaths[index]);
+   RI_TRACE(RI_PHASE_READ, 1);
+
+   if (!layers.failed)
+   {
+      for (index = 0; index < layers.count; ++index)
+         total += layers.chunks[index].len;
+
+      if (threads <= 0)
+         threads = (int)sysconf(_SC_NPROCESSORS_ONLN);
+
+      // Small files are parsed faster than threads start:
+      if (total < RI_BLOCK_SIZE)
+         threads = 1;
+
+      RI_TRACE(RI_PHASE_PARSE, 0);
+      parse_chunks_parallel(layers.chunks, layers.count, threads);
+
+      // A layer that couldn't be parsed would lose its overrides:
+      for (index = 0; index < layers.count; ++index)
+         layers.failed |= layers.chunks[index].failed;
+
+      if (!layers.failed)
+         sections = merge_layers(&layers, &arena);
+      if (!layers.failed && !place_merged(sections, &arena))
+         layers.failed = 1;
+
+      // Names that can't all be interned are compared as strings:
+      if (!layers.failed && (flags & RI_INTERN))
+      {
+         names = interner ? interner_retain(interner) : interner_create();
+         if (!(names && intern_sections(names, sections)))
+            flags &= ~RI_INTERN;
+      }
+      RI_TRACE(RI_PHASE_PARSE, 1);
+   }
+
+   if (!layers.failed && (flags & RI_INDEX))
+   {
+      RI_TRACE(RI_PHASE_INDEX, 0);
+      if (!ri_build_index(sections, &arena))
+         clear_index(sections);
+      RI_TRACE(RI_PHASE_INDEX, 1);
+   }
+
+   // The texts and parsed layers were only needed to merge:
+   for (index = 0; index < layers.count; ++index)
+      ri_arena_release(&layers.chunks[index].arena);
+
+   free(layers.chunks);
+   ri_arena_release(&layers.scratch);
+
+   if (layers.failed)
+   {
+      interner_release(names);
+      ri_arena_release(&arena);
+      return NULL;
+   }
+
+   memset(doc, 0, sizeof(ri_Document));
+   doc->sections = sections;
+   doc->flags = flags & ~(RI_MMAP | RI_LAZY);
+   doc->interner = names;
+   doc->arena = arena;
+
+   if (doc->flags & RI_SORTED)
+   {
+      RI_TRACE(RI_PHASE_INDEX, 0);
+      sort_document(doc);
+      RI_TRACE(RI_PHASE_INDEX, 1);
+   }
+
+   return doc;
+}
+
+/**
+ * @brief Load several files as layers of one document.
+ *
+ * The files, and the files named by their include directives, are
+ * read once each, parsed on several threads, and merged: sections
+ * of the same name are joined, and a tag takes its value from the
+ * last file that sets it.  Each file follows the files it includes,
+ * and later *filepaths* follow earlier ones, so a base file can be
+ * overridden by host and tenant files.  Lookups in the result cost
+ * the same however many layers it has.
+ *
+ * Include directives are lines preceding the first section head:
+ *
+ *    include = base.ini
+ *    include-dir = conf.d
+ *
+ * Relative paths are relative to the directory of the file that
+ * names them.  An included directory adds its files, except hidden
+ * ones, in order of name.  A file named again is skipped.
+ *
+ * Only the merged lines are kept, copied out of the files, so the
+ * texts of the files don't outlast the load.  RI_MMAP and RI_LAZY
+ * are ignored, since the lines come from several files.
+ *
+ * @param filepaths Paths of the files, from lowest to highest precedence.
+ * @param count     Number of paths.
+ * @param flags     RI_INDEX, RI_INTERN, RI_SORTED, or 0.
+ *
+ * @return Pointer to the merged document, or NULL if any file couldn't
+ *         be read.
+ */
+ri_Document* ri_load_layers(const char **filepaths, int count, int flags)
+{
+   return load_layers(filepaths, count, flags, 0, NULL);
+}
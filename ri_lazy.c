@@ -0,0 +1,200 @@
+#include <stdio.h>
+#include <stdlib.h>  // for malloc(), free()
+#include <string.h>  // for memset(), memchr(), memcpy()
+#include <pthread.h>
+#include <sys/types.h>
+
+#include "readini.h"
+#include "readini_private.h"
+
+/**
+ * @brief Make the sections of a document without their lines.
+ *
+ * Only the section heads are found: '[' characters are searched
+ * across the text, and one preceded on its line by nothing but
+ * spaces starts a head.  Each section records the text from its
+ * head to the next head, to be parsed when it is first looked up.
+ * Section names are copied, so the text is untouched until then.
+ *
+ * @return Head of the sections list, or NULL if there are none or
+ *         out of memory.
+ */
+ri_Section *lazy_sections(ri_Document *doc)
+{
+   ri_Section *head = NULL, *section = NULL, *new_section;
+   Lazy_Section *lazy = NULL;
+   char *text = doc->text, *end = text + doc->len;
+   char *ptr = text, *line, *bracket, *newline;
+   char *copy, *eol, *close;
+   int failed = 0;
+
+   pthread_mutex_init(&doc->lock, NULL);
+
+   while (!failed && ptr < end && (bracket = (char*)memchr(ptr, '[', end - ptr)))
+   {
+      newline = (char*)memchr(bracket, '\n', end - bracket);
+      if (!newline)
+         newline = end;
+      ptr = newline + 1;
+
+      for (line = bracket; line > text && is_space(line - 1); --line)
+         ;
+      if (line > text && *(line-1) != '\n')
+         continue;
+
+      // Any head ends the text of the section before it:
+      if (lazy)
+      {
+         lazy->len = line - lazy->text;
+         lazy = NULL;
+      }
+
+      // The name is found as by parse_text(), in a copy of the head:
+      if (!(copy = arena_strndup(&doc->arena, bracket, newline - bracket)))
+      {
+         failed = 1;
+         continue;
+      }
+
+      eol = (char*)ri_scan.line_end(copy, copy + (newline - bracket));
+      if (*eol == '#' && eol > copy && *(eol-1) == '\\')
+      {
+         eol = copy + (newline - bracket);
+         copy = cook_line(copy, &eol);
+      }
+      *eol = '\0';
+
+      // A head without ']' hides lines until the next section head
+      if (!(close = (char*)memchr(copy, ']', eol - copy)))
+         continue;
+      *close = '\0';
+
+      new_section = (ri_Section*)ri_arena_alloc(&doc->arena, sizeof(Section_Node));
+      lazy = (Lazy_Section*)ri_arena_alloc(&doc->arena, sizeof(Lazy_Section));
+      if (!new_section || !lazy)
+      {
+         failed = 1;
+         continue;
+      }
+
+      memset(new_section, 0, sizeof(Section_Node));
+      new_section->section_name = copy + 1;
+      SECTION_NODE(new_section)->lazy = lazy;
+
+      lazy->doc = doc;
+      lazy->text = line;
+      lazy->len = 0;
+
+      if (section)
+         section->next = new_section;
+      else
+         head = new_section;
+
+      section = new_section;
+   }
+
+   if (failed)
+      return NULL;
+
+   if (lazy)
+      lazy->len = end - lazy->text;
+
+   return head;
+}
+
+/**
+ * @brief Parse the text of a lazy section into its lines, entries
+ *        and, if indexed or sorted, table or array of tags.
+ *
+ * The text is parsed in place, as by *ri_load()*, after saving a
+ * copy of it.  Nothing is given to the section until every step has
+ * succeeded, so a section that runs out of memory has its text put
+ * back and is left unparsed, to be parsed again by a later lookup.
+ * With RI_INTERN, its tags are interned before the lines are given
+ * to the section, so they are never seen uninterned.
+ *
+ * @return TRUE if successful, FALSE if out of memory.
+ */
+int lazy_parse(ri_Section *section, const Lazy_Section *lazy)
+{
+   Section_Node *node = SECTION_NODE(section), *parsed = NULL;
+   ri_Section *head;
+   struct ri_index index;
+   Arena *arena = &lazy->doc->arena;
+   ri_Line *line;
+   char *saved;
+
+   if (!(saved = (char*)malloc(lazy->len + 1)))
+   {
+      fprintf(stderr, "Failed to allocate parse memory.");
+      return 0;
+   }
+
+   memcpy(saved, lazy->text, lazy->len);
+
+   if (node->index)
+      index = *node->index;
+
+   if (!parse_text(lazy->text, lazy->len, arena, &head)
+       || !(parsed = SECTION_NODE(head))
+       || ((lazy->doc->flags & RI_INTERN)
+           && !intern_sections(lazy->doc->interner, &parsed->section))
+       || (node->index && !index_tags(&index, parsed->section.lines, arena))
+       || ((lazy->doc->flags & RI_SORTED) && !sort_lines(&parsed->section, arena)))
+   {
+      // The nodes made so far are abandoned in the arena:
+      memcpy(lazy->text, saved, lazy->len);
+      free(saved);
+      return 0;
+   }
+
+   free(saved);
+
+   section->lines = parsed->section.lines;
+   node->pool = parsed->pool;
+   node->entries = parsed->entries;
+   node->entry_count = parsed->entry_count;
+   node->sorted = parsed->sorted;
+
+   for (line = (ri_Line*)section->lines; line; line = line->next)
+      LINE_NODE(line)->section = section;
+
+   // Other threads may be reading the rest of the index meanwhile:
+   if (node->index)
+      ((struct ri_index*)node->index)->tags = index.tags;
+
+   return 1;
+}
+
+/**
+ * @brief Make sure that the lines of a section are parsed.
+ *
+ * Sections of documents loaded without RI_LAZY are returned as they
+ * are.  Otherwise, the first thread to look a section up parses it,
+ * holding the lock of its document, and then publishes it, so
+ * later lookups take no lock.  A section that runs out of memory is
+ * returned without lines, and stays unparsed for the next lookup
+ * to try again.
+ *
+ * @return The section.
+ */
+const ri_Section *section_parsed(const ri_Section *section)
+{
+   Section_Node *node = SECTION_NODE(section);
+   const Lazy_Section *lazy = __atomic_load_n(&node->lazy, __ATOMIC_ACQUIRE);
+   ri_Document *doc;
+
+   if (!lazy)
+      return section;
+
+   doc = lazy->doc;
+   pthread_mutex_lock(&doc->lock);
+
+   // Another thread may have parsed it while this one waited:
+   if (node->lazy && lazy_parse(&node->section, lazy))
+      __atomic_store_n(&node->lazy, NULL, __ATOMIC_RELEASE);
+
+   pthread_mutex_unlock(&doc->lock);
+
+   return section;
+}
@@ -0,0 +1,197 @@
+#include <stdio.h>
+#include <stdlib.h>  // for malloc(), free()
+#include <string.h>  // for memchr()
+#include <unistd.h>  // for sysconf()
+#include <pthread.h>
+#include <sys/types.h>
+
+#include "readini.h"
+#include "readini_private.h"
+
+/** Chunks per worker, so that workers finishing early can take more. */
+#define CHUNKS_PER_THREAD 4
+
+/**
+ * Work shared by the workers of *parse_text_parallel()*: each takes
+ * the next unparsed chunk until none are left.
+ */
+struct chunk_work
+{
+   Parse_Chunk *chunks;
+   int count;
+   int next;
+};
+
+/**
+ * @brief Find the first section head at or after an offset.
+ *
+ * @return Offset of the start of the first line, at or after
+ *         *offset*, whose first character after any spaces is '[',
+ *         or *len* if there is none.
+ *
+ * Since a section head ends any open section, parsing from such a
+ * line gives the same result as reaching it from the top of the file.
+ */
+size_t next_chunk_start(const char *text, size_t len, size_t offset)
+{
+   const char *ptr = text + offset;
+   const char *end = text + len;
+   const char *line;
+
+   // Begin at a line start:
+   if (offset > 0 && ptr < end && *(ptr-1) != '\n')
+   {
+      ptr = (const char*)memchr(ptr, '\n', end - ptr);
+      ptr = ptr ? ptr + 1 : end;
+   }
+
+   while (ptr < end)
+   {
+      line = ptr;
+      while (line < end && is_space(line))
+         ++line;
+
+      if (line < end && line_is_section_type(line))
+         break;
+
+      ptr = (const char*)memchr(line, '\n', end - line);
+      ptr = ptr ? ptr + 1 : end;
+   }
+
+   return ptr - text;
+}
+
+/** @brief Worker: parse chunks until none are left. */
+void *parse_chunks(void *arg)
+{
+   struct chunk_work *work = (struct chunk_work*)arg;
+   Parse_Chunk *chunk;
+   int index;
+
+   while ((index = __atomic_fetch_add(&work->next, 1, __ATOMIC_RELAXED)) < work->count)
+   {
+      chunk = &work->chunks[index];
+      chunk->failed = !parse_text(chunk->text, chunk->len, &chunk->arena, &chunk->head);
+   }
+
+   return NULL;
+}
+
+/**
+ * @brief Parse chunks on a pool of up to *threads* workers, including
+ *        the calling thread, each taking the next unparsed chunk.
+ *
+ * If workers can't be started, the calling thread parses the rest.
+ */
+void parse_chunks_parallel(Parse_Chunk *chunks, int count, int threads)
+{
+   struct chunk_work work = { chunks, count, 0 };
+   pthread_t *workers = NULL;
+   int index, started = 0;
+
+   if (threads > count)
+      threads = count;
+
+   if (threads > 1)
+      workers = (pthread_t*)malloc((threads - 1) * sizeof(pthread_t));
+
+   for (index = 0; workers && index < threads - 1; ++index)
+      if (0 == pthread_create(&workers[index], NULL, parse_chunks, &work))
+         ++started;
+
+   parse_chunks(&work);
+
+   for (index = 0; index < started; ++index)
+      pthread_join(workers[index], NULL);
+
+   free(workers);
+}
+
+/**
+ * @brief Parse text on several threads.
+ *
+ * The text is split into chunks that begin at section heads, which
+ * a pool of *threads* workers, including the calling thread, parse
+ * into separate arenas.  The section lists of the chunks are then
+ * joined in file order, and the arenas are given to *arena*, so the
+ * result is the same as that of *parse_text()*.
+ *
+ * Each chunk is parsed with its own text pool, so only a chunk, not
+ * the whole text, is limited in size by the 32-bit entry offsets.
+ *
+ * @param threads Number of threads to use, or 0 for one per CPU.
+ * @param result  Set to the head of the sections list, or NULL.
+ *
+ * @return TRUE if successful, FALSE if any chunk couldn't be parsed,
+ *         in which case no sections are returned.
+ */
+int parse_text_parallel(char *text, size_t len, Arena *arena, int threads, ri_Section **result)
+{
+   Parse_Chunk *chunks;
+   ri_Section *head = NULL, *tail = NULL;
+   size_t start, next;
+   int index, count = 0, max_chunks, failed = 0;
+
+   if (threads <= 0)
+      threads = (int)sysconf(_SC_NPROCESSORS_ONLN);
+
+   if (threads <= 1 || len < RI_BLOCK_SIZE)
+      return parse_text(text, len, arena, result);
+
+   max_chunks = threads * CHUNKS_PER_THREAD;
+   chunks = (Parse_Chunk*)malloc(max_chunks * sizeof(Parse_Chunk));
+   if (!chunks)
+      return parse_text(text, len, arena, result);
+
+   // Split at the first section head following each even division:
+   for (start = 0; start < len && count < max_chunks; start = next)
+   {
+      next = next_chunk_start(text, len, len / max_chunks * (count + 1));
+      if (next <= start)
+         next = next_chunk_start(text, len, start + 1);
+
+      chunks[count].text = text + start;
+      chunks[count].len = next - start;
+      chunks[count].head = NULL;
+      chunks[count].failed = 0;
+      ri_arena_init(&chunks[count].arena, next - start + 4096);
+      ++count;
+   }
+
+   // The last chunk takes whatever the division leaves:
+   if (start < len)
+      chunks[count - 1].len = len - (chunks[count - 1].text - text);
+
+   parse_chunks_parallel(chunks, count, threads);
+
+   for (index = 0; index < count; ++index)
+      failed |= chunks[index].failed;
+
+   for (index = 0; index < count; ++index)
+   {
+      // A chunk without its sections would pass for a complete text:
+      if (failed)
+      {
+         ri_arena_release(&chunks[index].arena);
+         continue;
+      }
+
+      if (chunks[index].head)
+      {
+         if (tail)
+            tail->next = chunks[index].head;
+         else
+            head = chunks[index].head;
+
+         for (tail = chunks[index].head; tail->next; tail = tail->next)
+            ;
+      }
+
+      ri_arena_adopt(arena, &chunks[index].arena);
+   }
+
+   free(chunks);
+
+   *result = head;
+   return !failed;
+}
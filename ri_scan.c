@@ -0,0 +1,192 @@
+#include <stdio.h>
+#include <stdlib.h>  // for getenv()
+#include <string.h>  // for strcmp()
+#include <sys/types.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define RI_SCAN_X86 1
+#endif
+
+#include "readini.h"
+#include "readini_private.h"
+
+/**
+ * Character classes used by the scalar kernels, and by the
+ * vector kernels to finish the bytes that don't fill a vector.
+ */
+#define CLASS_LINE_END 1  // '\n' or '#'
+#define CLASS_TAG_END  2  // '#', ':', '=', ' ' or '\t'
+
+const unsigned char char_classes[256] = {
+   ['\n'] = CLASS_LINE_END,
+   ['#']  = CLASS_LINE_END | CLASS_TAG_END,
+   [':']  = CLASS_TAG_END,
+   ['=']  = CLASS_TAG_END,
+   [' ']  = CLASS_TAG_END,
+   ['\t'] = CLASS_TAG_END
+};
+
+/** @brief Return pointer to first '\n' or '#' before *end*, or *end*. */
+const char *line_end_scalar(const char *ptr, const char *end)
+{
+   while (ptr < end && !(char_classes[(unsigned char)*ptr] & CLASS_LINE_END))
+      ++ptr;
+   return ptr;
+}
+
+/** @brief Return pointer to first tag-ending character before *end*, or *end*. */
+const char *tag_end_scalar(const char *ptr, const char *end)
+{
+   while (ptr < end && !(char_classes[(unsigned char)*ptr] & CLASS_TAG_END))
+      ++ptr;
+   return ptr;
+}
+
+#ifdef RI_SCAN_X86
+
+/** @brief SSE2 version of *line_end_scalar()*, 16 bytes at a time. */
+const char *line_end_sse2(const char *ptr, const char *end)
+{
+   const __m128i newline = _mm_set1_epi8('\n');
+   const __m128i sharp = _mm_set1_epi8('#');
+   __m128i chars;
+   int mask;
+
+   while (end - ptr >= 16)
+   {
+      chars = _mm_loadu_si128((const __m128i*)ptr);
+      mask = _mm_movemask_epi8(_mm_or_si128(_mm_cmpeq_epi8(chars, newline),
+                                            _mm_cmpeq_epi8(chars, sharp)));
+      if (mask)
+         return ptr + __builtin_ctz(mask);
+
+      ptr += 16;
+   }
+
+   return line_end_scalar(ptr, end);
+}
+
+/** @brief SSE2 version of *tag_end_scalar()*, 16 bytes at a time. */
+const char *tag_end_sse2(const char *ptr, const char *end)
+{
+   const __m128i sharp = _mm_set1_epi8('#');
+   const __m128i colon = _mm_set1_epi8(':');
+   const __m128i equal = _mm_set1_epi8('=');
+   const __m128i space = _mm_set1_epi8(' ');
+   const __m128i tab = _mm_set1_epi8('\t');
+   __m128i chars, hits;
+   int mask;
+
+   while (end - ptr >= 16)
+   {
+      chars = _mm_loadu_si128((const __m128i*)ptr);
+      hits = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(chars, sharp),
+                                       _mm_cmpeq_epi8(chars, colon)),
+                          _mm_or_si128(_mm_cmpeq_epi8(chars, equal),
+                                       _mm_or_si128(_mm_cmpeq_epi8(chars, space),
+                                                    _mm_cmpeq_epi8(chars, tab))));
+      mask = _mm_movemask_epi8(hits);
+      if (mask)
+         return ptr + __builtin_ctz(mask);
+
+      ptr += 16;
+   }
+
+   return tag_end_scalar(ptr, end);
+}
+
+/** @brief AVX2 version of *line_end_scalar()*, 32 bytes at a time. */
+__attribute__((target("avx2")))
+const char *line_end_avx2(const char *ptr, const char *end)
+{
+   const __m256i newline = _mm256_set1_epi8('\n');
+   const __m256i sharp = _mm256_set1_epi8('#');
+   __m256i chars;
+   unsigned mask;
+
+   while (end - ptr >= 32)
+   {
+      chars = _mm256_loadu_si256((const __m256i*)ptr);
+      mask = _mm256_movemask_epi8(_mm256_or_si256(_mm256_cmpeq_epi8(chars, newline),
+                                                  _mm256_cmpeq_epi8(chars, sharp)));
+      if (mask)
+         return ptr + __builtin_ctz(mask);
+
+      ptr += 32;
+   }
+
+   return line_end_sse2(ptr, end);
+}
+
+/** @brief AVX2 version of *tag_end_scalar()*, 32 bytes at a time. */
+__attribute__((target("avx2")))
+const char *tag_end_avx2(const char *ptr, const char *end)
+{
+   const __m256i sharp = _mm256_set1_epi8('#');
+   const __m256i colon = _mm256_set1_epi8(':');
+   const __m256i equal = _mm256_set1_epi8('=');
+   const __m256i space = _mm256_set1_epi8(' ');
+   const __m256i tab = _mm256_set1_epi8('\t');
+   __m256i chars, hits;
+   unsigned mask;
+
+   while (end - ptr >= 32)
+   {
+      chars = _mm256_loadu_si256((const __m256i*)ptr);
+      hits = _mm256_or_si256(_mm256_or_si256(_mm256_cmpeq_epi8(chars, sharp),
+                                             _mm256_cmpeq_epi8(chars, colon)),
+                             _mm256_or_si256(_mm256_cmpeq_epi8(chars, equal),
+                                             _mm256_or_si256(_mm256_cmpeq_epi8(chars, space),
+                                                             _mm256_cmpeq_epi8(chars, tab))));
+      mask = _mm256_movemask_epi8(hits);
+      if (mask)
+         return ptr + __builtin_ctz(mask);
+
+      ptr += 32;
+   }
+
+   return tag_end_sse2(ptr, end);
+}
+
+#endif
+
+/** Kernels in use, scalar until *select_scan_kernels()* runs. */
+Scan_Kernels ri_scan = { "scalar", line_end_scalar, tag_end_scalar };
+
+/**
+ * @brief Choose the widest kernels the CPU supports when the library loads.
+ *
+ * Setting the environment variable RI_SCAN to "scalar", "sse2" or
+ * "avx2" limits the choice, which is useful for benchmarking.  The
+ * choice is made again by each call, so checks can compare kernels.
+ */
+__attribute__((constructor))
+void select_scan_kernels(void)
+{
+#ifdef RI_SCAN_X86
+   const char *limit = getenv("RI_SCAN");
+
+   ri_scan.name = "scalar";
+   ri_scan.line_end = line_end_scalar;
+   ri_scan.tag_end = tag_end_scalar;
+
+   if (limit && 0 == strcmp(limit, "scalar"))
+      return;
+
+   __builtin_cpu_init();
+
+   if (__builtin_cpu_supports("avx2") && !(limit && 0 == strcmp(limit, "sse2")))
+   {
+      ri_scan.name = "avx2";
+      ri_scan.line_end = line_end_avx2;
+      ri_scan.tag_end = tag_end_avx2;
+   }
+   else if (__builtin_cpu_supports("sse2"))
+   {
+      ri_scan.name = "sse2";
+      ri_scan.line_end = line_end_sse2;
+      ri_scan.tag_end = tag_end_sse2;
+   }
+#endif
+}
@@ -0,0 +1,310 @@
+#include <stdio.h>
+#include <stdlib.h>  // for malloc(), realloc(), free()
+#include <string.h>  // for memset(), strcmp(), strncmp()
+#include <sys/types.h>
+
+#include "readini.h"
+#include "readini_private.h"
+
+/**
+ * @brief Convert a value and set the member of its key.
+ *
+ * String values are copied to the strings arena of the target, and
+ * other values are converted as by the typed functions like
+ * *ri_line_int64()*.
+ *
+ * @return TRUE if the member was set, FALSE if the value is invalid
+ *         or out of memory, in which case *failed* is set.
+ */
+int schema_set(Schema_Load *load, int key, const char *value, int len)
+{
+   static int (*const converters[])(const char *text, ri_Typed_Value *value) = {
+      NULL, convert_int64, convert_uint64, convert_double,
+      convert_bool, convert_duration, convert_bytes
+   };
+   const ri_Schema_Key *schema_key = &load->schema->keys[key];
+   char *member = load->target + schema_key->offset;
+   ri_Typed_Value converted;
+   char *text;
+
+   text = arena_strndup(schema_key->type == RI_SCHEMA_STRING ? load->strings : &load->arena,
+                        value, len);
+   if (!text)
+   {
+      fprintf(stderr, "Failed to allocate schema memory.");
+      load->failed = 1;
+      return 0;
+   }
+
+   if (schema_key->type == RI_SCHEMA_STRING)
+   {
+      *(const char**)member = text;
+      return 1;
+   }
+
+   if ((*converters[schema_key->type])(text, &converted) != RI_OK)
+      return 0;
+
+   switch (schema_key->type)
+   {
+      case RI_SCHEMA_INT64:
+      case RI_SCHEMA_DURATION:
+         *(int64_t*)member = converted.i;
+         break;
+      case RI_SCHEMA_UINT64:
+      case RI_SCHEMA_BYTES:
+         *(uint64_t*)member = converted.u;
+         break;
+      case RI_SCHEMA_DOUBLE:
+         *(double*)member = converted.d;
+         break;
+      case RI_SCHEMA_BOOL:
+         *(int*)member = (int)converted.i;
+         break;
+   }
+
+   return 1;
+}
+
+/**
+ * @brief Set the defaults of a target and prepare to load a file.
+ *
+ * The table of keys is built from the hashes computed by the
+ * compiler, so only names too long for *RI_SCHEMA_HASH()* are
+ * hashed here.
+ *
+ * @return TRUE if successful, FALSE if the schema is invalid or out
+ *         of memory.
+ */
+int schema_init(Schema_Load *load, const ri_Schema *schema, void *target, int flags)
+{
+   const ri_Schema_Key *key;
+   unsigned slot_count = 2, index;
+   char *member;
+   int number;
+
+   memset(load, 0, sizeof(Schema_Load));
+   ri_arena_init(&load->arena, 0);
+   load->schema = schema;
+   load->target = (char*)target;
+   load->flags = flags;
+
+   // The target owns the strings arena, which ri_schema_free() releases
+   // even if this fails, so it is ready before anything else can fail:
+   load->strings = (Arena*)malloc(sizeof(Arena));
+   if (load->strings)
+      ri_arena_init(load->strings, 0);
+   *(Arena**)(load->target + schema->strings_offset) = load->strings;
+
+   while (slot_count < 2u * schema->count)
+      slot_count *= 2;
+
+   load->mask = slot_count - 1;
+   load->slots = (int*)ri_arena_alloc(&load->arena, slot_count * sizeof(int));
+   load->hashes = (unsigned*)ri_arena_alloc(&load->arena, schema->count * sizeof(unsigned));
+   load->seen = (char*)ri_arena_alloc(&load->arena, schema->count);
+
+   if (!load->strings || !load->slots || !load->hashes || !load->seen)
+   {
+      fprintf(stderr, "Failed to allocate schema memory.");
+      return 0;
+   }
+
+   memset(load->slots, 0, slot_count * sizeof(int));
+   memset(load->seen, 0, schema->count);
+
+   for (number = 0; number < schema->count; ++number)
+   {
+      key = &schema->keys[number];
+      member = load->target + key->offset;
+
+      if (key->type < RI_SCHEMA_STRING || key->type > RI_SCHEMA_BYTES)
+      {
+         fprintf(stderr, "Invalid type of tag \"%s\" in section \"%s\".",
+                 key->tag_name, key->section_name);
+         return 0;
+      }
+
+      load->hashes[number] = key->hash;
+      if (!load->hashes[number])
+      {
+         load->hashes[number] = ri_hash_more(ri_hash(key->section_name), "]", 1);
+         load->hashes[number] = ri_hash_more(load->hashes[number], key->tag_name,
+                                             strlen(key->tag_name));
+      }
+
+      for (index = load->hashes[number] & load->mask; load->slots[index];
+           index = (index + 1) & load->mask)
+         ;
+      load->slots[index] = number + 1;
+
+      // A string default is used as is, and other defaults are converted:
+      if (key->type == RI_SCHEMA_STRING)
+         *(const char**)member = key->default_value;
+      else if (!key->default_value)
+         switch (key->type)
+         {
+            case RI_SCHEMA_DOUBLE: *(double*)member = 0;  break;
+            case RI_SCHEMA_BOOL:   *(int*)member = 0;     break;
+            default:               *(int64_t*)member = 0; break;
+         }
+      else if (!schema_set(load, number, key->default_value, strlen(key->default_value)))
+      {
+         if (!load->failed)
+            fprintf(stderr, "Invalid default value of tag \"%s\" in section \"%s\".",
+                    key->tag_name, key->section_name);
+         return 0;
+      }
+   }
+
+   return 1;
+}
+
+/** @brief Event callback: remember the section of the following tags. */
+int schema_on_section(const char *name, int len, void *data)
+{
+   Schema_Load *load = (Schema_Load*)data;
+   char *larger;
+
+   if (len >= load->section_size)
+   {
+      if (!(larger = (char*)realloc(load->section, len + 1)))
+      {
+         fprintf(stderr, "Failed to allocate schema memory.");
+         load->failed = 1;
+         return 0;
+      }
+
+      load->section = larger;
+      load->section_size = len + 1;
+   }
+
+   memcpy(load->section, name, len);
+   load->section[len] = '\0';
+   load->section_hash = ri_hash_more(ri_hash_slice(name, len), "]", 1);
+
+   return 1;
+}
+
+/**
+ * @brief Event callback: set the member of a tag the first time it
+ *        is found, as *ri_find_section_value()* would find it.
+ */
+int schema_on_key_value(const char *tag, int len_tag,
+                        const char *value, int len_value, void *data)
+{
+   Schema_Load *load = (Schema_Load*)data;
+   const ri_Schema_Key *key = NULL;
+   unsigned hash = ri_hash_more(load->section_hash, tag, len_tag);
+   unsigned index;
+   int number;
+
+   for (index = hash & load->mask; (number = load->slots[index]); index = (index + 1) & load->mask)
+   {
+      key = &load->schema->keys[--number];
+      if (load->hashes[number] == hash
+          && 0 == strncmp(key->tag_name, tag, len_tag) && key->tag_name[len_tag] == '\0'
+          && 0 == strcmp(key->section_name, load->section))
+         break;
+   }
+
+   if (!load->slots[index])
+   {
+      ++load->problems;
+      if (load->flags & RI_STRICT)
+      {
+         fprintf(stderr, "Unknown tag \"%.*s\" in section \"%s\".", len_tag, tag, load->section);
+         load->failed = 1;
+      }
+   }
+   else if (!load->seen[number])
+   {
+      load->seen[number] = 1;
+
+      // A tag without a value keeps its default:
+      if (len_value && !schema_set(load, number, value, len_value) && !load->failed)
+      {
+         ++load->problems;
+         if (load->flags & RI_STRICT)
+         {
+            fprintf(stderr, "Invalid value of tag \"%s\" in section \"%s\".",
+                    key->tag_name, key->section_name);
+            load->failed = 1;
+         }
+      }
+   }
+
+   return !load->failed;
+}
+
+/** @brief Event callback: count a malformed line, or stop if strict. */
+int schema_on_error(const char *message, long line_number, void *data)
+{
+   Schema_Load *load = (Schema_Load*)data;
+
+   ++load->problems;
+   if (load->flags & RI_STRICT)
+   {
+      fprintf(stderr, "%s Line %ld.", message, line_number);
+      load->failed = 1;
+   }
+
+   return !load->failed;
+}
+
+/**
+ * @brief Read a file in one pass into a struct declared by a schema.
+ *
+ * Each member is first set to its default, then to the value of its
+ * tag, converted to its type, as *ri_find_section_value()* would
+ * find it: from the first line with the tag, in the first section of
+ * the name that has the tag.  A tag without a value keeps the default.
+ * The file is read with *ri_parse_events()*, so nothing but the string
+ * values is kept in memory.
+ *
+ * Tags that aren't in the schema, values that can't be converted and
+ * malformed lines are counted, and with RI_STRICT, the first of them
+ * stops the reading.
+ *
+ * String members point into memory owned by the target, which must be
+ * freed with *ri_schema_free()* once the target is no longer used,
+ * even if loading fails.
+ *
+ * @param filepath Path to the configuration file.
+ * @param schema   Schema returned by a function made by *RI_SCHEMA_TABLE()*.
+ * @param target   Struct made by *RI_SCHEMA_STRUCT()* from the same list.
+ * @param flags    RI_STRICT, or 0.
+ *
+ * @return Number of unknown tags, invalid values and malformed lines,
+ *         or -1 if the file couldn't be read, memory allocated or,
+ *         with RI_STRICT, any of them was found.
+ */
+int ri_load_schema(const char *filepath, const ri_Schema *schema, void *target, int flags)
+{
+   ri_Events events = { schema_on_section, schema_on_key_value, NULL, schema_on_error };
+   Schema_Load load;
+   int result = -1;
+
+   if (schema_init(&load, schema, target, flags)
+       && ri_parse_events(filepath, &events, &load)
+       && !load.failed)
+      result = load.problems;
+
+   ri_arena_release(&load.arena);
+   free(load.section);
+
+   return result;
+}
+
+/** @brief Free the string values of a target loaded by *ri_load_schema()*. */
+void ri_schema_free(const ri_Schema *schema, void *target)
+{
+   Arena **strings = (Arena**)((char*)target + schema->strings_offset);
+
+   if (*strings)
+   {
+      ri_arena_release(*strings);
+      free(*strings);
+      *strings = NULL;
+   }
+}
@@ -0,0 +1,294 @@
+#include <stdio.h>
+#include <stdlib.h>   // for malloc(), free()
+#include <string.h>   // for memcpy(), strcmp(), strncmp(), strcspn()
+#include <fnmatch.h>
+#include <sys/types.h>
+
+#include "readini.h"
+#include "readini_private.h"
+
+/** @brief Name of a section or line, which is its first member. */
+const char *node_name(const void *node)
+{
+   return *(const char * const *)node;
+}
+
+/** Number of nodes sorted by insertion before runs are merged. */
+#define SORT_RUN 16
+
+/**
+ * @brief Sort sections or lines by name, keeping those of the same
+ *        name in their order.
+ *
+ * Runs of SORT_RUN nodes are sorted in place by insertion, and then
+ * merged through a buffer of the same size as the array.
+ *
+ * @return TRUE if successful, FALSE if out of memory.
+ */
+int sort_nodes(const void **nodes, unsigned count)
+{
+   const void **work, **from, **to, **swap, *node;
+   unsigned width, lo, mid, hi, left, right, out;
+
+   for (lo = 0; lo < count; lo += SORT_RUN)
+   {
+      hi = lo + SORT_RUN < count ? lo + SORT_RUN : count;
+      for (left = lo + 1; left < hi; ++left)
+      {
+         node = nodes[left];
+         for (out = left; out > lo && strcmp(node_name(nodes[out-1]), node_name(node)) > 0; --out)
+            nodes[out] = nodes[out-1];
+         nodes[out] = node;
+      }
+   }
+
+   if (count <= SORT_RUN)
+      return 1;
+
+   if (!(work = (const void**)malloc(count * sizeof(const void*))))
+      return 0;
+
+   from = nodes;
+   to = work;
+   for (width = SORT_RUN; width < count; width *= 2)
+   {
+      for (lo = 0; lo < count; lo += 2 * width)
+      {
+         mid = lo + width < count ? lo + width : count;
+         hi = mid + width < count ? mid + width : count;
+
+         // A node of the right run goes first only if its name is less:
+         left = lo;
+         right = mid;
+         out = lo;
+         while (left < mid && right < hi)
+         {
+            if (strcmp(node_name(from[right]), node_name(from[left])) < 0)
+               to[out++] = from[right++];
+            else
+               to[out++] = from[left++];
+         }
+         while (left < mid)
+            to[out++] = from[left++];
+         while (right < hi)
+            to[out++] = from[right++];
+      }
+
+      swap = from;
+      from = to;
+      to = swap;
+   }
+
+   if (from != nodes)
+      memcpy(nodes, from, count * sizeof(const void*));
+
+   free(work);
+   return 1;
+}
+
+/**
+ * @brief Sort the lines of a section by tag.
+ *
+ * @return TRUE if successful, FALSE if out of memory, in which case
+ *         the section has no sorted lines.
+ */
+int sort_lines(ri_Section *section, Arena *arena)
+{
+   Sorted_Nodes *sorted;
+   const ri_Line *line;
+   unsigned count = 0;
+
+   for (line = section->lines; line; line = line->next)
+      ++count;
+
+   sorted = (Sorted_Nodes*)ri_arena_alloc(arena, sizeof(Sorted_Nodes) + count * sizeof(const void*));
+   if (!sorted)
+      return 0;
+
+   sorted->count = 0;
+   for (line = section->lines; line; line = line->next)
+      sorted->nodes[sorted->count++] = line;
+
+   if (!sort_nodes(sorted->nodes, count))
+      return 0;
+
+   SECTION_NODE(section)->sorted = sorted;
+   return 1;
+}
+
+/**
+ * @brief Sort the sections of a document by name, and the lines of
+ *        each section by tag.  The lines of lazy sections are sorted
+ *        when the sections are parsed.
+ *
+ * @return TRUE if successful, FALSE if out of memory, in which case
+ *         the document or some sections have no sorted nodes.
+ */
+int sort_document(ri_Document *doc)
+{
+   Sorted_Nodes *sorted;
+   ri_Section *section;
+   unsigned count = 0;
+
+   for (section = doc->sections; section; section = section->next)
+   {
+      ++count;
+      if (!SECTION_NODE(section)->lazy && !sort_lines(section, &doc->arena))
+         return 0;
+   }
+
+   sorted = (Sorted_Nodes*)ri_arena_alloc(&doc->arena,
+                                          sizeof(Sorted_Nodes) + count * sizeof(const void*));
+   if (!sorted)
+      return 0;
+
+   sorted->count = 0;
+   for (section = doc->sections; section; section = section->next)
+      sorted->nodes[sorted->count++] = section;
+
+   if (!sort_nodes(sorted->nodes, count))
+      return 0;
+
+   doc->sorted = sorted;
+   return 1;
+}
+
+/**
+ * @brief Set an iterator to the nodes whose names might match a
+ *        pattern: those that begin with the characters that precede
+ *        its first wildcard or escape, found by binary searches.
+ *
+ * @return TRUE if any node might match.
+ */
+int match_range(const Sorted_Nodes *sorted, const char *pattern, ri_Match_Iter *iter)
+{
+   size_t len = strcspn(pattern, "*?[\\");
+   unsigned lo = 0, hi = sorted->count, mid, first;
+
+   while (lo < hi)
+   {
+      mid = lo + (hi - lo) / 2;
+      if (strncmp(node_name(sorted->nodes[mid]), pattern, len) < 0)
+         lo = mid + 1;
+      else
+         hi = mid;
+   }
+
+   first = lo;
+   hi = sorted->count;
+   while (lo < hi)
+   {
+      mid = lo + (hi - lo) / 2;
+      if (strncmp(node_name(sorted->nodes[mid]), pattern, len) <= 0)
+         lo = mid + 1;
+      else
+         hi = mid;
+   }
+
+   iter->next = &sorted->nodes[first];
+   iter->end = &sorted->nodes[lo];
+
+   // Every name of the range matches a pattern that is a prefix and '*':
+   iter->pattern = 0 == strcmp(pattern + len, "*") ? NULL : pattern;
+
+   return iter->next != iter->end;
+}
+
+/** @brief Return the next node of a range that matches its pattern. */
+const void *match_next(ri_Match_Iter *iter)
+{
+   const void *node;
+
+   while (iter->next != iter->end)
+   {
+      node = *iter->next++;
+      if (!iter->pattern || 0 == fnmatch(iter->pattern, node_name(node), 0))
+         return node;
+   }
+
+   return NULL;
+}
+
+/**
+ * @brief Start iterating over the sections of a document whose names
+ *        match a pattern, in order of name.
+ *
+ * The pattern is a shell wildcard pattern, as for *fnmatch()*: '*'
+ * matches any characters, '?' one character, and "[...]" one of a
+ * set, while '\\' makes the next character literal.  The sections
+ * are found by binary search on the characters before the first
+ * wildcard, so a pattern like "tenant-*" costs a search and one step
+ * for each section that matches, and "*-tenant" visits every section.
+ * Sections of the same name are given in file order.
+ *
+ * @param doc     Document loaded with RI_SORTED.
+ * @param pattern Pattern to match against section names.
+ * @param iter    Iterator to initialize, usually on the stack.
+ *
+ * @return TRUE if any section might match, FALSE if none does or
+ *         the document wasn't loaded with RI_SORTED.
+ *
+ * @code
+ * ri_Match_Iter iter;
+ * const ri_Section *section;
+ * if (ri_match_sections(doc, "tenant-*", &iter))
+ *    while ((section = ri_next_section(&iter)))
+ *       printf("[%s]\n", section->section_name);
+ * @endcode
+ */
+int ri_match_sections(const ri_Document *doc, const char *pattern, ri_Match_Iter *iter)
+{
+   if (!doc->sorted)
+   {
+      iter->next = iter->end = NULL;
+      return 0;
+   }
+
+   return match_range(doc->sorted, pattern, iter);
+}
+
+/**
+ * @brief Return the next section found by *ri_match_sections()*, or
+ *        NULL if there are no more.
+ */
+const ri_Section* ri_next_section(ri_Match_Iter *iter)
+{
+   return (const ri_Section*)match_next(iter);
+}
+
+/**
+ * @brief Start iterating over the lines of a section whose tags match
+ *        a pattern, in order of tag.
+ *
+ * The pattern is as for *ri_match_sections()*, so "upstream.*" finds
+ * the tags that begin with "upstream." with a binary search.  Lines
+ * with the same tag are given in file order.
+ *
+ * @param section Section of a document loaded with RI_SORTED.
+ * @param pattern Pattern to match against tags.
+ * @param iter    Iterator to initialize, usually on the stack.
+ *
+ * @return TRUE if any line might match, FALSE if none does or the
+ *         section isn't from a document loaded with RI_SORTED.
+ */
+int ri_match_lines(const ri_Section *section, const char *pattern, ri_Match_Iter *iter)
+{
+   const Section_Node *node = SECTION_NODE(section_parsed(section));
+
+   if (!node->sorted)
+   {
+      iter->next = iter->end = NULL;
+      return 0;
+   }
+
+   return match_range(node->sorted, pattern, iter);
+}
+
+/**
+ * @brief Return the next line found by *ri_match_lines()*, or NULL if
+ *        there are no more.
+ */
+const ri_Line* ri_next_line(ri_Match_Iter *iter)
+{
+   return (const ri_Line*)match_next(iter);
+}
@@ -0,0 +1,110 @@
+#include <stdio.h>
+#include <string.h>  // for memset()
+#include <time.h>    // for clock_gettime()
+#include <sys/types.h>
+
+#include "readini.h"
+#include "readini_private.h"
+
+#ifdef RI_STATS
+
+ri_Stats ri_stats;
+ri_Trace_Hook trace_hook;
+void *trace_data;
+
+/** Start time of each phase in progress in this thread. */
+__thread uint64_t phase_started[RI_PHASE_COUNT];
+
+/** @brief Monotonic time in nanoseconds. */
+uint64_t stats_now(void)
+{
+   struct timespec ts;
+
+   clock_gettime(CLOCK_MONOTONIC, &ts);
+   return (uint64_t)ts.tv_sec * 1000000000u + ts.tv_nsec;
+}
+
+/**
+ * @brief Mark the beginning or end of a phase: time the parse
+ *        phase, and call the trace hook.
+ */
+void trace_phase(int phase, int end)
+{
+   ri_Trace_Hook hook = __atomic_load_n(&trace_hook, __ATOMIC_ACQUIRE);
+
+   if (!end)
+      phase_started[phase] = stats_now();
+   else if (phase == RI_PHASE_PARSE)
+      RI_STAT_ADD(parse_ns, stats_now() - phase_started[phase]);
+
+   if (hook)
+      (*hook)(phase, end, trace_data);
+}
+
+#endif
+
+/**
+ * @brief Copy the counters of the work done since the library was
+ *        loaded or *ri_reset_stats()* was called.
+ *
+ * Counters are summed over all threads.  The lines, sections and
+ * tags read by *ri_open()* and *ri_read_file()* are counted when
+ * their file is closed, and those of an **ri_Parser** when it
+ * finishes.  The average number of probes per lookup is
+ * *lookup_probes* / *lookups*.
+ *
+ * @return TRUE if the library was built with RI_STATS, otherwise
+ *         FALSE, with the counters set to 0.
+ */
+int ri_get_stats(ri_Stats *stats)
+{
+#ifdef RI_STATS
+   const uint64_t *counter = (const uint64_t*)&ri_stats;
+   uint64_t *copy = (uint64_t*)stats;
+   size_t index;
+
+   for (index = 0; index < sizeof(ri_Stats) / sizeof(uint64_t); ++index)
+      copy[index] = __atomic_load_n(&counter[index], __ATOMIC_RELAXED);
+
+   return 1;
+#else
+   memset(stats, 0, sizeof(ri_Stats));
+   return 0;
+#endif
+}
+
+/** @brief Set all counters to 0. */
+void ri_reset_stats(void)
+{
+#ifdef RI_STATS
+   uint64_t *counter = (uint64_t*)&ri_stats;
+   size_t index;
+
+   for (index = 0; index < sizeof(ri_Stats) / sizeof(uint64_t); ++index)
+      __atomic_store_n(&counter[index], 0, __ATOMIC_RELAXED);
+#endif
+}
+
+/**
+ * @brief Set a function to call as each phase of a load begins and
+ *        ends, in the thread doing the load, for tracing tools.
+ *
+ * The hook is called with an RI_PHASE_ constant, FALSE at the
+ * beginning of the phase and TRUE at its end, and *data*.  Set it
+ * before loading in other threads, or NULL to remove it.
+ *
+ * @return TRUE if the library was built with RI_STATS, otherwise
+ *         FALSE, and the hook is never called.
+ */
+int ri_set_trace_hook(ri_Trace_Hook hook, void *data)
+{
+#ifdef RI_STATS
+   trace_data = data;
+   __atomic_store_n(&trace_hook, hook, __ATOMIC_RELEASE);
+   return 1;
+#else
+   (void)hook;
+   (void)data;
+   return 0;
+#endif
+}
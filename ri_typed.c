@@ -0,0 +1,424 @@
+#include <stdio.h>
+#include <stdlib.h>  // for strtoll(), strtoull(), strtod()
+#include <string.h>  // for strchr()
+#include <strings.h> // for strcasecmp()
+#include <ctype.h>   // for toupper()
+#include <errno.h>
+#include <math.h>    // for HUGE_VAL
+#include <sys/types.h>
+
+#include "readini.h"
+#include "readini_private.h"
+
+/**
+ * @brief Return the converted value of a line, converting it the
+ *        first time.
+ *
+ * The first conversion of a line is saved on the line, in
+ * *converted*, with its type and result in *typed*, so a later
+ * conversion to the same type only reads them.  Lines are shared by
+ * the threads reading a document, so the first thread to claim
+ * *typed* saves its conversion and publishes it with a release
+ * store.  A line converted to another type, or by another thread
+ * at the same moment, is converted again without saving.
+ *
+ * @return RI_OK if *value* was set, otherwise the error of the conversion.
+ */
+int typed_value(const ri_Line *line, int type, ri_Typed_Value *value,
+                int (*convert)(const char *text, ri_Typed_Value *value))
+{
+   Line_Node *cached = LINE_NODE(line);
+   int typed, result, expected = 0;
+
+   if (!line || !line->value)
+      return RI_MISSING;
+
+   typed = __atomic_load_n(&cached->typed, __ATOMIC_ACQUIRE);
+   if ((typed & RI_TYPED_MASK) == type)
+   {
+      *value = cached->converted;
+      return typed >> RI_TYPED_RESULT_SHIFT;
+   }
+
+   result = (*convert)(line->value, value);
+
+   if (!typed && __atomic_compare_exchange_n(&cached->typed, &expected, RI_TYPED_BUSY, 0,
+                                             __ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+   {
+      cached->converted = *value;
+      __atomic_store_n(&cached->typed, type | result << RI_TYPED_RESULT_SHIFT, __ATOMIC_RELEASE);
+   }
+
+   return result;
+}
+
+/** @brief Number base of a value, 16 for a "0x" prefix, otherwise 10. */
+int number_base(const char *text)
+{
+   if (*text == '-' || *text == '+')
+      ++text;
+
+   return text[0] == '0' && (text[1] == 'x' || text[1] == 'X') ? 16 : 10;
+}
+
+int convert_int64(const char *text, ri_Typed_Value *value)
+{
+   char *end;
+
+   errno = 0;
+   value->i = strtoll(text, &end, number_base(text));
+
+   if (end == text || *end)
+      return RI_INVALID;
+
+   return errno == ERANGE ? RI_RANGE : RI_OK;
+}
+
+int convert_uint64(const char *text, ri_Typed_Value *value)
+{
+   char *end;
+   int result;
+
+   // *strtoull()* would negate a negative value, not reject it:
+   if (*text == '-')
+   {
+      result = convert_int64(text, value);
+      return result == RI_OK && value->i < 0 ? RI_RANGE : result;
+   }
+
+   errno = 0;
+   value->u = strtoull(text, &end, number_base(text));
+
+   if (end == text || *end)
+      return RI_INVALID;
+
+   return errno == ERANGE ? RI_RANGE : RI_OK;
+}
+
+int convert_double(const char *text, ri_Typed_Value *value)
+{
+   char *end;
+
+   errno = 0;
+   value->d = strtod(text, &end);
+
+   if (end == text || *end)
+      return RI_INVALID;
+
+   // Underflow also sets ERANGE, but leaves a usable value:
+   return errno == ERANGE && (value->d == HUGE_VAL || value->d == -HUGE_VAL) ? RI_RANGE : RI_OK;
+}
+
+int convert_bool(const char *text, ri_Typed_Value *value)
+{
+   static const char *trues[] = { "true", "yes", "on", "1", NULL };
+   static const char *falses[] = { "false", "no", "off", "0", NULL };
+   int index;
+
+   for (index = 0; trues[index]; ++index)
+   {
+      if (0 == strcasecmp(text, trues[index]))
+      {
+         value->i = 1;
+         return RI_OK;
+      }
+
+      if (0 == strcasecmp(text, falses[index]))
+      {
+         value->i = 0;
+         return RI_OK;
+      }
+   }
+
+   return RI_INVALID;
+}
+
+/**
+ * @brief Read a decimal number with an optional fraction.
+ *
+ * @return RI_OK and the whole and fractional parts, with *ptr*
+ *         following the number, or an error.
+ */
+int read_decimal(const char **ptr, uint64_t *whole, double *fraction)
+{
+   double scale = 0.1;
+   unsigned digit;
+   int digits = 0;
+
+   *whole = 0;
+   *fraction = 0;
+
+   for (; **ptr >= '0' && **ptr <= '9'; ++*ptr, ++digits)
+   {
+      digit = **ptr - '0';
+      if (*whole > (UINT64_MAX - digit) / 10)
+         return RI_RANGE;
+
+      *whole = *whole * 10 + digit;
+   }
+
+   if (**ptr == '.')
+      for (++*ptr; **ptr >= '0' && **ptr <= '9'; ++*ptr, ++digits, scale /= 10)
+         *fraction += (**ptr - '0') * scale;
+
+   return digits ? RI_OK : RI_INVALID;
+}
+
+/**
+ * @brief Add *whole* and *fraction* of *unit* to a total.
+ *
+ * @return RI_OK, or RI_RANGE if the total would overflow.
+ */
+int add_units(uint64_t *total, uint64_t whole, double fraction, uint64_t unit)
+{
+   uint64_t part;
+
+   if (whole > UINT64_MAX / unit)
+      return RI_RANGE;
+
+   part = whole * unit + (uint64_t)(fraction * unit);
+   if (part < whole * unit || part > UINT64_MAX - *total)
+      return RI_RANGE;
+
+   *total += part;
+   return RI_OK;
+}
+
+/**
+ * @brief Read a duration unit, returning nanoseconds per unit, or 0
+ *        if there is no unit at *ptr*.
+ */
+uint64_t duration_unit(const char **ptr)
+{
+   static const struct { const char *name; uint64_t ns; } units[] = {
+      { "ns", 1ULL },
+      { "us", 1000ULL },
+      { "\xc2\xb5s", 1000ULL },   // "µs" in UTF-8
+      { "ms", 1000000ULL },
+      { "s",  1000000000ULL },
+      { "m",  60000000000ULL },
+      { "h",  3600000000000ULL },
+      { "d",  86400000000000ULL },
+      { NULL, 0 }
+   };
+   size_t len;
+   int index;
+
+   // Two-character units come first, so "ms" isn't taken for "m":
+   for (index = 0; units[index].name; ++index)
+   {
+      len = strlen(units[index].name);
+      if (0 == strncmp(*ptr, units[index].name, len))
+      {
+         *ptr += len;
+         return units[index].ns;
+      }
+   }
+
+   return 0;
+}
+
+/**
+ * @brief Convert a duration like "250ms", "1.5s" or "1h 30m" to
+ *        nanoseconds.  A single number without a unit is in seconds;
+ *        a number without a unit after others is invalid.
+ */
+int convert_duration(const char *text, ri_Typed_Value *value)
+{
+   const char *ptr = text;
+   uint64_t total = 0, whole, unit;
+   double fraction;
+   int negative = 0, result;
+
+   if (*ptr == '-' || *ptr == '+')
+      negative = *ptr++ == '-';
+
+   if ((result = read_decimal(&ptr, &whole, &fraction)) != RI_OK)
+      return result;
+
+   // A number alone is in seconds, but each of several needs a unit:
+   if (!*ptr)
+      result = add_units(&total, whole, fraction, 1000000000ULL);
+
+   while (*ptr && result == RI_OK)
+   {
+      while (*ptr == ' ' || *ptr == '\t')
+         ++ptr;
+
+      if (!(unit = duration_unit(&ptr)))
+         return RI_INVALID;
+
+      result = add_units(&total, whole, fraction, unit);
+
+      while (*ptr == ' ' || *ptr == '\t')
+         ++ptr;
+
+      if (*ptr && result == RI_OK)
+      {
+         result = read_decimal(&ptr, &whole, &fraction);
+
+         // so "1m 30" or "1s5" isn't taken for "1m" or "1s":
+         if (result == RI_OK && !*ptr)
+            return RI_INVALID;
+      }
+   }
+
+   if (result != RI_OK)
+      return result;
+
+   if (total > (uint64_t)INT64_MAX + negative)
+      return RI_RANGE;
+
+   value->i = negative ? (int64_t)(0 - total) : (int64_t)total;
+   return RI_OK;
+}
+
+/**
+ * @brief Convert a size like "64MiB", "1.5GB" or "512K" to bytes.
+ *
+ * Units are case-insensitive.  "KiB", "MiB" and so on to "EiB", and
+ * the single letters "K" to "E", are powers of 1024; "KB" to "EB"
+ * are powers of 1000.  A number without a unit, or with "B", is in
+ * bytes.
+ */
+int convert_bytes(const char *text, ri_Typed_Value *value)
+{
+   static const char prefixes[] = "KMGTPE";
+   const char *ptr = text, *prefix;
+   uint64_t whole, unit = 1, base = 1024;
+   double fraction;
+   int power, result;
+
+   if (*ptr == '+')
+      ++ptr;
+
+   if ((result = read_decimal(&ptr, &whole, &fraction)) != RI_OK)
+      return result;
+
+   while (*ptr == ' ')
+      ++ptr;
+
+   if (*ptr && (prefix = strchr(prefixes, toupper((unsigned char)*ptr))))
+   {
+      ++ptr;
+      if ((ptr[0] == 'i' || ptr[0] == 'I') && (ptr[1] == 'B' || ptr[1] == 'b'))
+         ptr += 2;
+      else if (*ptr == 'B' || *ptr == 'b')
+      {
+         base = 1000;
+         ++ptr;
+      }
+
+      for (power = prefix - prefixes + 1; power > 0; --power)
+         unit *= base;
+   }
+   else if (*ptr == 'B' || *ptr == 'b')
+      ++ptr;
+
+   if (*ptr)
+      return RI_INVALID;
+
+   value->u = 0;
+   return add_units(&value->u, whole, fraction, unit);
+}
+
+/**
+ * @brief Convert the value of a line to a signed integer.
+ *
+ * The value is decimal, or hexadecimal with a "0x" prefix.  This and
+ * the other typed conversions accept the line found by
+ * *ri_find_line()* or *ri_find_section_line()*, including NULL, and
+ * save the result on the line, so converting the same line again
+ * costs only a read.
+ *
+ * @return RI_OK and sets *result*, or RI_MISSING if there is no line
+ *         or it has no value, RI_INVALID if the value isn't a number,
+ *         or RI_RANGE if it doesn't fit.
+ */
+int ri_line_int64(const ri_Line *line, int64_t *result)
+{
+   ri_Typed_Value value;
+   int status = typed_value(line, RI_TYPE_INT64, &value, convert_int64);
+
+   if (status == RI_OK)
+      *result = value.i;
+
+   return status;
+}
+
+/** @brief Convert the value of a line to an unsigned integer, as *ri_line_int64()*. */
+int ri_line_uint64(const ri_Line *line, uint64_t *result)
+{
+   ri_Typed_Value value;
+   int status = typed_value(line, RI_TYPE_UINT64, &value, convert_uint64);
+
+   if (status == RI_OK)
+      *result = value.u;
+
+   return status;
+}
+
+/** @brief Convert the value of a line to a floating-point number. */
+int ri_line_double(const ri_Line *line, double *result)
+{
+   ri_Typed_Value value;
+   int status = typed_value(line, RI_TYPE_DOUBLE, &value, convert_double);
+
+   if (status == RI_OK)
+      *result = value.d;
+
+   return status;
+}
+
+/**
+ * @brief Convert the value of a line to TRUE or FALSE.
+ *
+ * "true", "yes", "on" and "1" are TRUE, and "false", "no", "off" and
+ * "0" are FALSE, in any case.  A tag without a value is RI_MISSING.
+ */
+int ri_line_bool(const ri_Line *line, int *result)
+{
+   ri_Typed_Value value;
+   int status = typed_value(line, RI_TYPE_BOOL, &value, convert_bool);
+
+   if (status == RI_OK)
+      *result = (int)value.i;
+
+   return status;
+}
+
+/**
+ * @brief Convert the value of a line to a duration in nanoseconds.
+ *
+ * The value is a number without a unit, in seconds, or a sequence
+ * of numbers with units, like "1h 30m" or "1.5s".  The units are
+ * "ns", "us" (or "µs"), "ms", "s", "m", "h" and "d".
+ */
+int ri_line_duration(const ri_Line *line, int64_t *nanoseconds)
+{
+   ri_Typed_Value value;
+   int status = typed_value(line, RI_TYPE_DURATION, &value, convert_duration);
+
+   if (status == RI_OK)
+      *nanoseconds = value.i;
+
+   return status;
+}
+
+/**
+ * @brief Convert the value of a line to a number of bytes.
+ *
+ * The value is a number with an optional unit: "KiB" to "EiB", or
+ * "K" to "E", for powers of 1024, and "KB" to "EB" for powers of
+ * 1000.  A fraction of a unit, like "1.5GiB", is rounded down.
+ */
+int ri_line_bytes(const ri_Line *line, uint64_t *bytes)
+{
+   ri_Typed_Value value;
+   int status = typed_value(line, RI_TYPE_BYTES, &value, convert_bytes);
+
+   if (status == RI_OK)
+      *bytes = value.u;
+
+   return status;
+}
@@ -0,0 +1,337 @@
+#define _GNU_SOURCE   // for pipe2()
+#include <stdio.h>
+#include <stdlib.h>  // for malloc(), free()
+#include <string.h>  // for strdup(), strrchr()
+#include <unistd.h>  // for pipe(), read(), close()
+#include <fcntl.h>   // for O_CLOEXEC
+#include <errno.h>
+#include <poll.h>
+#include <sched.h>   // for sched_yield()
+#include <pthread.h>
+#include <stdatomic.h>
+#include <sys/types.h>
+#include <sys/inotify.h>
+
+#include "readini.h"
+#include "readini_private.h"
+
+/**
+ * Reader count for one parity, padded to its own cache line so
+ * the two counters don't share a line.
+ */
+struct reader_count
+{
+   atomic_long count;
+   char pad[64 - sizeof(atomic_long)];
+};
+
+/**
+ * Contents of the opaque **ri_Watcher**.
+ *
+ * Readers announce themselves by incrementing the reader count of
+ * the current parity before loading *current*, and decrement the
+ * same count when done.  A reload swaps *current*, then flips the
+ * parity and waits for the count of the old parity to drain, twice,
+ * after which no reader can hold the old document and it is freed.
+ */
+struct ri_watcher
+{
+   char *path;
+   const char *name;          // file name within directory, in *path*
+   int flags;
+   Interner *interner;        // names shared by the loads, with RI_INTERN
+
+   _Atomic(ri_Document*) current;
+   atomic_ulong generation;
+   atomic_int parity;
+   struct reader_count readers[2];
+
+   pthread_mutex_t reload_lock;
+   pthread_t thread;
+   int thread_running;
+   int notify_fd;
+   int stop_pipe[2];
+};
+
+/**
+ * @brief Wait until no reader can still be using a replaced document.
+ *
+ * Two flips of the parity are needed: a reader that read the parity
+ * just before the first flip may increment the old count after it
+ * was seen to be zero, but it then finds the new document, and is
+ * waited for by a later grace period.
+ */
+void wait_for_readers(ri_Watcher *watcher)
+{
+   int phase, parity;
+
+   for (phase = 0; phase < 2; ++phase)
+   {
+      parity = atomic_load(&watcher->parity);
+      atomic_store(&watcher->parity, !parity);
+
+      while (atomic_load(&watcher->readers[parity].count))
+         sched_yield();
+   }
+}
+
+/**
+ * @brief Reload the watched file now, and publish the new document.
+ *
+ * Readers are never blocked: they continue with the old document
+ * until they release it, and the old document is freed when all of
+ * them have.  If the file can't be loaded, the old document stays
+ * in place.
+ *
+ * @return TRUE if a new document was published.
+ */
+int ri_watch_reload(ri_Watcher *watcher)
+{
+   ri_Document *doc, *old;
+
+   pthread_mutex_lock(&watcher->reload_lock);
+
+   doc = load_file(watcher->path, watcher->flags, 1, watcher->interner);
+   if (doc)
+   {
+      old = atomic_exchange(&watcher->current, doc);
+      atomic_fetch_add(&watcher->generation, 1);
+
+      wait_for_readers(watcher);
+      ri_free(old);
+   }
+
+   pthread_mutex_unlock(&watcher->reload_lock);
+
+   return doc != NULL;
+}
+
+/**
+ * @brief Background thread that reloads the file when it changes.
+ *
+ * The directory is watched rather than the file, so that editors
+ * and deployment tools that replace the file by renaming another
+ * over it are noticed.
+ */
+void *watch_thread(void *arg)
+{
+   ri_Watcher *watcher = (ri_Watcher*)arg;
+   char buffer[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+   struct pollfd fds[2];
+   const struct inotify_event *event;
+   ssize_t len;
+   char *ptr;
+   int changed;
+
+   fds[0].fd = watcher->notify_fd;
+   fds[0].events = POLLIN;
+   fds[1].fd = watcher->stop_pipe[0];
+   fds[1].events = POLLIN;
+
+   while (1)
+   {
+      if (poll(fds, 2, -1) == -1)
+      {
+         if (errno == EINTR)
+            continue;
+         break;
+      }
+
+      if (fds[1].revents)
+         break;
+
+      if (!(fds[0].revents & POLLIN))
+         continue;
+
+      len = read(watcher->notify_fd, buffer, sizeof(buffer));
+      if (len <= 0)
+         continue;
+
+      changed = 0;
+      for (ptr = buffer; ptr < buffer + len; ptr += sizeof(struct inotify_event) + event->len)
+      {
+         event = (const struct inotify_event*)ptr;
+         if (event->len && 0 == strcmp(event->name, watcher->name))
+            changed = 1;
+      }
+
+      if (changed)
+         ri_watch_reload(watcher);
+   }
+
+   return NULL;
+}
+
+/**
+ * @brief Start watching a directory for changes to the file.
+ *
+ * @return TRUE if the background thread was started.
+ */
+int start_watch_thread(ri_Watcher *watcher)
+{
+   char *dir = strdup(watcher->path);
+   char *slash;
+   int wd = -1;
+
+   if (!dir)
+      return 0;
+
+   slash = strrchr(dir, '/');
+   if (slash == dir)
+      dir[1] = '\0';
+   else if (slash)
+      *slash = '\0';
+   else
+      strcpy(dir, ".");
+
+   watcher->notify_fd = inotify_init1(IN_CLOEXEC);
+   if (watcher->notify_fd != -1)
+      wd = inotify_add_watch(watcher->notify_fd, dir, IN_CLOSE_WRITE | IN_MOVED_TO);
+
+   free(dir);
+
+   if (wd == -1 || pipe2(watcher->stop_pipe, O_CLOEXEC) == -1)
+      return 0;
+
+   watcher->thread_running =
+      0 == pthread_create(&watcher->thread, NULL, watch_thread, watcher);
+
+   return watcher->thread_running;
+}
+
+/**
+ * @brief Load a file and keep it loaded as it changes.
+ *
+ * A background thread reloads the file with *ri_load()* whenever it
+ * is rewritten or replaced, and publishes the new document.  Any
+ * number of threads can read the current document through
+ * *ri_watch_acquire()* or *ri_watch_use()* without locking.
+ *
+ * With RI_INTERN, all the loads intern their names together, so a
+ * name has the same copy in every reload.  Names are kept until the
+ * watcher is stopped, even if they are removed from the file.
+ *
+ * @param filepath Path to the configuration file.
+ * @param flags    Flags passed to *ri_load()* for each load.
+ *
+ * @return Pointer to the watcher, or NULL if the file can't be loaded.
+ */
+ri_Watcher* ri_watch(const char *filepath, int flags)
+{
+   ri_Watcher *watcher = (ri_Watcher*)malloc(sizeof(ri_Watcher));
+   ri_Document *doc;
+   const char *slash;
+
+   if (!watcher)
+      return NULL;
+
+   memset(watcher, 0, sizeof(ri_Watcher));
+   watcher->notify_fd = watcher->stop_pipe[0] = watcher->stop_pipe[1] = -1;
+   watcher->flags = flags;
+   pthread_mutex_init(&watcher->reload_lock, NULL);
+
+   // Without an interner, each load interns its names on its own:
+   if (flags & RI_INTERN)
+      watcher->interner = interner_create();
+
+   if (!(watcher->path = strdup(filepath))
+       || !(doc = load_file(filepath, flags, 1, watcher->interner)))
+   {
+      interner_release(watcher->interner);
+      free(watcher->path);
+      free(watcher);
+      return NULL;
+   }
+
+   atomic_init(&watcher->current, doc);
+
+   slash = strrchr(watcher->path, '/');
+   watcher->name = slash ? slash + 1 : watcher->path;
+
+   if (!start_watch_thread(watcher))
+      fprintf(stderr, "Failed to watch \"%s\" for changes.", filepath);
+
+   return watcher;
+}
+
+/**
+ * @brief Stop watching and free the current document.
+ *
+ * No thread may be using a document from the watcher when it
+ * is stopped.
+ */
+void ri_unwatch(ri_Watcher *watcher)
+{
+   if (!watcher)
+      return;
+
+   if (watcher->thread_running)
+   {
+      while (write(watcher->stop_pipe[1], "", 1) == -1 && errno == EINTR)
+         ;
+      pthread_join(watcher->thread, NULL);
+   }
+
+   if (watcher->notify_fd != -1)
+      close(watcher->notify_fd);
+   if (watcher->stop_pipe[0] != -1)
+   {
+      close(watcher->stop_pipe[0]);
+      close(watcher->stop_pipe[1]);
+   }
+
+   ri_free(atomic_load(&watcher->current));
+   interner_release(watcher->interner);
+   pthread_mutex_destroy(&watcher->reload_lock);
+   free(watcher->path);
+   free(watcher);
+}
+
+/**
+ * @brief Get the current document for reading, without locking.
+ *
+ * The document remains valid until it is passed back with the same
+ * token to *ri_watch_release()*, even if a reload replaces it in the
+ * meantime.  A reload waits for its release to free it, so documents
+ * should be released promptly.
+ *
+ * @param watcher Watcher returned by *ri_watch()*.
+ * @param token   Set to a value to be passed to *ri_watch_release()*.
+ */
+const ri_Document* ri_watch_acquire(ri_Watcher *watcher, int *token)
+{
+   *token = atomic_load(&watcher->parity);
+   atomic_fetch_add(&watcher->readers[*token].count, 1);
+
+   return atomic_load(&watcher->current);
+}
+
+/** @brief Release a document obtained from *ri_watch_acquire()*. */
+void ri_watch_release(ri_Watcher *watcher, int token)
+{
+   atomic_fetch_sub(&watcher->readers[token].count, 1);
+}
+
+/**
+ * @brief Invoke a callback with the current document of a watcher.
+ *
+ * The document is acquired for the duration of the callback, in
+ * the same way *ri_open()* keeps a file open for its callback.
+ */
+void ri_watch_use(ri_Watcher *watcher, ri_Document_User cb_document_user, void *data)
+{
+   int token;
+   const ri_Document *doc = ri_watch_acquire(watcher, &token);
+
+   (*cb_document_user)(doc, data);
+
+   ri_watch_release(watcher, token);
+}
+
+/**
+ * @brief Returns the number of times the document has been reloaded.
+ */
+unsigned long ri_watch_generation(ri_Watcher *watcher)
+{
+   return atomic_load(&watcher->generation);
+}
@@ -0,0 +1,1017 @@
+// -*- compile-command: "make ribench" -*-
+
+/**
+ * Benchmark harness for the readini library.
+ *
+ * For each configuration file named on the command line, every load
+ * mode is run in a child process on a small, painted thread stack to
+ * measure parse throughput, system calls per load, peak resident set
+ * size and stack use.  Lookup rates are then measured against loaded
+ * documents, one at a time and batched, with and without an index
+ * and from a binary cache, parallel loads are timed with increasing
+ * numbers of threads, and the cost of hot reloads is measured against reader threads using
+ * a watched document.  Finally, lookups and section reads are made from many threads at
+ * once, and their results checked against single-threaded results.
+ *
+ * Results are appended to the output file as one JSON object per
+ * line, so runs of different versions can be compared.  A measurement
+ * whose child process fails, by a crash or by finding results that
+ * differ, is recorded as failed, and makes the harness exit with a
+ * failure status once every file is measured.
+ *
+ * The harness is linked with the library sources and with --wrap
+ * options for the file system calls, so that the calls made by the
+ * library can be counted.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <sys/resource.h>
+
+#include "readini.h"
+#include "readini_private.h"
+
+#define BENCH_STACK (256 * 1024)
+#define STACK_PAINT 0xA5
+#define LOOKUP_SECONDS 0.25
+#define LOOKUP_PAIRS 10000
+#define WATCH_READERS 4
+#define WATCH_RELOADS 5
+#define STRESS_THREADS 32
+#define STRESS_SECTION_READS 4
+
+/** ********************************************
+ * System call counting through linker wrappers *
+ **********************************************/
+
+long syscall_count = 0;
+
+// Measurements whose child process failed, for the exit status:
+int failed_count = 0;
+
+#define COUNT_CALL() __atomic_fetch_add(&syscall_count, 1, __ATOMIC_RELAXED)
+
+ssize_t __real_read(int fd, void *buf, size_t count);
+ssize_t __wrap_read(int fd, void *buf, size_t count)
+{
+   COUNT_CALL();
+   return __real_read(fd, buf, count);
+}
+
+ssize_t __real_pread(int fd, void *buf, size_t count, off_t offset);
+ssize_t __wrap_pread(int fd, void *buf, size_t count, off_t offset)
+{
+   COUNT_CALL();
+   return __real_pread(fd, buf, count, offset);
+}
+
+off_t __real_lseek(int fd, off_t offset, int whence);
+off_t __wrap_lseek(int fd, off_t offset, int whence)
+{
+   COUNT_CALL();
+   return __real_lseek(fd, offset, whence);
+}
+
+int __real_open(const char *path, int flags, ...);
+int __wrap_open(const char *path, int flags, ...)
+{
+   va_list args;
+   mode_t mode;
+
+   va_start(args, flags);
+   mode = va_arg(args, mode_t);
+   va_end(args);
+
+   COUNT_CALL();
+   return __real_open(path, flags, mode);
+}
+
+int __real_close(int fd);
+int __wrap_close(int fd)
+{
+   COUNT_CALL();
+   return __real_close(fd);
+}
+
+int __real_fstat(int fd, struct stat *st);
+int __wrap_fstat(int fd, struct stat *st)
+{
+   COUNT_CALL();
+   return __real_fstat(fd, st);
+}
+
+void *__real_mmap(void *addr, size_t len, int prot, int flags, int fd, off_t offset);
+void *__wrap_mmap(void *addr, size_t len, int prot, int flags, int fd, off_t offset)
+{
+   COUNT_CALL();
+   return __real_mmap(addr, len, prot, flags, fd, offset);
+}
+
+int __real_munmap(void *addr, size_t len);
+int __wrap_munmap(void *addr, size_t len)
+{
+   COUNT_CALL();
+   return __real_munmap(addr, len);
+}
+
+/** ***********
+ * Utilities  *
+ *************/
+
+double now(void)
+{
+   struct timespec ts;
+   clock_gettime(CLOCK_MONOTONIC, &ts);
+   return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+long peak_rss_kb(void)
+{
+   struct rusage usage;
+   getrusage(RUSAGE_SELF, &usage);
+   return usage.ru_maxrss;
+}
+
+/**
+ * @brief Run a function on a thread whose stack is painted beforehand,
+ *        returning the number of stack bytes the thread touched, or
+ *        -1 if the thread couldn't be started.
+ *
+ * A guard page below the stack turns an overflow into a crash of
+ * the child process instead of a silent corruption.
+ */
+long run_on_painted_stack(void *(*func)(void*), void *arg)
+{
+   size_t page = sysconf(_SC_PAGESIZE);
+   pthread_attr_t attr;
+   pthread_t thread;
+   char *base, *stack;
+   size_t offset;
+   int started;
+
+   base = (char*)mmap(NULL, BENCH_STACK + page, PROT_READ|PROT_WRITE,
+                      MAP_PRIVATE|MAP_ANONYMOUS, -1, 0);
+   if (base == MAP_FAILED)
+      return -1;
+
+   mprotect(base, page, PROT_NONE);
+   stack = base + page;
+   memset(stack, STACK_PAINT, BENCH_STACK);
+
+   pthread_attr_init(&attr);
+   pthread_attr_setstack(&attr, stack, BENCH_STACK);
+   started = 0 == pthread_create(&thread, &attr, func, arg);
+   if (started)
+      pthread_join(thread, NULL);
+   pthread_attr_destroy(&attr);
+
+   if (!started)
+   {
+      munmap(base, BENCH_STACK + page);
+      return -1;
+   }
+
+   // The stack grows down, so find the lowest byte that was written:
+   for (offset = 0; offset < BENCH_STACK && (unsigned char)stack[offset] == STACK_PAINT; ++offset)
+      ;
+
+   munmap(base, BENCH_STACK + page);
+   return BENCH_STACK - offset;
+}
+
+/** *************
+ * Load modes   *
+ ***************/
+
+/** @brief Visit every line, so no mode is measured without being used. */
+long count_lines(const ri_Section *sections)
+{
+   const ri_Line *line;
+   long count = 0;
+
+   for (; sections; sections = sections->next)
+      for (line = sections->lines; line; line = line->next)
+         ++count;
+
+   return count;
+}
+
+void count_lines_cb(const ri_Section *sections, void *data)
+{
+   *(long*)data = count_lines(sections);
+}
+
+long load_read_file(const char *path)
+{
+   long count = 0;
+   ri_read_file(path, count_lines_cb, &count);
+   return count;
+}
+
+long load_read_file_mmap(const char *path)
+{
+   long count = 0;
+   ri_read_file_mmap(path, count_lines_cb, &count);
+   return count;
+}
+
+long load_document(const char *path, int flags)
+{
+   long count = -1;
+   ri_Document *doc = ri_load(path, flags);
+   if (doc)
+   {
+      count = count_lines(ri_document_sections(doc));
+      ri_free(doc);
+   }
+
+   return count;
+}
+
+long load_plain(const char *path) { return load_document(path, 0); }
+long load_mmap(const char *path)  { return load_document(path, RI_MMAP); }
+long load_index(const char *path) { return load_document(path, RI_INDEX); }
+
+int count_key_value(const char *tag, int len_tag, const char *value, int len_value, void *data)
+{
+   ++*(long*)data;
+   return 1;
+}
+
+long load_events(const char *path)
+{
+   static const ri_Events events = { NULL, count_key_value, NULL, NULL };
+   long count = 0;
+
+   return ri_parse_events(path, &events, &count) ? count : -1;
+}
+
+/** @brief Path of the cache file kept next to a benchmarked file. */
+const char *cache_path(const char *path)
+{
+   static char buffer[4096];
+   snprintf(buffer, sizeof(buffer), "%s.cache", path);
+   return buffer;
+}
+
+long load_cached(const char *path)
+{
+   long count = -1;
+   ri_Document *doc = ri_load_cached(path, cache_path(path), 0);
+   if (doc)
+   {
+      count = count_lines(ri_document_sections(doc));
+      ri_free(doc);
+   }
+
+   return count;
+}
+
+/** @brief Map a cache without making its sections, as for lookups only. */
+long open_cached(const char *path)
+{
+   long count = -1;
+   ri_Document *doc = ri_load_cached(path, cache_path(path), 0);
+   if (doc)
+   {
+      count = doc->cache ? (long)doc->cache->entry_count : count_lines(ri_document_sections(doc));
+      ri_free(doc);
+   }
+
+   return count;
+}
+
+struct load_mode
+{
+   const char *name;
+   long (*load)(const char *path);
+};
+
+const struct load_mode load_modes[] = {
+   { "read_file",      load_read_file },
+   { "read_file_mmap", load_read_file_mmap },
+   { "load",           load_plain },
+   { "load_mmap",      load_mmap },
+   { "load_index",     load_index },
+   { "parse_events",   load_events },
+   { "load_cached",    load_cached },
+   { "open_cached",    open_cached },
+   { NULL, NULL }
+};
+
+/** ************************
+ * Measurement and report  *
+ **************************/
+
+struct bench_context
+{
+   const char *label;
+   const char *path;
+   off_t bytes;
+   int reps;
+   int threads;       // most threads for parallel loads
+   FILE *out;
+};
+
+/** @brief Begin a JSON result line with fields common to all results. */
+void begin_result(const struct bench_context *ctx)
+{
+   fprintf(ctx->out,
+           "{\"label\":\"%s\",\"time\":%ld,\"kernel\":\"%s\",\"file\":\"%s\",\"bytes\":%ld",
+           ctx->label, (long)time(NULL), ri_scan.name, ctx->path, (long)ctx->bytes);
+}
+
+void end_result(const struct bench_context *ctx)
+{
+   fprintf(ctx->out, "}\n");
+   fflush(ctx->out);
+}
+
+struct load_run
+{
+   const struct bench_context *ctx;
+   const struct load_mode *mode;
+   double best;
+   double total;
+   long lines;
+   long syscalls;
+   ri_Stats stats;     // counters of the last load, if built with RI_STATS
+   int has_stats;
+};
+
+void *load_thread(void *arg)
+{
+   struct load_run *run = (struct load_run*)arg;
+   double start, elapsed;
+   long calls_before;
+   int rep;
+
+   run->best = 1e30;
+   for (rep = 0; rep < run->ctx->reps; ++rep)
+   {
+      ri_reset_stats();
+      calls_before = syscall_count;
+      start = now();
+      run->lines = (*run->mode->load)(run->ctx->path);
+      elapsed = now() - start;
+      run->has_stats = ri_get_stats(&run->stats);
+
+      run->syscalls = syscall_count - calls_before;
+      run->total += elapsed;
+      if (elapsed < run->best)
+         run->best = elapsed;
+   }
+
+   return NULL;
+}
+
+/** @brief Measure one load mode in the current (child) process. */
+void measure_load(const struct bench_context *ctx, const struct load_mode *mode)
+{
+   struct load_run run = { ctx, mode, 0, 0, 0, 0 };
+   long rss_before = peak_rss_kb();
+   long stack = run_on_painted_stack(load_thread, &run);
+   const ri_Stats *stats = &run.stats;
+
+   if (stack < 0)
+      exit(1);
+
+   begin_result(ctx);
+   fprintf(ctx->out,
+           ",\"mode\":\"%s\",\"lines\":%ld,\"best_s\":%.6f,\"mean_s\":%.6f"
+           ",\"mb_per_s\":%.2f,\"syscalls\":%ld,\"peak_rss_kb\":%ld"
+           ",\"rss_growth_kb\":%ld,\"stack_bytes\":%ld",
+           mode->name, run.lines, run.best, run.total / ctx->reps,
+           ctx->bytes / run.best / 1e6, run.syscalls, peak_rss_kb(),
+           peak_rss_kb() - rss_before, stack);
+
+   if (run.has_stats)
+      fprintf(ctx->out,
+              ",\"bytes_read\":%lu,\"read_calls\":%lu,\"bytes_mapped\":%lu"
+              ",\"comment_lines\":%lu,\"truncated_lines\":%lu,\"parse_s\":%.6f",
+              (unsigned long)stats->bytes_read, (unsigned long)stats->read_calls,
+              (unsigned long)stats->bytes_mapped, (unsigned long)stats->comment_lines,
+              (unsigned long)stats->truncated_lines, stats->parse_ns / 1e9);
+
+   end_result(ctx);
+}
+
+/**
+ * @brief Time parallel loads with 1, 2, 4... threads, up to the
+ *        number of CPUs or the -t option.
+ */
+void measure_parallel(const struct bench_context *ctx, const struct load_mode *mode)
+{
+   ri_Document *doc;
+   double start, elapsed, best, serial = 0;
+   long lines = 0;
+   int threads, rep, most = ctx->threads;
+
+   if (most <= 0)
+      most = (int)sysconf(_SC_NPROCESSORS_ONLN);
+
+   if (most < 1)
+      most = 1;
+
+   for (threads = 1; ; threads = threads * 2 < most ? threads * 2 : most)
+   {
+      best = 1e30;
+      for (rep = 0; rep < ctx->reps; ++rep)
+      {
+         start = now();
+         if (!(doc = ri_load_parallel(ctx->path, RI_MMAP, threads)))
+            exit(1);
+         lines = count_lines(ri_document_sections(doc));
+         ri_free(doc);
+         elapsed = now() - start;
+
+         if (elapsed < best)
+            best = elapsed;
+      }
+
+      if (threads == 1)
+         serial = best;
+
+      begin_result(ctx);
+      fprintf(ctx->out,
+              ",\"mode\":\"parallel\",\"threads\":%d,\"lines\":%ld,\"best_s\":%.6f"
+              ",\"mb_per_s\":%.2f,\"speedup\":%.2f",
+              threads, lines, best, ctx->bytes / best / 1e6, serial / best);
+      end_result(ctx);
+
+      if (threads == most)
+         break;
+   }
+}
+
+struct lookup_pair
+{
+   const ri_Section *section;
+   const char *tag;
+};
+
+/** @brief Pick random (section, tag) pairs that exist in a document. */
+int collect_pairs(const ri_Section *sections, struct lookup_pair *pairs, int count)
+{
+   const ri_Section *section;
+   const ri_Line *line;
+   long total = 0, seen = 0;
+   int filled = 0;
+
+   for (section = sections; section; section = section->next)
+      for (line = section->lines; line; line = line->next)
+         ++total;
+
+   if (!total)
+      return 0;
+
+   // Reservoir sampling keeps the pairs spread over the whole file:
+   for (section = sections; section; section = section->next)
+      for (line = section->lines; line; line = line->next, ++seen)
+      {
+         if (filled < count)
+            pairs[filled++] = (struct lookup_pair){ section, line->tag };
+         else if (random() % (seen + 1) < count)
+            pairs[random() % count] = (struct lookup_pair){ section, line->tag };
+      }
+
+   return filled;
+}
+
+/**
+ * @brief Measure lookups in a loaded document, one at a time and in
+ *        batches of 64, or with *ri_document_value()* in a document
+ *        loaded from its cache.
+ */
+void measure_lookups(const struct bench_context *ctx, int flags, int cached)
+{
+   static struct lookup_pair pairs[LOOKUP_PAIRS];
+   const char *values[64];
+   ri_Lookup lookups[64];
+   const ri_Section *sections;
+   ri_Document *doc;
+   double start, elapsed;
+   long done, missed;
+   int count, index, batch, lookup, kind;
+   static const char *kinds[] = { "find_section_value", "find_value", "find_batch",
+                                  "document_value" };
+
+   doc = cached ? ri_load_cached(ctx->path, cache_path(ctx->path), flags) : ri_load(ctx->path, flags);
+   if (!doc)
+      return;
+
+   sections = ri_document_sections(doc);
+   count = collect_pairs(sections, pairs, LOOKUP_PAIRS);
+
+   for (kind = cached ? 3 : 0; count && kind < (cached ? 4 : 3); ++kind)
+   {
+      done = missed = 0;
+      index = 0;
+      start = now();
+      do
+      {
+         // Check the time every 64 lookups, since unindexed lookups can be slow
+         for (batch = 0; batch < 64; ++batch)
+         {
+            if (kind == 2)
+            {
+               lookups[batch] = (ri_Lookup){ pairs[index].section->section_name,
+                                             pairs[index].tag, &values[batch] };
+               if (batch == 63 && ri_find_batch(sections, lookups, 64) >= 0)
+                  for (lookup = 0; lookup < 64; ++lookup)
+                     missed += !values[lookup];
+            }
+            else if (kind == 3)
+               missed += !ri_document_value(doc,
+                                            pairs[index].section->section_name,
+                                            pairs[index].tag);
+            else if (kind == 0)
+               missed += !ri_find_section_value(sections,
+                                                pairs[index].section->section_name,
+                                                pairs[index].tag);
+            else
+               missed += !ri_find_value(pairs[index].section->lines, pairs[index].tag);
+
+            if (++index == count)
+               index = 0;
+         }
+         done += 64;
+      }
+      while ((elapsed = now() - start) < LOOKUP_SECONDS);
+
+      begin_result(ctx);
+      fprintf(ctx->out,
+              ",\"lookup\":\"%s\",\"index\":%d,\"lookups_per_s\":%.0f,\"empty\":%ld",
+              kinds[kind], (flags & RI_INDEX) != 0, done / elapsed, missed);
+      end_result(ctx);
+   }
+
+   ri_free(doc);
+}
+
+/** @brief Copy a file, returning 0 on success. */
+int copy_file(const char *from, const char *to)
+{
+   char buffer[RI_BLOCK_SIZE];
+   int in, out;
+   ssize_t len = 0;
+
+   if ((in = open(from, O_RDONLY)) == -1)
+      return -1;
+
+   if ((out = open(to, O_WRONLY | O_CREAT | O_TRUNC, 0644)) != -1)
+   {
+      while ((len = read(in, buffer, sizeof(buffer))) > 0)
+         if (write(out, buffer, len) != len)
+         {
+            len = -1;
+            break;
+         }
+      close(out);
+   }
+
+   close(in);
+   return out == -1 || len < 0 ? -1 : 0;
+}
+
+struct watch_run
+{
+   ri_Watcher *watcher;
+   const char **names;     // section and tag, alternately
+   int count;
+   volatile int stop;
+   pthread_mutex_t lock;
+   long lookups;
+   double total;
+   double worst;
+};
+
+/** @brief Reader thread: timed lookups in the current watched document. */
+void *watch_reader(void *arg)
+{
+   struct watch_run *run = (struct watch_run*)arg;
+   const ri_Document *doc;
+   double start, elapsed, total = 0, worst = 0;
+   long lookups = 0;
+   int token, index = (int)(random() % run->count);
+
+   while (!run->stop)
+   {
+      start = now();
+      doc = ri_watch_acquire(run->watcher, &token);
+      ri_find_section_value(ri_document_sections(doc),
+                            run->names[2 * index], run->names[2 * index + 1]);
+      ri_watch_release(run->watcher, token);
+      elapsed = now() - start;
+
+      ++lookups;
+      total += elapsed;
+      if (elapsed > worst)
+         worst = elapsed;
+      if (++index == run->count)
+         index = 0;
+   }
+
+   pthread_mutex_lock(&run->lock);
+   run->lookups += lookups;
+   run->total += total;
+   if (worst > run->worst)
+      run->worst = worst;
+   pthread_mutex_unlock(&run->lock);
+
+   return NULL;
+}
+
+/**
+ * @brief Measure hot reloads of a copy of the file while reader
+ *        threads make lookups in the watched document.
+ *
+ * Reloads are first forced with *ri_watch_reload()*, then triggered
+ * by replacing the file, to include the notification delay.
+ */
+void measure_watch(const struct bench_context *ctx, const struct load_mode *mode)
+{
+   static struct lookup_pair pairs[LOOKUP_PAIRS];
+   static const char *names[2 * LOOKUP_PAIRS];
+   struct watch_run run = { NULL, names, 0, 0, PTHREAD_MUTEX_INITIALIZER, 0, 0, 0 };
+   pthread_t readers[WATCH_READERS];
+   char path[1024], temp[1024];
+   const ri_Document *doc;
+   double start, elapsed, reload_total = 0, reload_worst = 0, notify_total = 0;
+   unsigned long generation;
+   int token, index, notified = 0;
+
+   snprintf(path, sizeof(path), "%s.watch", ctx->path);
+   snprintf(temp, sizeof(temp), "%s.watch.tmp", ctx->path);
+
+   if (copy_file(ctx->path, path) || !(run.watcher = ri_watch(path, RI_INDEX)))
+      exit(1);
+
+   // Names are copied, since the document they come from is replaced:
+   doc = ri_watch_acquire(run.watcher, &token);
+   run.count = collect_pairs(ri_document_sections(doc), pairs, LOOKUP_PAIRS);
+   for (index = 0; index < run.count; ++index)
+   {
+      names[2 * index] = strdup(pairs[index].section->section_name);
+      names[2 * index + 1] = strdup(pairs[index].tag);
+   }
+   ri_watch_release(run.watcher, token);
+
+   if (!run.count)
+      exit(1);
+
+   for (index = 0; index < WATCH_READERS; ++index)
+      pthread_create(&readers[index], NULL, watch_reader, &run);
+
+   for (index = 0; index < WATCH_RELOADS; ++index)
+   {
+      start = now();
+      ri_watch_reload(run.watcher);
+      elapsed = now() - start;
+
+      reload_total += elapsed;
+      if (elapsed > reload_worst)
+         reload_worst = elapsed;
+   }
+
+   for (index = 0; index < WATCH_RELOADS; ++index)
+   {
+      generation = ri_watch_generation(run.watcher);
+      if (copy_file(ctx->path, temp))
+         break;
+
+      start = now();
+      rename(temp, path);
+      while (ri_watch_generation(run.watcher) == generation && now() - start < 5)
+         usleep(100);
+
+      if (ri_watch_generation(run.watcher) != generation)
+      {
+         notify_total += now() - start;
+         ++notified;
+      }
+   }
+
+   run.stop = 1;
+   for (index = 0; index < WATCH_READERS; ++index)
+      pthread_join(readers[index], NULL);
+
+   ri_unwatch(run.watcher);
+   unlink(path);
+   unlink(temp);
+
+   begin_result(ctx);
+   fprintf(ctx->out,
+           ",\"mode\":\"watch\",\"readers\":%d,\"reload_mean_s\":%.6f,\"reload_worst_s\":%.6f"
+           ",\"notify_mean_s\":%.6f,\"notified\":%d,\"reader_lookups\":%ld"
+           ",\"reader_mean_ns\":%.0f,\"reader_worst_ns\":%.0f",
+           WATCH_READERS, reload_total / WATCH_RELOADS, reload_worst,
+           notified ? notify_total / notified : 0, notified, run.lookups,
+           run.lookups ? run.total / run.lookups * 1e9 : 0, run.worst * 1e9);
+   end_result(ctx);
+}
+
+struct stress_run
+{
+   const ri_Section *sections;
+   const struct lookup_pair *pairs;
+   const char **expected;  // value of each pair, found by one thread
+   int count;
+   int fh;
+   int started;            // threads started, of STRESS_THREADS
+   long lookups;
+   long errors;
+};
+
+/** @brief Lookups from one of many threads sharing a document. */
+void *stress_lookups(void *arg)
+{
+   struct stress_run *run = (struct stress_run*)arg;
+   const struct lookup_pair *pair;
+   double start = now();
+   long lookups = 0, errors = 0;
+   int batch, index = (int)(random() % run->count);
+
+   do
+   {
+      for (batch = 0; batch < 64; ++batch)
+      {
+         pair = &run->pairs[index];
+         if (ri_find_section_value(run->sections, pair->section->section_name, pair->tag)
+             != run->expected[index])
+            ++errors;
+
+         if (++index == run->count)
+            index = 0;
+      }
+      lookups += 64;
+   }
+   while (now() - start < LOOKUP_SECONDS);
+
+   __atomic_fetch_add(&run->lookups, lookups, __ATOMIC_RELAXED);
+   __atomic_fetch_add(&run->errors, errors, __ATOMIC_RELAXED);
+   return NULL;
+}
+
+void count_section_lines(int fh, const ri_Line *lines, void *data)
+{
+   long *count = (long*)data;
+
+   for (*count = 0; lines; lines = lines->next)
+      ++*count;
+}
+
+/** @brief Section reads through a file descriptor shared by many threads. */
+void *stress_sections(void *arg)
+{
+   struct stress_run *run = (struct stress_run*)arg;
+   const ri_Section *section;
+   const ri_Line *line;
+   long expected, count, errors = 0;
+   int read;
+
+   for (read = 0; read < STRESS_SECTION_READS; ++read)
+   {
+      section = ri_get_section(run->sections,
+                               run->pairs[random() % run->count].section->section_name);
+      for (expected = 0, line = section->lines; line; line = line->next)
+         ++expected;
+
+      count = -1;
+      ri_open_section(run->fh, section->section_name, count_section_lines, &count);
+      if (count != expected)
+         ++errors;
+   }
+
+   __atomic_fetch_add(&run->errors, errors, __ATOMIC_RELAXED);
+   return NULL;
+}
+
+/**
+ * @brief Start STRESS_THREADS threads, stopping at the first that
+ *        can't be started.
+ *
+ * @return The number of threads started, which are to be joined.
+ */
+int start_stress_threads(pthread_t *threads, void *(*func)(void*), struct stress_run *run)
+{
+   int started = 0;
+
+   while (started < STRESS_THREADS && 0 == pthread_create(&threads[started], NULL, func, run))
+      ++started;
+
+   return started;
+}
+
+void join_stress_threads(pthread_t *threads, int started)
+{
+   while (started)
+      pthread_join(threads[--started], NULL);
+}
+
+void stress_file_user(int fh, void *data)
+{
+   struct stress_run *run = (struct stress_run*)data;
+   pthread_t threads[STRESS_THREADS];
+
+   run->fh = fh;
+   run->started = start_stress_threads(threads, stress_sections, run);
+   join_stress_threads(threads, run->started);
+}
+
+/**
+ * @brief Lookups in one document, and section reads through one
+ *        file descriptor, from many threads at once.
+ *
+ * Every result is checked against the result found by a single
+ * thread, and mismatches are reported as errors.
+ */
+void measure_threads(const struct bench_context *ctx, const struct load_mode *mode)
+{
+   static struct lookup_pair pairs[LOOKUP_PAIRS];
+   static const char *expected[LOOKUP_PAIRS];
+   struct stress_run run = { NULL, pairs, expected, 0, -1, 0, 0, 0 };
+   pthread_t threads[STRESS_THREADS];
+   ri_Document *doc;
+   double start, elapsed;
+   long lookup_errors;
+   int index, lookup_threads;
+
+   if (!(doc = ri_load(ctx->path, RI_INDEX)))
+      exit(1);
+
+   run.sections = ri_document_sections(doc);
+   if (!(run.count = collect_pairs(run.sections, pairs, LOOKUP_PAIRS)))
+      exit(1);
+
+   for (index = 0; index < run.count; ++index)
+      expected[index] = ri_find_section_value(run.sections,
+                                              pairs[index].section->section_name,
+                                              pairs[index].tag);
+
+   start = now();
+   lookup_threads = start_stress_threads(threads, stress_lookups, &run);
+   join_stress_threads(threads, lookup_threads);
+   elapsed = now() - start;
+
+   lookup_errors = run.errors;
+   run.errors = 0;
+   ri_open(ctx->path, stress_file_user, &run);
+
+   begin_result(ctx);
+   fprintf(ctx->out,
+           ",\"mode\":\"threads\",\"threads\":%d,\"lookups_per_s\":%.0f"
+           ",\"lookup_errors\":%ld,\"section_reads\":%d,\"section_errors\":%ld",
+           lookup_threads, run.lookups / elapsed, lookup_errors,
+           run.started * STRESS_SECTION_READS, run.errors);
+   end_result(ctx);
+
+   ri_free(doc);
+
+   // A thread that couldn't start, or a file that couldn't be opened,
+   // fails the measurement as a mismatch does:
+   if (lookup_errors || run.errors
+       || lookup_threads < STRESS_THREADS || run.started < STRESS_THREADS)
+      exit(1);
+}
+
+/** @brief Run a measurement in a child process, for a clean peak RSS. */
+void in_child(const struct bench_context *ctx,
+              void (*measure)(const struct bench_context*, const struct load_mode*),
+              const struct load_mode *mode)
+{
+   int status;
+   pid_t pid;
+
+   // A child that exits early must not write what the parent buffered:
+   fflush(stdout);
+   fflush(ctx->out);
+   if ((pid = fork()) == 0)
+   {
+      (*measure)(ctx, mode);
+      fflush(ctx->out);
+      _exit(0);
+   }
+
+   waitpid(pid, &status, 0);
+   if (!WIFEXITED(status) || WEXITSTATUS(status))
+   {
+      begin_result(ctx);
+      fprintf(ctx->out, ",\"mode\":\"%s\",\"failed\":true", mode ? mode->name : "lookup");
+      end_result(ctx);
+      ++failed_count;
+   }
+}
+
+void measure_lookups_plain(const struct bench_context *ctx, const struct load_mode *mode)
+{
+   measure_lookups(ctx, 0, 0);
+}
+
+void measure_lookups_indexed(const struct bench_context *ctx, const struct load_mode *mode)
+{
+   measure_lookups(ctx, RI_INDEX, 0);
+}
+
+void measure_lookups_cached(const struct bench_context *ctx, const struct load_mode *mode)
+{
+   measure_lookups(ctx, 0, 1);
+}
+
+void bench_file(struct bench_context *ctx)
+{
+   const struct load_mode *mode;
+   struct stat st;
+
+   if (stat(ctx->path, &st))
+   {
+      fprintf(stderr, "Failed to open \"%s\".\n", ctx->path);
+      return;
+   }
+
+   ctx->bytes = st.st_size;
+
+   // The cached modes measure loads from a current cache:
+   ri_compile(ctx->path, cache_path(ctx->path));
+
+   for (mode = load_modes; mode->name; ++mode)
+      in_child(ctx, measure_load, mode);
+
+   in_child(ctx, measure_parallel, NULL);
+   in_child(ctx, measure_lookups_plain, NULL);
+   in_child(ctx, measure_lookups_indexed, NULL);
+   in_child(ctx, measure_lookups_cached, NULL);
+   in_child(ctx, measure_watch, NULL);
+   in_child(ctx, measure_threads, NULL);
+
+   unlink(cache_path(ctx->path));
+}
+
+void show_usage(void)
+{
+   printf("Usage: ribench [options] file...\n"
+          "  -o path   append results to path (default bench_output.txt)\n"
+          "  -l label  version label recorded with each result\n"
+          "  -r reps   repetitions of each load (default 5)\n"
+          "  -t count  most threads for parallel loads (default CPU count)\n");
+}
+
+int main(int argc, char** argv)
+{
+   struct bench_context ctx = { "", NULL, 0, 5, 0, NULL };
+   const char *output = "bench_output.txt";
+   int opt;
+
+   while ((opt = getopt(argc, argv, "o:l:r:t:h")) != -1)
+   {
+      switch (opt)
+      {
+         case 'o': output = optarg; break;
+         case 'l': ctx.label = optarg; break;
+         case 'r': ctx.reps = atoi(optarg) > 0 ? atoi(optarg) : 1; break;
+         case 't': ctx.threads = atoi(optarg); break;
+         default:
+            show_usage();
+            return opt == 'h' ? 0 : 1;
+      }
+   }
+
+   if (optind >= argc)
+   {
+      show_usage();
+      return 1;
+   }
+
+   if (!(ctx.out = fopen(output, "a")))
+   {
+      fprintf(stderr, "Failed to open \"%s\".\n", output);
+      return 1;
+   }
+
+   for (; optind < argc; ++optind)
+   {
+      ctx.path = argv[optind];
+      printf("Benchmarking %s\n", ctx.path);
+      bench_file(&ctx);
+   }
+
+   fclose(ctx.out);
+   printf("Results appended to %s\n", output);
+
+   if (failed_count)
+   {
+      fprintf(stderr, "%d measurements failed.\n", failed_count);
+      return 1;
+   }
+
+   return 0;
+}
@@ -0,0 +1,2287 @@
+// -*- compile-command: "make check" -*-
+
+/**
+ * Checks of the readini library.
+ *
+ * Each check writes the files it needs to a temporary directory,
+ * reads them with the library and compares the results with the
+ * results expected.  A failed comparison is reported with its line,
+ * and the program exits with a failure status if any check failed,
+ * so that "make check" fails.
+ *
+ * The checks are linked with the library sources, like ribench, so
+ * that they test the tree rather than an installed library.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "readini.h"
+#include "readini_private.h"
+
+#define CHECK_STACK (64 * 1024)
+#define DEEP_SECTIONS 100000
+#define MAX_PATHS 256
+
+/** *****************
+ * Reporting        *
+ *******************/
+
+int failures = 0;
+
+#define CHECK(cond) check_that((cond), #cond, __LINE__)
+
+/** @brief Report a condition that is false, and count it as a failure. */
+int check_that(int ok, const char *text, int line)
+{
+   if (!ok)
+   {
+      fprintf(stderr, "richeck.c:%d: check failed: %s\n", line, text);
+      ++failures;
+   }
+
+   return ok;
+}
+
+/** @brief Compare two strings, either of which may be NULL. */
+int same(const char *str, const char *expected)
+{
+   if (!str || !expected)
+      return str == expected;
+
+   return 0 == strcmp(str, expected);
+}
+
+/** @brief Check that two lists of lines have the same tags and values. */
+void check_same_lines(const ri_Line *lines, const ri_Line *expected)
+{
+   for (; lines && expected; lines = lines->next, expected = expected->next)
+      CHECK(same(lines->tag, expected->tag) && same(lines->value, expected->value));
+
+   CHECK(!lines && !expected);
+}
+
+/** @brief Check that the entries of a section give its lines, in order. */
+void check_entries(const ri_Section *section)
+{
+   ri_Entry_Iter iter;
+   const ri_Line *line;
+   const char *tag, *value;
+   int has_entries = ri_entries(section, &iter);
+
+   // Only a section without lines has no entries:
+   line = section->lines;
+   if (!CHECK(has_entries == (line != NULL)) || !has_entries)
+      return;
+
+   for (; ri_entry_next(&iter, &tag, &value); line = line->next)
+      if (!CHECK(line && same(tag, line->tag) && same(value, line->value)))
+         return;
+
+   CHECK(line == NULL);
+}
+
+/** @brief Check that two lists of sections have the same names and lines. */
+void check_same_sections(const ri_Section *sections, const ri_Section *expected)
+{
+   for (; sections && expected; sections = sections->next, expected = expected->next)
+   {
+      if (!CHECK(same(sections->section_name, expected->section_name)))
+         return;
+      check_same_lines(sections->lines, expected->lines);
+      check_entries(sections);
+   }
+
+   CHECK(!sections && !expected);
+}
+
+/** *****************
+ * Check files      *
+ *******************/
+
+char check_dir[] = "/tmp/richeck-XXXXXX";
+char *paths[MAX_PATHS];
+int path_count = 0;
+
+/** @brief Return the path of a name in the check directory, kept for cleanup. */
+const char *check_path(const char *name)
+{
+   char *path;
+
+   if (path_count == MAX_PATHS)
+   {
+      fprintf(stderr, "Too many check files.\n");
+      exit(1);
+   }
+
+   if (!(path = (char*)malloc(strlen(check_dir) + strlen(name) + 2)))
+      exit(1);
+
+   sprintf(path, "%s/%s", check_dir, name);
+   paths[path_count++] = path;
+   return path;
+}
+
+/** @brief Write a file of the check directory, returning its path. */
+const char *write_file(const char *name, const char *text)
+{
+   const char *path = check_path(name);
+   FILE *file;
+
+   if (!(file = fopen(path, "w")))
+   {
+      fprintf(stderr, "Failed to open \"%s\".\n", path);
+      exit(1);
+   }
+
+   fputs(text, file);
+   fclose(file);
+   return path;
+}
+
+/** @brief Remove the check files, newest first, and then the directory. */
+void remove_files(void)
+{
+   while (path_count)
+   {
+      remove(paths[--path_count]);
+      free(paths[path_count]);
+   }
+
+   rmdir(check_dir);
+}
+
+/**
+ * @brief Run a function on a thread with a small stack.
+ *
+ * A guard page below the stack turns an overflow into a crash of
+ * the check, instead of a silent corruption.
+ *
+ * @return TRUE if the thread ran, FALSE if it couldn't be started.
+ */
+int run_on_small_stack(void *(*func)(void*), void *arg)
+{
+   size_t page = sysconf(_SC_PAGESIZE);
+   pthread_attr_t attr;
+   pthread_t thread;
+   char *base;
+   int started;
+
+   base = (char*)mmap(NULL, CHECK_STACK + page, PROT_READ|PROT_WRITE,
+                      MAP_PRIVATE|MAP_ANONYMOUS, -1, 0);
+   if (base == MAP_FAILED)
+      return 0;
+
+   mprotect(base, page, PROT_NONE);
+
+   pthread_attr_init(&attr);
+   pthread_attr_setstack(&attr, base + page, CHECK_STACK);
+   started = 0 == pthread_create(&thread, &attr, func, arg);
+   if (started)
+      pthread_join(thread, NULL);
+   pthread_attr_destroy(&attr);
+
+   munmap(base, CHECK_STACK + page);
+   return started;
+}
+
+/** *****************
+ * Round trips      *
+ *******************/
+
+#define TRIP_SECTIONS 3000
+#define TRIP_VALUE_MAX 181
+
+/** @brief Make the value of the name line of a section, of a length varying by section. */
+void trip_value(int index, char *value)
+{
+   int len = 1 + index * 37 % TRIP_VALUE_MAX;
+
+   memset(value, 'a' + index % 26, len);
+   value[len] = '\0';
+}
+
+/**
+ * @brief Return the path of a file of many sections, written on
+ *        the first call, whose lines cross the blocks it is read in.
+ */
+const char *trip_path(void)
+{
+   static const char *path = NULL;
+   char value[TRIP_VALUE_MAX + 1];
+   FILE *file;
+   int index;
+
+   if (path)
+      return path;
+
+   path = check_path("trip.ini");
+   if (!(file = fopen(path, "w")))
+   {
+      fprintf(stderr, "Failed to open \"%s\".\n", path);
+      exit(1);
+   }
+
+   fputs("before : no section\n", file);
+   for (index = 0; index < TRIP_SECTIONS; ++index)
+   {
+      trip_value(index, value);
+      fprintf(file, "[trip-%d]\nname-%d = %s\n# comment line %d\n", index, index, value, index);
+      fprintf(file, "   spaced-%d :   %d  \nhash-%d = a\\#%d # comment\n", index, index, index, index);
+   }
+
+   fclose(file);
+   return path;
+}
+
+/** @brief Check the lines of a section of the round-trip file. */
+void check_trip_lines(const ri_Line *line, int index)
+{
+   char tag[32], value[TRIP_VALUE_MAX + 1];
+
+   sprintf(tag, "name-%d", index);
+   trip_value(index, value);
+   if (!CHECK(line && same(line->tag, tag) && same(line->value, value)))
+      return;
+
+   line = line->next;
+   sprintf(tag, "spaced-%d", index);
+   sprintf(value, "%d", index);
+   if (!CHECK(line && same(line->tag, tag) && same(line->value, value)))
+      return;
+
+   line = line->next;
+   sprintf(tag, "hash-%d", index);
+   sprintf(value, "a#%d", index);
+   if (!CHECK(line && same(line->tag, tag) && same(line->value, value)))
+      return;
+
+   CHECK(line->next == NULL);
+}
+
+/** @brief Check the sections of the round-trip file. */
+void check_trip_sections(const ri_Section *sections, void *data)
+{
+   char name[32];
+   int index;
+
+   for (index = 0; index < TRIP_SECTIONS && sections; ++index, sections = sections->next)
+   {
+      sprintf(name, "trip-%d", index);
+      if (!CHECK(same(sections->section_name, name)))
+         return;
+      check_trip_lines(sections->lines, index);
+   }
+
+   CHECK(index == TRIP_SECTIONS && !sections);
+   if (data)
+      ++*(int*)data;
+}
+
+void use_trip_section(int fh, const ri_Line *lines, void *data)
+{
+   check_trip_lines(lines, *(int*)data);
+}
+
+/** @brief Open sections of the round-trip file out of order. */
+void use_trip_file(int fh, void *data)
+{
+   char name[32];
+   int count, index;
+
+   for (count = 0; count < 64; ++count)
+   {
+      index = count * 1103 % TRIP_SECTIONS;
+      sprintf(name, "trip-%d", index);
+      ri_open_section(fh, name, use_trip_section, &index);
+   }
+
+   // The last section ends at the end of the file:
+   index = TRIP_SECTIONS - 1;
+   sprintf(name, "trip-%d", index);
+   ri_open_section(fh, name, use_trip_section, &index);
+}
+
+/**
+ * Lines read through the block buffer of a descriptor, including
+ * those crossing the end of a block, give the text written, whether
+ * the whole file is read or its sections are opened in any order.
+ */
+void check_block_reads(void)
+{
+   const char *path = trip_path();
+   int calls = 0, fh;
+
+   ri_read_file(path, check_trip_sections, &calls);
+   CHECK(calls == 1);
+
+   ri_open(path, use_trip_file, NULL);
+
+   // A descriptor not opened by ri_open() is read with its own buffer:
+   if (CHECK((fh = open(path, O_RDONLY)) != -1))
+   {
+      use_trip_file(fh, NULL);
+      close(fh);
+   }
+}
+
+struct trip_run
+{
+   const char *path;
+   const ri_Section *sections;
+   int calls;
+};
+
+/** @brief Compare the sections being read with those already read another way. */
+void compare_read_sections(const ri_Section *sections, void *data)
+{
+   struct trip_run *run = (struct trip_run*)data;
+
+   // Only sections parsed in memory have entries, so they come first:
+   check_same_sections(run->sections, sections);
+   ++run->calls;
+}
+
+/** @brief Read a mapped file again with ri_read_file() to compare. */
+void read_mapped_again(const ri_Section *sections, void *data)
+{
+   struct trip_run *run = (struct trip_run*)data;
+
+   run->sections = sections;
+   ri_read_file(run->path, compare_read_sections, run);
+}
+
+/** @brief Check the value of a last line without a newline. */
+void check_unterminated(const ri_Section *sections, void *data)
+{
+   CHECK(same(ri_find_section_value(sections, "last", "key"), "end"));
+   ++*(int*)data;
+}
+
+/**
+ * A file parsed in a private mapping gives the same sections and
+ * lines as one read with ri_read_file(), including a last line
+ * without a newline, which ends at the end of the mapping.
+ */
+void check_mapped_reads(void)
+{
+   struct trip_run run = { NULL, NULL, 0 };
+   int calls = 0;
+
+   run.path = trip_path();
+   ri_read_file_mmap(run.path, check_trip_sections, &calls);
+   CHECK(calls == 1);
+   ri_read_file_mmap(run.path, read_mapped_again, &run);
+   CHECK(run.calls == 1);
+
+   run.path = write_file("unterminated.ini", "[first]\nkey : 1\n[last]\n  key = end");
+   run.calls = calls = 0;
+   ri_read_file_mmap(run.path, check_unterminated, &calls);
+   ri_read_file_mmap(run.path, read_mapped_again, &run);
+   CHECK(calls == 1 && run.calls == 1);
+
+   // Neither reader calls back for a file without sections:
+   run.path = write_file("sectionless.ini", "key : no section\n");
+   run.calls = 0;
+   ri_read_file_mmap(run.path, read_mapped_again, &run);
+   CHECK(run.calls == 0);
+}
+
+/**
+ * A document loaded with or without a mapping gives the same
+ * sections and lines as a file read with ri_read_file(), and they
+ * remain valid after the load returns, until ri_free().
+ */
+void check_loaded_documents(void)
+{
+   static const int flags[] = { 0, RI_MMAP, RI_INDEX, RI_MMAP | RI_INDEX };
+   struct trip_run run = { NULL, NULL, 0 };
+   const ri_Section *sections;
+   ri_Document *doc;
+   int index;
+
+   run.path = trip_path();
+   for (index = 0; index < (int)(sizeof(flags) / sizeof(flags[0])); ++index)
+   {
+      if (!CHECK((doc = ri_load(run.path, flags[index])) != NULL))
+         continue;
+
+      sections = ri_document_sections(doc);
+      check_trip_sections(sections, NULL);
+
+      run.sections = sections;
+      run.calls = 0;
+      ri_read_file(run.path, compare_read_sections, &run);
+      CHECK(run.calls == 1);
+
+      CHECK(same(ri_find_section_value(sections, "trip-0", "spaced-0"), "0"));
+      CHECK(same(ri_find_section_value(sections, "trip-2999", "hash-2999"), "a#2999"));
+      CHECK(ri_find_section_value(sections, "trip-3000", "name-3000") == NULL);
+      ri_free(doc);
+   }
+
+   CHECK(ri_load(check_path("missing-document.ini"), 0) == NULL);
+   fputc('\n', stderr);
+}
+
+/** *****************
+ * Deep files       *
+ *******************/
+
+struct deep_run
+{
+   const char *path;
+   long loaded;
+   long read;
+   int last_found;
+};
+
+long count_sections(const ri_Section *sections)
+{
+   long count = 0;
+
+   for (; sections; sections = sections->next)
+      ++count;
+
+   return count;
+}
+
+void count_read_sections(const ri_Section *sections, void *data)
+{
+   struct deep_run *run = (struct deep_run*)data;
+   char name[32];
+
+   sprintf(name, "section-%d", DEEP_SECTIONS - 1);
+   run->read = count_sections(sections);
+   run->last_found = same(ri_find_section_value(sections, name, "key"), "last");
+}
+
+void *load_deep(void *arg)
+{
+   struct deep_run *run = (struct deep_run*)arg;
+   ri_Document *doc;
+
+   if ((doc = ri_load(run->path, 0)))
+   {
+      run->loaded = count_sections(ri_document_sections(doc));
+      ri_free(doc);
+   }
+
+   ri_read_file(run->path, count_read_sections, run);
+   return NULL;
+}
+
+/**
+ * Sections are parsed one after another, so a file of many sections
+ * loads on a thread with a small stack.
+ */
+void check_deep_file(void)
+{
+   struct deep_run run = { NULL, 0, 0, 0 };
+   FILE *file;
+   int index;
+
+   run.path = check_path("deep.ini");
+   if (!CHECK((file = fopen(run.path, "w")) != NULL))
+      return;
+
+   for (index = 0; index < DEEP_SECTIONS; ++index)
+      fprintf(file, "[section-%d]\nkey : %s\n", index,
+              index == DEEP_SECTIONS - 1 ? "last" : "value");
+   fclose(file);
+
+   if (!CHECK(run_on_small_stack(load_deep, &run)))
+      return;
+
+   CHECK(run.loaded == DEEP_SECTIONS);
+   CHECK(run.read == DEEP_SECTIONS);
+   CHECK(run.last_found);
+}
+
+/** *****************
+ * Indexed lookups  *
+ *******************/
+
+#define INDEX_SECTIONS 2000
+#define INDEX_NAMES 1500
+
+/** @brief Check that a lookup of a tag finds the same value in two lists of lines. */
+void check_same_value(const ri_Line *lines, const ri_Line *expected, const char *tag)
+{
+   CHECK(same(ri_find_value(lines, tag), ri_find_value(expected, tag)));
+}
+
+/**
+ * Sections and tags looked up through the hash tables of RI_INDEX
+ * are those found by scanning: the first of duplicate names, and
+ * none for names that are absent.  A lookup that starts after the
+ * first line of a section scans from there instead.
+ */
+void check_index(void)
+{
+   static const int flags[] = { RI_INDEX, RI_INDEX | RI_MMAP };
+   const char *path = check_path("index.ini");
+   const ri_Section *sections, *expected_sections, *section, *expected;
+   ri_Document *doc, *scanned;
+   char name[32];
+   FILE *file;
+   int index, run;
+
+   if (!CHECK((file = fopen(path, "w")) != NULL))
+      return;
+
+   // The first names repeat further down, with other values:
+   for (index = 0; index < INDEX_SECTIONS; ++index)
+      fprintf(file, "[index-%d]\nkey = %d\ndup = first-%d\ndup = second-%d\ntag-%d = %d\n",
+              index % INDEX_NAMES, index, index, index, index, index);
+   fclose(file);
+
+   if (!CHECK((scanned = ri_load(path, 0)) != NULL))
+      return;
+   expected_sections = ri_document_sections(scanned);
+
+   for (run = 0; run < (int)(sizeof(flags) / sizeof(flags[0])); ++run)
+   {
+      if (!CHECK((doc = ri_load(path, flags[run])) != NULL))
+         continue;
+      sections = ri_document_sections(doc);
+
+      for (index = 0; index < INDEX_NAMES + 100; ++index)
+      {
+         sprintf(name, "index-%d", index);
+         section = ri_get_section(sections, name);
+         expected = ri_get_section(expected_sections, name);
+         if (!CHECK((section == NULL) == (expected == NULL)) || !section)
+            continue;
+
+         CHECK(same(section->section_name, expected->section_name));
+         check_same_value(section->lines, expected->lines, "key");
+         check_same_value(section->lines, expected->lines, "dup");
+         check_same_value(section->lines, expected->lines, "absent");
+         sprintf(name, "tag-%d", index);
+         check_same_value(section->lines, expected->lines, name);
+
+         // Past the first line, the section's table isn't used:
+         check_same_value(section->lines->next->next, expected->lines->next->next, "dup");
+         check_same_value(section->lines->next, expected->lines->next, "key");
+      }
+
+      CHECK(same(ri_find_section_value(sections, "index-0", "dup"), "first-0"));
+      CHECK(same(ri_find_section_value(sections, "index-499", "key"), "499"));
+      CHECK(ri_find_section_value(sections, "index-1500", "key") == NULL);
+      ri_free(doc);
+   }
+
+   ri_free(scanned);
+}
+
+/** *****************
+ * Section reads    *
+ *******************/
+
+struct reopen_run
+{
+   const char *path;
+   const char *before;   // value of [moved] before the rewrite
+   const char *after;    // value of [moved] after the rewrite
+   int found_before;
+   int found_after;
+};
+
+void use_moved_before(int fh, const ri_Line *lines, void *data)
+{
+   struct reopen_run *run = (struct reopen_run*)data;
+
+   run->found_before = same(ri_find_value(lines, "key"), run->before);
+}
+
+void use_moved_after(int fh, const ri_Line *lines, void *data)
+{
+   struct reopen_run *run = (struct reopen_run*)data;
+
+   run->found_after = same(ri_find_value(lines, "key"), run->after);
+}
+
+void rewrite_while_open(int fh, void *data)
+{
+   struct reopen_run *run = (struct reopen_run*)data;
+   FILE *file;
+
+   // The first read records the offset of every head it passes:
+   ri_open_section(fh, "moved", use_moved_before, run);
+
+   // Rewritten in place, so the open descriptor sees the new text:
+   if (!CHECK((file = fopen(run->path, "w")) != NULL))
+      return;
+   fputs("[added]\nfiller : moves the other sections down\n"
+         "[first]\nkey : 1\n"
+         "[moved]\nkey : after\n", file);
+   fclose(file);
+
+   ri_open_section(fh, "moved", use_moved_after, run);
+}
+
+/**
+ * Sections found through recorded head offsets are found again at
+ * their new offsets when the file is rewritten while it is open.
+ */
+void check_section_reads(void)
+{
+   struct reopen_run run = { NULL, "before", "after", 0, 0 };
+
+   run.path = write_file("reopen.ini", "[first]\nkey : 1\n[moved]\nkey : before\n[last]\n");
+   ri_open(run.path, rewrite_while_open, &run);
+   CHECK(run.found_before);
+   CHECK(run.found_after);
+}
+
+/** *****************
+ * Entries          *
+ *******************/
+
+/** @brief Check the next entry of a section, and the length recorded for it. */
+void check_next_entry(ri_Entry_Iter *iter, const char *tag, const char *value)
+{
+   const ri_Entry *entry;
+   const char *entry_tag, *entry_value;
+
+   if (!CHECK((entry = ri_entry_next(iter, &entry_tag, &entry_value)) != NULL))
+      return;
+
+   CHECK(same(entry_tag, tag) && same(entry_value, value));
+   CHECK(entry->tag_len == strlen(tag));
+   CHECK(entry->value_len == (value ? strlen(value) : 0));
+}
+
+/**
+ * The entries of a loaded document give the tags and values of its
+ * lines, with no value for a tag without one, whether or not it has
+ * a separator.  A section without lines has no entries.
+ */
+void check_document_entries(void)
+{
+   static const int flags[] = { 0, RI_MMAP };
+   const char *path = write_file("entries.ini",
+                                 "[keys]\nk1 = a\nk2 : b\nk3\nk4 =\n  k5 =   spaced  \n"
+                                 "[empty]\n# only a comment\n"
+                                 "[after]\nk6 = c\n");
+   const ri_Section *sections, *section;
+   const ri_Line *line;
+   ri_Entry_Iter iter;
+   ri_Document *doc;
+   int run;
+
+   for (run = 0; run < (int)(sizeof(flags) / sizeof(flags[0])); ++run)
+   {
+      if (!CHECK((doc = ri_load(path, flags[run])) != NULL))
+         continue;
+      sections = ri_document_sections(doc);
+
+      for (section = sections; section; section = section->next)
+         check_entries(section);
+
+      if (CHECK(ri_entries(ri_get_section(sections, "keys"), &iter)))
+      {
+         check_next_entry(&iter, "k1", "a");
+         check_next_entry(&iter, "k2", "b");
+         check_next_entry(&iter, "k3", NULL);
+         check_next_entry(&iter, "k4", NULL);
+         check_next_entry(&iter, "k5", "spaced");
+         CHECK(ri_entry_next(&iter, NULL, NULL) == NULL);
+      }
+
+      // The line of a tag without a value is found, with no value:
+      line = ri_find_section_line(sections, "keys", "k4");
+      CHECK(line && line->value == NULL);
+      CHECK(ri_find_section_value(sections, "keys", "k4") == NULL);
+
+      CHECK(!ri_entries(ri_get_section(sections, "empty"), &iter));
+      CHECK(same(ri_find_section_value(sections, "after", "k6"), "c"));
+      ri_free(doc);
+   }
+}
+
+/** *****************
+ * Scan kernels     *
+ *******************/
+
+#define SCAN_KERNELS 3
+#define SCAN_OFFSETS 48
+#define SCAN_LENGTH 100
+#define SCAN_TAG 71
+
+const char *kernel_names[SCAN_KERNELS] = { "scalar", "sse2", "avx2" };
+
+/**
+ * @brief Select each kernel the CPU supports, as RI_SCAN would.
+ *
+ * @return Number of kernels selected into *kernels*, scalar first.
+ */
+int select_kernels(Scan_Kernels *kernels)
+{
+   char *setting = getenv("RI_SCAN");
+   int index, count = 0;
+
+   if (setting && !(setting = strdup(setting)))
+      return 0;
+
+   for (index = 0; index < SCAN_KERNELS; ++index)
+   {
+      setenv("RI_SCAN", kernel_names[index], 1);
+      select_scan_kernels();
+      if (same(ri_scan.name, kernel_names[index]))
+         kernels[count++] = ri_scan;
+   }
+
+   if (setting)
+      setenv("RI_SCAN", setting, 1);
+   else
+      unsetenv("RI_SCAN");
+   free(setting);
+
+   select_scan_kernels();
+   return count;
+}
+
+/**
+ * @brief Check that the kernels find the same character in every
+ *        slice of a buffer, with each target at each position.
+ */
+void check_kernel_slices(const Scan_Kernels *kernels, int count, char filler)
+{
+   static const char targets[] = "\n#:= \t";
+   static char buffer[SCAN_OFFSETS + SCAN_LENGTH + 1] __attribute__((aligned(64)));
+   const char *start, *end, *line_end, *tag_end;
+   int offset, len, target, position, kernel;
+
+   for (offset = 0; offset < SCAN_OFFSETS; ++offset)
+      for (len = 0; len <= SCAN_LENGTH; ++len)
+         for (target = 0; target < (int)sizeof(targets) - 1; ++target)
+            for (position = 0; position <= len; ++position)
+            {
+               // A target at *len* lies just past the slice, so isn't found:
+               memset(buffer, filler, sizeof(buffer));
+               buffer[offset + position] = targets[target];
+               start = buffer + offset;
+               end = start + len;
+
+               line_end = kernels[0].line_end(start, end);
+               tag_end = kernels[0].tag_end(start, end);
+               for (kernel = 1; kernel < count; ++kernel)
+                  if (!CHECK(kernels[kernel].line_end(start, end) == line_end
+                             && kernels[kernel].tag_end(start, end) == tag_end))
+                  {
+                     fprintf(stderr, "%s: offset %d, length %d, '%c' at %d\n",
+                             kernels[kernel].name, offset, len, targets[target], position);
+                     return;
+                  }
+            }
+}
+
+/**
+ * The SSE2 and AVX2 kernels that the CPU supports find the same
+ * characters as the scalar kernels, at any alignment and across
+ * 16- and 32-byte boundaries, and documents parsed with them have
+ * the same lines, including values with an escaped '#'.
+ */
+void check_scan_kernels(void)
+{
+   Scan_Kernels kernels[SCAN_KERNELS];
+   const char *path = check_path("kernels.ini");
+   ri_Document *docs[SCAN_KERNELS];
+   const char *saved = ri_scan.name;
+   char tag[SCAN_TAG], value[33];
+   FILE *file;
+   int count, index, len;
+
+   if (!CHECK((count = select_kernels(kernels)) > 0) || !CHECK(same(ri_scan.name, saved)))
+      return;
+
+   check_kernel_slices(kernels, count, 'a');
+   check_kernel_slices(kernels, count, (char)0xe9);
+
+   if (!CHECK((file = fopen(path, "w")) != NULL))
+      return;
+
+   // Tags, comments and escapes fall at each offset of a 32-byte block:
+   for (len = 1; len < SCAN_TAG; ++len)
+   {
+      memset(tag, 't', len);
+      tag[len] = '\0';
+      memset(value, 'v', len % 33);
+      value[len % 33] = '\0';
+      fprintf(file, "[scan-%d]\n%*s%s = %s\\#%d # comment %d\n%s:x\n",
+              len, len % 17, "", tag, value, len, len, tag);
+   }
+   fclose(file);
+
+   for (index = 0; index < count; ++index)
+   {
+      ri_scan = kernels[index];
+      docs[index] = ri_load(path, RI_MMAP);
+   }
+   select_scan_kernels();
+
+   for (index = 0; index < count; ++index)
+      CHECK(docs[index] != NULL);
+
+   if (docs[0])
+   {
+      CHECK(count_sections(ri_document_sections(docs[0])) == SCAN_TAG - 1);
+      CHECK(same(ri_find_section_value(ri_document_sections(docs[0]), "scan-3", "ttt"),
+                 "vvv#3"));
+   }
+
+   for (index = 1; index < count; ++index)
+      if (docs[0] && docs[index])
+         check_same_sections(ri_document_sections(docs[index]), ri_document_sections(docs[0]));
+
+   for (index = 0; index < count; ++index)
+      ri_free(docs[index]);
+}
+
+/** *****************
+ * Hot reload       *
+ *******************/
+
+#define RELOAD_WAIT_MS 5000
+
+struct reload_run
+{
+   ri_Watcher *watcher;
+   int fh;
+   int reloaded;
+};
+
+/**
+ * @brief Rewrite the watched file through a descriptor kept open.
+ *
+ * The watcher thread reloads when a file written to is closed, so
+ * writing without closing leaves the reloads to the check.
+ */
+void write_version(int fh, const char *version)
+{
+   char text[32];
+   int len = sprintf(text, "[app]\nversion : %s\n", version);
+
+   CHECK(0 == ftruncate(fh, 0) && len == pwrite(fh, text, len, 0));
+}
+
+/** @brief Return the version of the [app] section of a document. */
+const char *app_version(const ri_Document *doc)
+{
+   return ri_find_section_value(ri_document_sections(doc), "app", "version");
+}
+
+void *reload_version_3(void *arg)
+{
+   struct reload_run *run = (struct reload_run*)arg;
+
+   write_version(run->fh, "3");
+   run->reloaded = ri_watch_reload(run->watcher);
+   return NULL;
+}
+
+/**
+ * A reload publishes a new generation of the document at once, while
+ * a document acquired before it, and its values, stay valid until
+ * released.  A file that can't be read leaves the last document.
+ */
+void check_watch(void)
+{
+   struct reload_run run = { NULL, -1, 0 };
+   struct timespec pause = { 0, 1000000 };
+   const ri_Document *held, *current;
+   const char *path, *held_version;
+   unsigned long generation;
+   pthread_t reloader;
+   int token, other, waited;
+
+   path = write_file("watched.ini", "[app]\nversion : 1\n");
+   if (!CHECK((run.fh = open(path, O_WRONLY)) != -1))
+      return;
+
+   if (!CHECK((run.watcher = ri_watch(path, RI_INDEX)) != NULL))
+   {
+      close(run.fh);
+      return;
+   }
+
+   current = ri_watch_acquire(run.watcher, &token);
+   CHECK(same(app_version(current), "1"));
+   ri_watch_release(run.watcher, token);
+
+   generation = ri_watch_generation(run.watcher);
+   write_version(run.fh, "2");
+   CHECK(ri_watch_reload(run.watcher));
+   CHECK(ri_watch_generation(run.watcher) == generation + 1);
+
+   held = ri_watch_acquire(run.watcher, &token);
+   held_version = app_version(held);
+   CHECK(same(held_version, "2"));
+
+   // The reload publishes at once, then waits for the held document:
+   generation = ri_watch_generation(run.watcher);
+   if (CHECK(0 == pthread_create(&reloader, NULL, reload_version_3, &run)))
+   {
+      for (waited = 0; waited < RELOAD_WAIT_MS && ri_watch_generation(run.watcher) == generation;
+           ++waited)
+         nanosleep(&pause, NULL);
+
+      current = ri_watch_acquire(run.watcher, &other);
+      CHECK(current != held && same(app_version(current), "3"));
+      ri_watch_release(run.watcher, other);
+
+      CHECK(same(app_version(held), "2") && same(held_version, "2"));
+      ri_watch_release(run.watcher, token);
+
+      pthread_join(reloader, NULL);
+      CHECK(run.reloaded);
+   }
+   else
+      ri_watch_release(run.watcher, token);
+
+   // A file that can't be read isn't published:
+   remove(path);
+   CHECK(!ri_watch_reload(run.watcher));
+   fputc('\n', stderr);
+
+   current = ri_watch_acquire(run.watcher, &token);
+   CHECK(same(app_version(current), "3"));
+   ri_watch_release(run.watcher, token);
+
+   ri_unwatch(run.watcher);
+   close(run.fh);
+}
+
+/** *****************
+ * Parallel loads   *
+ *******************/
+
+#define PARALLEL_SECTIONS 5000
+
+/**
+ * A file split into chunks at section heads and parsed on several
+ * threads gives the same sections and lines as one parsed at once,
+ * including lines outside any section and heads without a ']'.
+ */
+void check_parallel(void)
+{
+   static const int threads[] = { 2, 4, 16 };
+   static const int flags[] = { 0, RI_INDEX, RI_MMAP | RI_INTERN };
+   const char *path = check_path("parallel.ini");
+   ri_Document *serial, *parallel;
+   FILE *file;
+   int index, run;
+
+   if (!CHECK((file = fopen(path, "w")) != NULL))
+      return;
+
+   fputs("before : the first section\n", file);
+   for (index = 0; index < PARALLEL_SECTIONS; ++index)
+   {
+      if (index % 97 == 0)
+         fprintf(file, "[broken-%d\nhidden : %d\n", index, index);
+      fprintf(file, "  [section-%d]   # head %d\n", index % 1000, index);
+      fprintf(file, "key : %d\nescaped : a\\#%d # comment\nflag\n", index, index);
+      if (index % 13 == 0)
+         fputs("# a comment line\n\n", file);
+   }
+   fclose(file);
+
+   for (run = 0; run < (int)(sizeof(flags) / sizeof(flags[0])); ++run)
+   {
+      if (!CHECK((serial = ri_load(path, flags[run])) != NULL))
+         continue;
+
+      CHECK(count_sections(ri_document_sections(serial)) == PARALLEL_SECTIONS);
+
+      for (index = 0; index < (int)(sizeof(threads) / sizeof(threads[0])); ++index)
+      {
+         if (!CHECK((parallel = ri_load_parallel(path, flags[run], threads[index])) != NULL))
+            continue;
+
+         check_same_sections(ri_document_sections(parallel), ri_document_sections(serial));
+         CHECK(same(ri_find_section_value(ri_document_sections(parallel), "section-999", "key"),
+                    "999"));
+         ri_free(parallel);
+      }
+
+      ri_free(serial);
+   }
+}
+
+/** *****************
+ * Events           *
+ *******************/
+
+/** Events recorded as text, one line each, to compare with those expected. */
+struct transcript
+{
+   char text[1024];
+   size_t len;
+   int events_left;   // events to record before stopping, or -1
+};
+
+int record(struct transcript *script, const char *kind, const char *str, int len,
+           const char *value, int len_value)
+{
+   size_t room = sizeof(script->text) - script->len;
+
+   if (value)
+      script->len += snprintf(script->text + script->len, room, "%s %.*s=%.*s\n",
+                              kind, len, str, len_value, value);
+   else
+      script->len += snprintf(script->text + script->len, room, "%s %.*s\n", kind, len, str);
+
+   if (script->len >= sizeof(script->text))
+      script->len = sizeof(script->text) - 1;
+
+   return script->events_left < 0 || --script->events_left > 0;
+}
+
+int record_section(const char *name, int len, void *data)
+{
+   return record((struct transcript*)data, "section", name, len, NULL, 0);
+}
+
+int record_key_value(const char *tag, int len_tag, const char *value, int len_value, void *data)
+{
+   return record((struct transcript*)data, "key", tag, len_tag, len_value ? value : NULL, len_value);
+}
+
+int record_comment(const char *text, int len, void *data)
+{
+   return record((struct transcript*)data, "comment", text, len, NULL, 0);
+}
+
+int record_error(const char *message, long line_number, void *data)
+{
+   char number[24];
+
+   return record((struct transcript*)data, "error", number,
+                 sprintf(number, "%ld", line_number), NULL, 0);
+}
+
+const ri_Events recorder = { record_section, record_key_value, record_comment, record_error };
+
+const char events_text[] =
+   "# leading comment\n"
+   "orphan : ignored\n"
+   "[global]\n"
+   "mailhost : smtp.example.com   # trailing\n"
+   "empty_tag\n"
+   "escaped : a\\#b\n"
+   "[broken\n"
+   "lost : line\n"
+   "[second]\n"
+   "port: 587";
+
+const char events_expected[] =
+   "comment  leading comment\n"
+   "section global\n"
+   "comment  trailing\n"
+   "key mailhost=smtp.example.com\n"
+   "key empty_tag\n"
+   "key escaped=a#b\n"
+   "error 7\n"
+   "section second\n"
+   "key port=587\n";
+
+/**
+ * Every section head, line, comment and error is reported in file
+ * order, and a callback returning FALSE stops the reading.
+ */
+void check_events(void)
+{
+   const char *path = write_file("events.ini", events_text);
+   struct transcript script = { "", 0, -1 };
+
+   CHECK(ri_parse_events(path, &recorder, &script));
+   CHECK(same(script.text, events_expected));
+
+   // Stop at the third event:
+   script.len = 0;
+   script.text[0] = '\0';
+   script.events_left = 3;
+   CHECK(!ri_parse_events(path, &recorder, &script));
+   CHECK(same(script.text, "comment  leading comment\nsection global\ncomment  trailing\n"));
+}
+
+/** *****************
+ * Streams          *
+ *******************/
+
+#define PIPE_SECTIONS 10000
+
+/**
+ * Text fed to a push parser in pieces of any size, split anywhere,
+ * is reported as the same events as the file.
+ */
+void check_push_parser(void)
+{
+   static const size_t pieces[] = { 1, 2, 7, sizeof(events_text) };
+   struct transcript script;
+   ri_Parser *parser;
+   size_t piece, offset, len;
+   int index;
+
+   if (!CHECK((parser = ri_parser_create(&recorder, &script)) != NULL))
+      return;
+
+   for (index = 0; index < (int)(sizeof(pieces) / sizeof(pieces[0])); ++index)
+   {
+      script.len = 0;
+      script.text[0] = '\0';
+      script.events_left = -1;
+
+      piece = pieces[index];
+      for (offset = 0; offset < sizeof(events_text) - 1; offset += len)
+      {
+         len = sizeof(events_text) - 1 - offset < piece ? sizeof(events_text) - 1 - offset : piece;
+         CHECK(ri_parser_feed(parser, events_text + offset, len));
+      }
+
+      // The last line has no newline, so is reported only when finished:
+      CHECK(!strstr(script.text, "key port="));
+      CHECK(ri_parser_finish(parser));
+      CHECK(same(script.text, events_expected));
+   }
+
+   ri_parser_destroy(parser);
+}
+
+/** @brief Write many sections to a pipe, closing it at the end. */
+void *write_pipe(void *arg)
+{
+   FILE *out = (FILE*)arg;
+   int index;
+
+   for (index = 0; index < PIPE_SECTIONS; ++index)
+      fprintf(out, "[pipe-%d]\nindex : %d\n", index, index);
+
+   fclose(out);
+   return NULL;
+}
+
+/**
+ * A document is loaded from a pipe, which can't be mapped or sized,
+ * from text longer than the pipe holds at once.  Includes, which
+ * a stream has no directory to resolve, are refused.
+ */
+void check_load_fd(void)
+{
+   pthread_t writer;
+   ri_Document *doc;
+   const ri_Section *sections;
+   int fds[2];
+   FILE *out;
+
+   if (!CHECK(0 == pipe(fds)))
+      return;
+
+   CHECK(ri_load_fd(fds[0], RI_INCLUDES) == NULL);
+   fputc('\n', stderr);
+
+   if (!CHECK((out = fdopen(fds[1], "w")) != NULL))
+   {
+      close(fds[0]);
+      close(fds[1]);
+      return;
+   }
+
+   if (!CHECK(0 == pthread_create(&writer, NULL, write_pipe, out)))
+   {
+      fclose(out);
+      close(fds[0]);
+      return;
+   }
+
+   doc = ri_load_fd(fds[0], RI_INDEX);
+   pthread_join(writer, NULL);
+   close(fds[0]);
+
+   if (!CHECK(doc != NULL))
+      return;
+
+   sections = ri_document_sections(doc);
+   CHECK(count_sections(sections) == PIPE_SECTIONS);
+   CHECK(same(ri_find_section_value(sections, "pipe-0", "index"), "0"));
+   CHECK(same(ri_find_section_value(sections, "pipe-9999", "index"), "9999"));
+   CHECK(ri_find_section_value(sections, "pipe-10000", "index") == NULL);
+   ri_free(doc);
+}
+
+/** *****************
+ * Caches           *
+ *******************/
+
+/** @brief Set the modification time of a file, to seconds since 1970. */
+void set_mtime(const char *path, time_t seconds)
+{
+   struct timespec times[2] = { { seconds, 0 }, { seconds, 0 } };
+
+   CHECK(0 == utimensat(AT_FDCWD, path, times, 0));
+}
+
+/** @brief Check values of a document loaded from a cache. */
+void check_cached(const char *path, const char *cache, const char *port)
+{
+   ri_Document *doc;
+   const ri_Section *sections;
+
+   if (!CHECK((doc = ri_load_cached(path, cache, 0)) != NULL))
+      return;
+
+   CHECK(same(ri_document_value(doc, "server", "port"), port));
+   CHECK(same(ri_document_value(doc, "server", "host"), "first"));
+   CHECK(same(ri_document_value(doc, "client", "retries"), "3"));
+   CHECK(ri_document_value(doc, "server", "flag") == NULL);
+   CHECK(ri_document_value(doc, "server", "missing") == NULL);
+   CHECK(ri_document_value(doc, "missing", "port") == NULL);
+
+   // The sections are made from the cache when first asked for:
+   sections = ri_document_sections(doc);
+   CHECK(count_sections(sections) == 3);
+   CHECK(same(ri_find_section_value(sections, "client", "retries"), "3"));
+   CHECK(sections && same(sections->section_name, "server"));
+
+   ri_free(doc);
+}
+
+/**
+ * A compiled cache answers lookups as the file would, with the first
+ * of repeated tags and sections, and is replaced when the file
+ * changes, but not when it is only touched.
+ */
+void check_cache(void)
+{
+   const char *path = write_file("cache.ini",
+                                 "[server]\nhost : first\nport : 1\nhost : second\nflag\n"
+                                 "[client]\nretries : 3\n"
+                                 "[server]\nport : 9\n");
+   const char *cache = check_path("cache.ini.cache");
+   const char *empty = write_file("empty.ini", "");
+   const char *empty_cache = check_path("empty.ini.cache");
+   ri_Document *doc;
+
+   set_mtime(path, 1000000000);
+   CHECK(ri_compile(path, cache));
+   check_cached(path, cache, "1");
+
+   // Touched, but not changed:
+   set_mtime(path, 1000000100);
+   check_cached(path, cache, "1");
+
+   // Changed, with the same size:
+   write_file("cache.ini",
+              "[server]\nhost : first\nport : 2\nhost : second\nflag\n"
+              "[client]\nretries : 3\n"
+              "[server]\nport : 9\n");
+   set_mtime(path, 1000000200);
+   check_cached(path, cache, "2");
+   check_cached(path, cache, "2");
+
+   // A file without keys has a cache without a perfect hash:
+   CHECK(ri_compile(empty, empty_cache));
+   if (CHECK((doc = ri_load_cached(empty, empty_cache, 0)) != NULL))
+   {
+      CHECK(ri_document_value(doc, "server", "port") == NULL);
+      CHECK(ri_document_sections(doc) == NULL);
+      ri_free(doc);
+   }
+}
+
+/** *****************
+ * Long lines       *
+ *******************/
+
+#define LONG_VALUE 200000
+#define LONG_LAST 70000
+#define LINE_LIMIT 1000
+
+struct long_run
+{
+   size_t cert_len;      // length of the long value, or 0 if it isn't all 'c'
+   size_t last_len;      // length of the last value, or 0 if it isn't all 'z'
+   int after_found;
+   int calls;
+};
+
+/** @brief Return the length of a value made of one character, or 0 if it isn't. */
+size_t run_length(const char *value, char c)
+{
+   size_t len = 0;
+
+   if (!value)
+      return 0;
+
+   while (value[len] == c)
+      ++len;
+
+   return value[len] ? 0 : len;
+}
+
+void measure_long_lines(const ri_Section *sections, void *data)
+{
+   struct long_run *run = (struct long_run*)data;
+
+   run->cert_len = run_length(ri_find_section_value(sections, "long", "cert"), 'c');
+   run->last_len = run_length(ri_find_section_value(sections, "next", "key"), 'z');
+   run->after_found = same(ri_find_section_value(sections, "long", "after"), "2");
+   ++run->calls;
+}
+
+void measure_long_section(int fh, const ri_Line *lines, void *data)
+{
+   struct long_run *run = (struct long_run*)data;
+
+   run->last_len = run_length(ri_find_value(lines, "key"), 'z');
+   ++run->calls;
+}
+
+void open_long_section(int fh, void *data)
+{
+   ri_open_section(fh, "next", measure_long_section, data);
+}
+
+/** @brief Check the lengths of the long values read, by each reader. */
+void check_long_values(const char *path, size_t cert_len, size_t last_len)
+{
+   struct long_run run = { 0, 0, 0, 0 };
+
+   ri_read_file(path, measure_long_lines, &run);
+   CHECK(run.calls == 1 && run.after_found);
+   CHECK(run.cert_len == cert_len && run.last_len == last_len);
+
+   run.last_len = 0;
+   ri_open(path, open_long_section, &run);
+   CHECK(run.calls == 2 && run.last_len == last_len);
+}
+
+/**
+ * Lines longer than the 64 KB block they are read in are read whole,
+ * including a last line without a newline.  With a line limit, they
+ * are cut at the limit, with the rest of the line skipped, except in
+ * documents, which are never truncated.
+ */
+void check_long_lines(void)
+{
+   const char *path = check_path("long.ini");
+   struct long_run run = { 0, 0, 0, 0 };
+   ri_Document *doc;
+   FILE *file;
+   int index;
+
+   if (!CHECK((file = fopen(path, "w")) != NULL))
+      return;
+
+   fputs("[long]\nbefore = 1\n# ", file);
+   for (index = 0; index < LONG_VALUE; ++index)
+      fputc('#', file);
+   fputs("\ncert = ", file);
+   for (index = 0; index < LONG_VALUE; ++index)
+      fputc('c', file);
+   fputs("\nafter = 2\n[next]\nkey = ", file);
+   for (index = 0; index < LONG_LAST; ++index)
+      fputc('z', file);
+   fclose(file);
+
+   check_long_values(path, LONG_VALUE, LONG_LAST);
+
+   CHECK(ri_set_line_limit(LINE_LIMIT) == 0);
+   check_long_values(path, LINE_LIMIT - strlen("cert = "), LINE_LIMIT - strlen("key = "));
+   fputc('\n', stderr);
+
+   if (CHECK((doc = ri_load(path, 0)) != NULL))
+   {
+      measure_long_lines(ri_document_sections(doc), &run);
+      CHECK(run.cert_len == LONG_VALUE && run.last_len == LONG_LAST && run.after_found);
+      ri_free(doc);
+   }
+
+   CHECK(ri_set_line_limit(0) == LINE_LIMIT);
+}
+
+/** *****************
+ * Typed values     *
+ *******************/
+
+const char typed_text[] =
+   "[numbers]\n"
+   "count : 42\n"
+   "negative : -17\n"
+   "hex : 0x1F\n"
+   "huge : 99999999999999999999\n"
+   "word : forty\n"
+   "ratio : 0.25\n"
+   "empty\n"
+   "[flags]\n"
+   "on : Yes\n"
+   "off : OFF\n"
+   "maybe : perhaps\n"
+   "[sizes]\n"
+   "timeout : 1h 30m\n"
+   "short : 250ms\n"
+   "bare : 5\n"
+   "trailing : 1m 30\n"
+   "cache : 64MiB\n"
+   "disk : 1.5GB\n"
+   "page : 4k\n";
+
+/**
+ * Values are converted to each type, with the errors of values that
+ * aren't of it or don't fit, and converting a line again, to the
+ * same or another type, gives the same results.
+ */
+void check_typed(void)
+{
+   const char *path = write_file("typed.ini", typed_text);
+   const ri_Section *sections;
+   const ri_Line *line;
+   ri_Document *doc;
+   int64_t i;
+   uint64_t u;
+   double d;
+   int b, pass;
+
+   if (!CHECK((doc = ri_load(path, RI_INDEX)) != NULL))
+      return;
+
+   sections = ri_document_sections(doc);
+
+   // The second pass reads the conversions saved by the first:
+   for (pass = 0; pass < 2; ++pass)
+   {
+      CHECK(RI_OK == ri_line_int64(ri_find_section_line(sections, "numbers", "count"), &i) && i == 42);
+      CHECK(RI_OK == ri_line_int64(ri_find_section_line(sections, "numbers", "negative"), &i) && i == -17);
+      CHECK(RI_OK == ri_line_int64(ri_find_section_line(sections, "numbers", "hex"), &i) && i == 31);
+      CHECK(RI_RANGE == ri_line_int64(ri_find_section_line(sections, "numbers", "huge"), &i));
+      CHECK(RI_INVALID == ri_line_int64(ri_find_section_line(sections, "numbers", "word"), &i));
+      CHECK(RI_INVALID == ri_line_int64(ri_find_section_line(sections, "numbers", "ratio"), &i));
+      CHECK(RI_MISSING == ri_line_int64(ri_find_section_line(sections, "numbers", "empty"), &i));
+      CHECK(RI_MISSING == ri_line_int64(ri_find_section_line(sections, "numbers", "absent"), &i));
+
+      CHECK(RI_OK == ri_line_uint64(ri_find_section_line(sections, "numbers", "count"), &u) && u == 42);
+      CHECK(RI_RANGE == ri_line_uint64(ri_find_section_line(sections, "numbers", "negative"), &u));
+      CHECK(RI_RANGE == ri_line_uint64(ri_find_section_line(sections, "numbers", "huge"), &u));
+
+      CHECK(RI_OK == ri_line_double(ri_find_section_line(sections, "numbers", "ratio"), &d) && d == 0.25);
+      CHECK(RI_OK == ri_line_double(ri_find_section_line(sections, "numbers", "count"), &d) && d == 42.0);
+      CHECK(RI_INVALID == ri_line_double(ri_find_section_line(sections, "numbers", "word"), &d));
+
+      CHECK(RI_OK == ri_line_bool(ri_find_section_line(sections, "flags", "on"), &b) && b == 1);
+      CHECK(RI_OK == ri_line_bool(ri_find_section_line(sections, "flags", "off"), &b) && b == 0);
+      CHECK(RI_INVALID == ri_line_bool(ri_find_section_line(sections, "flags", "maybe"), &b));
+
+      CHECK(RI_OK == ri_line_duration(ri_find_section_line(sections, "sizes", "timeout"), &i)
+            && i == 5400 * INT64_C(1000000000));
+      CHECK(RI_OK == ri_line_duration(ri_find_section_line(sections, "sizes", "short"), &i)
+            && i == 250 * INT64_C(1000000));
+      CHECK(RI_OK == ri_line_duration(ri_find_section_line(sections, "sizes", "bare"), &i)
+            && i == 5 * INT64_C(1000000000));
+      CHECK(RI_INVALID == ri_line_duration(ri_find_section_line(sections, "sizes", "trailing"), &i));
+
+      CHECK(RI_OK == ri_line_bytes(ri_find_section_line(sections, "sizes", "cache"), &u)
+            && u == 64 * UINT64_C(1048576));
+      CHECK(RI_OK == ri_line_bytes(ri_find_section_line(sections, "sizes", "disk"), &u)
+            && u == UINT64_C(1500000000));
+      CHECK(RI_OK == ri_line_bytes(ri_find_section_line(sections, "sizes", "page"), &u) && u == 4096);
+      CHECK(RI_OK == ri_line_bytes(ri_find_section_line(sections, "numbers", "count"), &u) && u == 42);
+   }
+
+   // A line found in a list of lines converts as well:
+   line = ri_find_line(ri_get_section(sections, "numbers")->lines, "hex");
+   CHECK(RI_OK == ri_line_uint64(line, &u) && u == 31);
+
+   ri_free(doc);
+}
+
+/** *****************
+ * Batch lookups    *
+ *******************/
+
+#define BATCH_COUNT 7
+
+const char batch_text[] =
+   "[server]\nhost : first\nflag\n"
+   "[client]\nretries : 3\n"
+   "[server]\nport : 9\nhost : later\n";
+
+/** Values expected for the lookups of *make_lookups()*, in order. */
+const char *batch_expected[BATCH_COUNT] = { "first", "9", NULL, "3", NULL, NULL, "first" };
+
+/** @brief Set lookups of found, repeated, missing and valueless tags. */
+void make_lookups(ri_Lookup *lookups, const char **values)
+{
+   static const char *names[BATCH_COUNT][2] = {
+      { "server", "host" }, { "server", "port" }, { "server", "flag" },
+      { "client", "retries" }, { "client", "host" }, { "missing", "host" },
+      { "server", "host" }
+   };
+   int index;
+
+   for (index = 0; index < BATCH_COUNT; ++index)
+   {
+      lookups[index].section_name = names[index][0];
+      lookups[index].tag_name = names[index][1];
+      lookups[index].value = &values[index];
+      values[index] = "unset";
+   }
+}
+
+/** @brief Check the values set by a batch, and that they are as found one by one. */
+void check_batch_values(const char **values, const ri_Section *sections)
+{
+   ri_Lookup lookups[BATCH_COUNT];
+   const char *unused[BATCH_COUNT];
+   int index;
+
+   make_lookups(lookups, unused);
+   for (index = 0; index < BATCH_COUNT; ++index)
+   {
+      CHECK(same(values[index], batch_expected[index]));
+      if (sections)
+         CHECK(same(values[index], ri_find_section_value(sections, lookups[index].section_name,
+                                                         lookups[index].tag_name)));
+   }
+}
+
+void use_batch_values(int fh, void *data)
+{
+   // The values remain valid until the callback returns:
+   check_batch_values((const char**)data, NULL);
+}
+
+void use_batch_file_values(int fh, void *data)
+{
+   ri_Lookup lookups[BATCH_COUNT];
+   const char *values[BATCH_COUNT];
+
+   make_lookups(lookups, values);
+   *(int*)data = ri_open_batch(fh, lookups, BATCH_COUNT, use_batch_values, values);
+}
+
+/**
+ * A batch finds the values that *ri_find_section_value()* finds, one
+ * by one, in a document with or without an index and in a file.
+ */
+void check_batch(void)
+{
+   static const int flags[] = { 0, RI_INDEX, RI_LAZY };
+   const char *path = write_file("batch.ini", batch_text);
+   ri_Lookup lookups[BATCH_COUNT];
+   const char *values[BATCH_COUNT];
+   ri_Document *doc;
+   int index, found = -1;
+
+   for (index = 0; index < (int)(sizeof(flags) / sizeof(flags[0])); ++index)
+   {
+      if (!CHECK((doc = ri_load(path, flags[index])) != NULL))
+         continue;
+
+      make_lookups(lookups, values);
+      CHECK(ri_find_batch(ri_document_sections(doc), lookups, BATCH_COUNT) == 5);
+      check_batch_values(values, ri_document_sections(doc));
+      ri_free(doc);
+   }
+
+   ri_open(path, use_batch_file_values, &found);
+   CHECK(found == 5);
+}
+
+/** *****************
+ * Schemas          *
+ *******************/
+
+#define CHECK_CONFIG(X) \
+   X(host,    "server",  "host",       STRING,   "localhost") \
+   X(port,    "server",  "port",       INT64,    "8080")      \
+   X(timeout, "server",  "timeout",    DURATION, "30s")       \
+   X(name,    "server",  "name",       STRING,   NULL)        \
+   X(verbose, "logging", "verbose",    BOOL,     "no")        \
+   X(limit,   "logging", "size_limit", BYTES,    "1MiB")      \
+   X(ratio,   "logging", "ratio",      DOUBLE,   "0.5")       \
+   X(count,   "a_section_name_longer_than_the_maximum", "count", UINT64, "7")
+
+RI_SCHEMA_STRUCT(check_config, CHECK_CONFIG);
+static RI_SCHEMA_TABLE(check_config, CHECK_CONFIG)
+
+const char schema_text[] =
+   "[server]\n"
+   "host : example.org\n"
+   "port : 9090\n"
+   "port : 1\n"
+   "unknown : x\n"
+   "timeout\n"
+   "[logging]\n"
+   "verbose : yes\n"
+   "ratio : bad\n"
+   "[broken\n"
+   "[a_section_name_longer_than_the_maximum]\n"
+   "count : 12\n";
+
+/**
+ * A file loads into a schema struct with the first value of each
+ * tag, converted, and the defaults of tags that are missing, have no
+ * value or have an invalid one.  Unknown tags, invalid values and
+ * malformed lines are counted, or stop a strict load.
+ */
+void check_schema(void)
+{
+   const char *path = write_file("schema.ini", schema_text);
+   struct check_config config;
+
+   CHECK(ri_load_schema(path, check_config_schema(), &config, 0) == 3);
+   CHECK(same(config.host, "example.org"));
+   CHECK(config.port == 9090);
+   CHECK(config.timeout == 30 * INT64_C(1000000000));
+   CHECK(config.name == NULL);
+   CHECK(config.verbose == 1);
+   CHECK(config.limit == UINT64_C(1048576));
+   CHECK(config.ratio == 0.5);
+   CHECK(config.count == 12);
+   ri_schema_free(check_config_schema(), &config);
+
+   // Failures are reported by the library, without a newline:
+   CHECK(ri_load_schema(path, check_config_schema(), &config, RI_STRICT) == -1);
+   fputc('\n', stderr);
+   ri_schema_free(check_config_schema(), &config);
+
+   CHECK(ri_load_schema(check_path("missing.ini"), check_config_schema(), &config, 0) == -1);
+   fputc('\n', stderr);
+   ri_schema_free(check_config_schema(), &config);
+}
+
+/** *****************
+ * Counters         *
+ *******************/
+
+struct phase_run
+{
+   int begun[RI_PHASE_COUNT];
+   int ended[RI_PHASE_COUNT];
+};
+
+void count_phase(int phase, int end, void *data)
+{
+   struct phase_run *run = (struct phase_run*)data;
+
+   if (phase >= 0 && phase < RI_PHASE_COUNT)
+      ++(end ? run->ended : run->begun)[phase];
+}
+
+void count_read(const ri_Section *sections, void *data)
+{
+   ++*(int*)data;
+}
+
+/**
+ * Built with RI_STATS, as by "make STATS=1 check", the counters
+ * advance by the work of each load and lookup, and the trace hook
+ * sees each phase begin and end.  Built without it, the counters
+ * and the hook are refused.
+ */
+void check_stats(void)
+{
+   static const char text[] = "# comment\n[first]\nk1 = 1\nk2 = 2\n\n[second]\nk3 = 3\n";
+   const char *path = write_file("counted.ini", text);
+   struct phase_run phases;
+   const ri_Section *sections;
+   ri_Document *doc;
+   ri_Stats stats;
+   int calls = 0;
+
+   memset(&phases, 0, sizeof(phases));
+   ri_reset_stats();
+
+#ifdef RI_STATS
+   CHECK(ri_set_trace_hook(count_phase, &phases));
+
+   if (CHECK((doc = ri_load(path, RI_INDEX)) != NULL))
+   {
+      sections = ri_document_sections(doc);
+      CHECK(same(ri_find_section_value(sections, "first", "k2"), "2"));
+      CHECK(same(ri_find_section_value(sections, "second", "k3"), "3"));
+      ri_free(doc);
+   }
+
+   CHECK(ri_get_stats(&stats));
+   CHECK(stats.sections == 2 && stats.keys == 3 && stats.comment_lines == 1);
+   CHECK(stats.lines == 7);
+   CHECK(stats.lookups == 2 && stats.lookup_probes >= 2);
+
+   CHECK(phases.begun[RI_PHASE_READ] == 1 && phases.ended[RI_PHASE_READ] == 1);
+   CHECK(phases.begun[RI_PHASE_PARSE] == 1 && phases.ended[RI_PHASE_PARSE] == 1);
+   CHECK(phases.begun[RI_PHASE_INDEX] == 1 && phases.ended[RI_PHASE_INDEX] == 1);
+
+   // Files read through a descriptor count their reads:
+   ri_reset_stats();
+   ri_read_file(path, count_read, &calls);
+   CHECK(ri_get_stats(&stats) && calls == 1);
+   CHECK(stats.read_calls >= 1 && stats.bytes_read == strlen(text));
+   CHECK(stats.sections == 2 && stats.keys == 3);
+
+   CHECK(ri_set_trace_hook(NULL, NULL));
+#else
+   CHECK(!ri_set_trace_hook(count_phase, &phases));
+
+   if (CHECK((doc = ri_load(path, RI_INDEX)) != NULL))
+   {
+      sections = ri_document_sections(doc);
+      CHECK(same(ri_find_section_value(sections, "first", "k2"), "2"));
+      ri_free(doc);
+   }
+   ri_read_file(path, count_read, &calls);
+
+   // The counters read as 0, and the hook was never called:
+   CHECK(!ri_get_stats(&stats));
+   CHECK(stats.sections == 0 && stats.keys == 0 && stats.lines == 0 && stats.lookups == 0);
+   CHECK(phases.begun[RI_PHASE_READ] == 0 && phases.begun[RI_PHASE_PARSE] == 0);
+#endif
+}
+
+/** *****************
+ * Layers           *
+ *******************/
+
+/** @brief Make a directory of the check directory, returning its path. */
+const char *make_dir(const char *name)
+{
+   const char *path = check_path(name);
+
+   if (mkdir(path, 0700))
+   {
+      fprintf(stderr, "Failed to make \"%s\".\n", path);
+      exit(1);
+   }
+
+   return path;
+}
+
+/** @brief Check a document merged from the layers of *check_layers()*. */
+void check_merged(const ri_Document *doc, const char *level, int flags)
+{
+   const ri_Section *sections = ri_document_sections(doc), *section;
+
+   CHECK(count_sections(sections) == 3);
+   CHECK(same(ri_find_section_value(sections, "server", "host"), "main-host"));
+   CHECK(same(ri_find_section_value(sections, "server", "port"), "8080"));
+   CHECK(same(ri_find_section_value(sections, "logging", "level"), level));
+   CHECK(same(ri_find_section_value(sections, "extra", "key"), "b"));
+   CHECK(ri_find_section_value(sections, "server", "include") == NULL);
+
+   for (section = sections; section; section = section->next)
+   {
+      check_entries(section);
+      if (flags & RI_INTERN)
+         CHECK(ri_interned(doc, section->section_name) == section->section_name);
+   }
+
+   if (flags & RI_INTERN)
+      CHECK(ri_find_line(ri_get_section(sections, "server")->lines, "port")->tag
+            == ri_interned(doc, "port"));
+}
+
+/**
+ * Files are merged with the files and directories they include, so
+ * each tag has the value of the last file that sets it, with or
+ * without an index, interned names or sorted names.
+ */
+void check_layers(void)
+{
+   static const int flags[] = { 0, RI_INDEX, RI_INDEX | RI_INTERN, RI_SORTED };
+   const char *layers[2];
+   ri_Document *doc;
+   int index;
+
+   write_file("base.ini", "[server]\nhost : base-host\nport : 80\n[logging]\nlevel : info\n");
+   make_dir("conf.d");
+   write_file("conf.d/10-a.ini", "[server]\nport : 8080\n");
+   write_file("conf.d/20-b.ini", "[extra]\nkey : b\n");
+   write_file("conf.d/.hidden.ini", "[server]\nport : 1\n");
+   layers[0] = write_file("main.ini",
+                          "include = base.ini\n"
+                          "include-dir = conf.d\n"
+                          "include = main.ini\n"
+                          "[server]\nhost : main-host\n");
+   layers[1] = write_file("tenant.ini", "[logging]\nlevel : debug\n");
+
+   for (index = 0; index < (int)(sizeof(flags) / sizeof(flags[0])); ++index)
+   {
+      if (CHECK((doc = ri_load(layers[0], flags[index] | RI_INCLUDES)) != NULL))
+      {
+         check_merged(doc, "info", flags[index]);
+         ri_free(doc);
+      }
+
+      if (CHECK((doc = ri_load_layers(layers, 2, flags[index])) != NULL))
+      {
+         check_merged(doc, "debug", flags[index]);
+         ri_free(doc);
+      }
+   }
+
+   // Without RI_INCLUDES, the directives are lines outside any section:
+   if (CHECK((doc = ri_load(layers[0], 0)) != NULL))
+   {
+      CHECK(count_sections(ri_document_sections(doc)) == 1);
+      CHECK(ri_find_section_value(ri_document_sections(doc), "server", "port") == NULL);
+      ri_free(doc);
+   }
+
+   // A missing include fails the load, which the library reports:
+   layers[0] = write_file("broken.ini", "include = absent.ini\n[server]\nport : 1\n");
+   CHECK(ri_load(layers[0], RI_INCLUDES) == NULL);
+   fputc('\n', stderr);
+}
+
+/** *****************
+ * Directories      *
+ *******************/
+
+#define DIR_FILES 150
+#define LONG_FILE_LINES 1000
+
+/**
+ * Every regular file of a directory, but hidden ones, is loaded as
+ * its own document, in order of name, whatever the number of threads,
+ * including more files than are read at once and a file longer than
+ * one read.
+ */
+void check_dir_loader(void)
+{
+   static const int threads[] = { 1, 3, 0 };
+   const char *dirpath = make_dir("tenants");
+   char name[48], text[64], *long_text;
+   const ri_Document *doc;
+   ri_Directory *dir;
+   int index, run;
+
+   for (index = 0; index < DIR_FILES; ++index)
+   {
+      sprintf(name, "tenants/t%03d.ini", index);
+      sprintf(text, "[tenant]\nid : %d\n", index);
+      write_file(name, text);
+   }
+
+   write_file("tenants/.hidden.ini", "[tenant]\nid : hidden\n");
+   make_dir("tenants/sub.ini");
+
+   if (!CHECK((long_text = (char*)malloc(LONG_FILE_LINES * 24 + 16)) != NULL))
+      return;
+
+   strcpy(long_text, "[long]\n");
+   for (index = 0; index < LONG_FILE_LINES; ++index)
+      sprintf(long_text + strlen(long_text), "key%d : value %d\n", index, index);
+   write_file("tenants/z-long.ini", long_text);
+   free(long_text);
+
+   for (run = 0; run < (int)(sizeof(threads) / sizeof(threads[0])); ++run)
+   {
+      if (!CHECK((dir = ri_load_dir(dirpath, run ? RI_INDEX : 0, threads[run])) != NULL))
+         continue;
+
+      CHECK(ri_dir_count(dir) == DIR_FILES + 1);
+      for (index = 0; index < DIR_FILES && index < ri_dir_count(dir); ++index)
+      {
+         sprintf(name, "t%03d.ini", index);
+         sprintf(text, "%d", index);
+         doc = ri_dir_document(dir, index);
+         CHECK(same(ri_dir_name(dir, index), name));
+         CHECK(same(ri_find_section_value(ri_document_sections(doc), "tenant", "id"), text));
+         CHECK(ri_dir_find(dir, name) == doc);
+      }
+
+      doc = ri_dir_find(dir, "z-long.ini");
+      if (CHECK(doc != NULL))
+      {
+         CHECK(same(ri_find_section_value(ri_document_sections(doc), "long", "key0"), "value 0"));
+         CHECK(same(ri_find_section_value(ri_document_sections(doc), "long", "key999"), "value 999"));
+      }
+
+      CHECK(ri_dir_find(dir, ".hidden.ini") == NULL);
+      CHECK(ri_dir_find(dir, "sub.ini") == NULL);
+      CHECK(ri_dir_find(dir, "absent.ini") == NULL);
+      ri_dir_free(dir);
+   }
+}
+
+/** *****************
+ * Lazy sections    *
+ *******************/
+
+#define LAZY_THREADS 4
+
+const char lazy_text[] =
+   "before : any section\n"
+   "[first]\n"
+   "key : [not a head]\n"
+   "# [not a head either]\n"
+   "other : 1\n"
+   "   [indented]\n"
+   "key : indented value\n"
+   "[empty]\n"
+   "[first]\n"
+   "key : repeated\n"
+   "extra : 2\n"
+   "[last]\n"
+   "key : end";
+
+struct lazy_run
+{
+   const ri_Document *doc;
+   long errors;
+};
+
+/** @brief Lookups racing other threads to parse the same sections. */
+void *lazy_lookups(void *arg)
+{
+   struct lazy_run *run = (struct lazy_run*)arg;
+   const ri_Section *sections = ri_document_sections(run->doc);
+   long errors = 0;
+
+   errors += !same(ri_find_section_value(sections, "last", "key"), "end");
+   errors += !same(ri_find_section_value(sections, "first", "other"), "1");
+   errors += !same(ri_find_section_value(sections, "indented", "key"), "indented value");
+   errors += !same(ri_find_section_value(sections, "first", "extra"), "2");
+
+   __atomic_fetch_add(&run->errors, errors, __ATOMIC_RELAXED);
+   return NULL;
+}
+
+/**
+ * A lazy section has no lines until it is found, and then has the
+ * lines it would have had if loaded at once, however it is found,
+ * and by however many threads at once.
+ */
+void check_lazy(void)
+{
+   static const int flags[] = { RI_LAZY, RI_LAZY | RI_INDEX, RI_LAZY | RI_MMAP,
+                                RI_LAZY | RI_INTERN, RI_LAZY | RI_SORTED };
+   const char *path = write_file("lazy.ini", lazy_text);
+   const ri_Section *section, *expected;
+   ri_Document *eager, *doc;
+   pthread_t threads[LAZY_THREADS];
+   struct lazy_run run;
+   ri_Entry_Iter iter;
+   int index, started;
+
+   if (!CHECK((eager = ri_load(path, 0)) != NULL))
+      return;
+
+   CHECK(count_sections(ri_document_sections(eager)) == 5);
+
+   for (index = 0; index < (int)(sizeof(flags) / sizeof(flags[0])); ++index)
+   {
+      if (!CHECK((doc = ri_load(path, flags[index])) != NULL))
+         continue;
+
+      section = ri_document_sections(doc);
+      for (expected = ri_document_sections(eager); section && expected;
+           section = section->next, expected = expected->next)
+      {
+         CHECK(same(section->section_name, expected->section_name));
+         CHECK(section->lines == NULL);
+
+         // Finding the entries parses the section in place:
+         CHECK(ri_entries(section, &iter) == (expected->lines != NULL));
+         check_same_lines(section->lines, expected->lines);
+         check_entries(section);
+      }
+      CHECK(!section && !expected);
+
+      CHECK(same(ri_find_section_value(ri_document_sections(doc), "first", "key"),
+                 "[not a head]"));
+      ri_free(doc);
+
+      // Sections parsed by the first of several threads to find them:
+      if (!CHECK((doc = ri_load(path, flags[index])) != NULL))
+         continue;
+
+      run.doc = doc;
+      run.errors = 0;
+      for (started = 0; started < LAZY_THREADS; ++started)
+         if (!CHECK(0 == pthread_create(&threads[started], NULL, lazy_lookups, &run)))
+            break;
+      while (started)
+         pthread_join(threads[--started], NULL);
+      CHECK(run.errors == 0);
+
+      ri_free(doc);
+   }
+
+   ri_free(eager);
+}
+
+/** *****************
+ * Interning        *
+ *******************/
+
+const char intern_text[] =
+   "[tenant]\nkey : a\nport : 1\n"
+   "[other]\nkey : b\n"
+   "[tenant]\nkey : c\nextra : d\n";
+
+/** @brief Return the lines of a section, parsing it first if it is lazy. */
+const ri_Line *found_lines(const ri_Section *section)
+{
+   ri_Entry_Iter iter;
+
+   ri_entries(section, &iter);
+   return section->lines;
+}
+
+/** @brief Check the shared names of a document loaded from *intern_text*. */
+void check_interned_names(const ri_Document *doc)
+{
+   const ri_Section *sections = ri_document_sections(doc), *section;
+   const char *tenant, *key;
+
+   // The tags of lazy sections are interned as the sections are parsed:
+   for (section = sections; section; section = section->next)
+      found_lines(section);
+
+   tenant = ri_interned(doc, "tenant");
+   key = ri_interned(doc, "key");
+   CHECK(tenant != NULL && key != NULL);
+   CHECK(ri_interned(doc, "absent") == NULL);
+
+   for (section = sections; section; section = section->next)
+   {
+      CHECK(section->section_name == ri_interned(doc, section->section_name));
+      CHECK(section->lines->tag == key);
+   }
+
+   CHECK(sections && sections->section_name == tenant);
+   CHECK(sections && sections->next && sections->next->next
+         && sections->next->next->section_name == tenant);
+
+   CHECK(same(ri_document_value(doc, "tenant", "key"), "a"));
+   CHECK(same(ri_document_value(doc, "tenant", "extra"), "d"));
+   CHECK(same(ri_document_value(doc, "other", "key"), "b"));
+   CHECK(ri_document_value(doc, "other", "port") == NULL);
+   CHECK(ri_document_value(doc, "absent", "key") == NULL);
+   CHECK(same(ri_find_section_value(sections, "tenant", "port"), "1"));
+}
+
+/**
+ * Each distinct name has one copy, given by *ri_interned()*, which
+ * lookups find whether it was given or not, and a watcher keeps the
+ * copy of a name the same across reloads.
+ */
+void check_intern(void)
+{
+   static const int flags[] = { RI_INTERN, RI_INTERN | RI_INDEX, RI_INTERN | RI_LAZY };
+   const char *path = write_file("intern.ini", intern_text);
+   const char *key, *added;
+   const ri_Document *current;
+   ri_Watcher *watcher;
+   ri_Document *doc;
+   int index, token;
+
+   for (index = 0; index < (int)(sizeof(flags) / sizeof(flags[0])); ++index)
+   {
+      if (CHECK((doc = ri_load(path, flags[index])) != NULL))
+      {
+         check_interned_names(doc);
+         ri_free(doc);
+      }
+   }
+
+   if (CHECK((doc = ri_load(path, 0)) != NULL))
+   {
+      CHECK(ri_interned(doc, "key") == NULL);
+      ri_free(doc);
+   }
+
+   if (!CHECK((watcher = ri_watch(path, RI_INTERN | RI_INDEX)) != NULL))
+      return;
+
+   current = ri_watch_acquire(watcher, &token);
+   key = ri_interned(current, "key");
+   CHECK(ri_interned(current, "added") == NULL);
+   ri_watch_release(watcher, token);
+
+   // Replace the file in one step, so no reload sees it half written:
+   write_file("intern.tmp", "[added]\nkey : new\n");
+   CHECK(0 == rename(check_path("intern.tmp"), path));
+   CHECK(ri_watch_reload(watcher));
+
+   current = ri_watch_acquire(watcher, &token);
+   added = ri_interned(current, "added");
+   CHECK(ri_interned(current, "key") == key);
+   CHECK(added != NULL && ri_document_sections(current)->section_name == added);
+   CHECK(ri_document_sections(current)->lines->tag == key);
+   CHECK(same(ri_document_value(current, "added", "key"), "new"));
+   ri_watch_release(watcher, token);
+
+   ri_unwatch(watcher);
+}
+
+/** *****************
+ * Sorted queries   *
+ *******************/
+
+const char sorted_text[] =
+   "[tenant-b]\nid : 1\n"
+   "[other]\n"
+   "upstream.port : 80\nname : x\nupstream.host : h\nupstream.port : 81\nupstreams : no\n"
+   "[tenant-a]\nid : 2\n"
+   "[tenant-b]\nid : 3\n"
+   "[tenant-ab]\nid : 4\n"
+   "[star*]\nid : 5\n";
+
+/** @brief List the sections matching a pattern, as "name:id " for each, or "name:- ". */
+const char *matched_sections(const ri_Document *doc, const char *pattern)
+{
+   static char list[256];
+   const ri_Section *section;
+   const char *id;
+   ri_Match_Iter iter;
+
+   list[0] = '\0';
+   if (ri_match_sections(doc, pattern, &iter))
+      while ((section = ri_next_section(&iter)))
+      {
+         id = ri_find_value(found_lines(section), "id");
+         sprintf(list + strlen(list), "%s:%s ", section->section_name, id ? id : "-");
+      }
+
+   return list;
+}
+
+/** @brief List the lines of a section matching a pattern, as "tag=value " for each. */
+const char *matched_lines(const ri_Section *section, const char *pattern)
+{
+   static char list[256];
+   const ri_Line *line;
+   ri_Match_Iter iter;
+
+   list[0] = '\0';
+   if (ri_match_lines(section, pattern, &iter))
+      while ((line = ri_next_line(&iter)))
+         sprintf(list + strlen(list), "%s=%s ", line->tag, line->value);
+
+   return list;
+}
+
+/**
+ * Sections and lines are found by wildcard patterns in order of
+ * name, those of the same name in file order, with or without an
+ * index, and when parsed lazily.
+ */
+void check_sorted(void)
+{
+   static const int flags[] = { RI_SORTED, RI_SORTED | RI_INDEX, RI_SORTED | RI_LAZY,
+                                RI_SORTED | RI_INTERN };
+   const char *path = write_file("sorted.ini", sorted_text);
+   const ri_Section *other;
+   ri_Match_Iter iter;
+   ri_Document *doc;
+   int index;
+
+   for (index = 0; index < (int)(sizeof(flags) / sizeof(flags[0])); ++index)
+   {
+      if (!CHECK((doc = ri_load(path, flags[index])) != NULL))
+         continue;
+
+      CHECK(same(matched_sections(doc, "tenant-*"), "tenant-a:2 tenant-ab:4 tenant-b:1 tenant-b:3 "));
+      CHECK(same(matched_sections(doc, "tenant-?"), "tenant-a:2 tenant-b:1 tenant-b:3 "));
+      CHECK(same(matched_sections(doc, "*b"), "tenant-ab:4 tenant-b:1 tenant-b:3 "));
+      CHECK(same(matched_sections(doc, "tenant-[a]*"), "tenant-a:2 tenant-ab:4 "));
+      CHECK(same(matched_sections(doc, "star\\*"), "star*:5 "));
+      CHECK(same(matched_sections(doc, "other"), "other:- "));
+      CHECK(same(matched_sections(doc, "absent*"), ""));
+
+      other = ri_get_section(ri_document_sections(doc), "other");
+      CHECK(same(matched_lines(other, "upstream.*"),
+                 "upstream.host=h upstream.port=80 upstream.port=81 "));
+      CHECK(same(matched_lines(other, "*"),
+                 "name=x upstream.host=h upstream.port=80 upstream.port=81 upstreams=no "));
+      CHECK(same(matched_lines(other, "upstream?"), "upstreams=no "));
+      CHECK(same(matched_lines(other, "port"), ""));
+
+      ri_free(doc);
+   }
+
+   // Without RI_SORTED, nothing matches:
+   if (CHECK((doc = ri_load(path, RI_INDEX)) != NULL))
+   {
+      CHECK(!ri_match_sections(doc, "*", &iter) && ri_next_section(&iter) == NULL);
+      CHECK(!ri_match_lines(ri_document_sections(doc), "*", &iter) && ri_next_line(&iter) == NULL);
+      ri_free(doc);
+   }
+}
+
+/** *****************
+ * Running checks   *
+ *******************/
+
+struct check
+{
+   const char *name;
+   void (*run)(void);
+};
+
+const struct check checks[] = {
+   { "block reads", check_block_reads },
+   { "mapped reads", check_mapped_reads },
+   { "loaded documents", check_loaded_documents },
+   { "deep file", check_deep_file },
+   { "indexed lookups", check_index },
+   { "section reads", check_section_reads },
+   { "entries", check_document_entries },
+   { "scan kernels", check_scan_kernels },
+   { "hot reload", check_watch },
+   { "parallel loads", check_parallel },
+   { "events", check_events },
+   { "push parser", check_push_parser },
+   { "load from a pipe", check_load_fd },
+   { "cache", check_cache },
+   { "long lines", check_long_lines },
+   { "typed values", check_typed },
+   { "batch lookups", check_batch },
+   { "schema", check_schema },
+   { "counters", check_stats },
+   { "layers", check_layers },
+   { "directory", check_dir_loader },
+   { "lazy sections", check_lazy },
+   { "interning", check_intern },
+   { "sorted queries", check_sorted },
+   { NULL, NULL }
+};
+
+int main(int argc, char** argv)
+{
+   const struct check *check;
+   int before;
+
+   if (!mkdtemp(check_dir))
+   {
+      fprintf(stderr, "Failed to make a directory for check files.\n");
+      return 1;
+   }
+
+   for (check = checks; check->name; ++check)
+   {
+      before = failures;
+      (*check->run)();
+      printf("%-24s %s\n", check->name, failures == before ? "ok" : "FAILED");
+      fflush(stdout);
+   }
+
+   remove_files();
+
+   if (failures)
+      printf("%d checks failed.\n", failures);
+
+   return failures ? 1 : 0;
+}
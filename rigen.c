@@ -0,0 +1,137 @@
+// -*- compile-command: "cc -Wall -Werror -ggdb -o rigen rigen.c" -*-
+
+/**
+ * Generator of synthetic configuration files for benchmarking.
+ *
+ * Sections are named "section-N" and tags "key-N", so any file can
+ * be reproduced from its parameters and seed.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>  // for strtoul(), exit()
+#include <string.h>
+#include <unistd.h>  // for getopt()
+
+struct gen_params
+{
+   unsigned long sections;
+   unsigned long keys;         // keys per section
+   unsigned long value_len;    // average length of values
+   unsigned long comments;     // percent of lines with comments
+   const char *style;          // colon, space, equals or mixed
+   unsigned long seed;
+   const char *path;
+};
+
+/** @brief Small deterministic generator, so a seed always gives the same file. */
+unsigned long next_random(unsigned long *state)
+{
+   unsigned long x = *state;
+   x ^= x << 13;
+   x ^= x >> 7;
+   x ^= x << 17;
+   return *state = x;
+}
+
+const char *pick_separator(const char *style, unsigned long *state)
+{
+   static const char *separators[] = { " : ", " ", " = " };
+
+   if (0 == strcmp(style, "colon"))
+      return separators[0];
+   else if (0 == strcmp(style, "space"))
+      return separators[1];
+   else if (0 == strcmp(style, "equals"))
+      return separators[2];
+   else
+      return separators[next_random(state) % 3];
+}
+
+void write_value(FILE *out, unsigned long len, unsigned long *state)
+{
+   static const char chars[] = "abcdefghijklmnopqrstuvwxyz0123456789/._-";
+   unsigned long i;
+
+   for (i = 0; i < len; ++i)
+      fputc(chars[next_random(state) % (sizeof(chars) - 1)], out);
+}
+
+int generate(const struct gen_params *params)
+{
+   unsigned long state = params->seed ? params->seed : 1;
+   unsigned long section, key, len;
+   FILE *out = stdout;
+
+   if (params->path && !(out = fopen(params->path, "w")))
+   {
+      fprintf(stderr, "Failed to open \"%s\".\n", params->path);
+      return 1;
+   }
+
+   fprintf(out, "# Generated by rigen: %lu sections, %lu keys, seed %lu\n",
+           params->sections, params->keys, params->seed);
+
+   for (section = 0; section < params->sections; ++section)
+   {
+      fprintf(out, "\n[section-%lu]\n", section);
+
+      for (key = 0; key < params->keys; ++key)
+      {
+         if (next_random(&state) % 100 < params->comments)
+            fprintf(out, "# comment preceding key-%lu\n", key);
+
+         fprintf(out, "key-%lu%s", key, pick_separator(params->style, &state));
+
+         // Vary value lengths between half and one-and-a-half the average
+         len = params->value_len / 2 + next_random(&state) % (params->value_len + 1);
+         write_value(out, len, &state);
+
+         if (next_random(&state) % 100 < params->comments)
+            fputs("   # trailing comment", out);
+
+         fputc('\n', out);
+      }
+   }
+
+   if (out != stdout)
+      fclose(out);
+
+   return 0;
+}
+
+void show_usage(void)
+{
+   printf("Usage: rigen [options]\n"
+          "  -s count   number of sections (default 100)\n"
+          "  -k count   keys per section (default 10)\n"
+          "  -l length  average value length (default 24)\n"
+          "  -c percent percent of lines with comments (default 10)\n"
+          "  -S style   separator: colon, space, equals or mixed (default mixed)\n"
+          "  -r seed    random seed (default 1)\n"
+          "  -o path    output file (default stdout)\n");
+}
+
+int main(int argc, char** argv)
+{
+   struct gen_params params = { 100, 10, 24, 10, "mixed", 1, NULL };
+   int opt;
+
+   while ((opt = getopt(argc, argv, "s:k:l:c:S:r:o:h")) != -1)
+   {
+      switch (opt)
+      {
+         case 's': params.sections = strtoul(optarg, NULL, 10); break;
+         case 'k': params.keys = strtoul(optarg, NULL, 10); break;
+         case 'l': params.value_len = strtoul(optarg, NULL, 10); break;
+         case 'c': params.comments = strtoul(optarg, NULL, 10); break;
+         case 'S': params.style = optarg; break;
+         case 'r': params.seed = strtoul(optarg, NULL, 10); break;
+         case 'o': params.path = optarg; break;
+         default:
+            show_usage();
+            return opt == 'h' ? 0 : 1;
+      }
+   }
+
+   return generate(&params);
+}
@@ -141,18 +141,51 @@ void use_file_to_read(int fd, void* data)
 }
 
 
+/** ****************************************
+ * Demonstration of Persistent Document Usage *
+ ******************************************/
 
+/**
+ * @brief Demonstration of a document that outlives the call
+ *        that loaded it, as in a long-running service.
+ */
+ri_Document* load_document(const char *path)
+{
+   ri_Document *doc = ri_load(path, RI_INDEX);
+   if (!doc)
+      printf("Failed to load \"%s\".\n", path);
+
+   return doc;
+}
+
+void use_document(const ri_Document *doc)
+{
+   const ri_Section *sections = ri_document_sections(doc);
 
+   printf("Getting global/mailhost : '%s'.\n",
+          ri_find_section_value(sections, "global", "mailhost"));
+   printf("Getting fake/user : '%s'.\n",
+          ri_find_section_value(sections, "fake", "user"));
+}
 
 int main(int argc, char** argv)
 {
+   ri_Document *doc;
+
    printf("[32;1mTesting recommended full-read configuration file pattern.\n[m");
    ri_read_file("./demo.ini", use_sections, NULL);
 
    // Test service function
    printf("\n\n[32;1mTesting alternate sparse section reading pattern.\n[m");
    ri_open("./demo.ini", use_file_to_read, NULL);
-   
+
+   printf("\n\n[32;1mTesting persistent document pattern.\n[m");
+   if ((doc = load_document("./demo.ini")))
+   {
+      use_document(doc);
+      ri_free(doc);
+   }
+
    return 0;
 }
 